@@ -0,0 +1,23 @@
+# usage: cmake -DTACHYON=<tachyon> -DEXAMPLES=<dir> -DREPORT=<file> -P profile_examples.cmake
+#
+# each run of a profiling build merges its counts into the file named by TACHYON_PROFILE, so the
+# report starts empty and grows with every example. examples that fail are reported and skipped.
+
+file(REMOVE ${REPORT})
+file(GLOB_RECURSE examples ${EXAMPLES}/*.tachyon)
+list(SORT examples)
+
+foreach (example ${examples})
+    execute_process(
+            COMMAND ${CMAKE_COMMAND} -E env TACHYON_PROFILE=${REPORT} ${TACHYON} run ${example}
+            RESULT_VARIABLE result
+            OUTPUT_QUIET
+            ERROR_QUIET
+            TIMEOUT 600
+    )
+    if (NOT result EQUAL 0)
+        message(STATUS "skipped ${example}: ${result}")
+    endif ()
+endforeach ()
+
+message(STATUS "profile written to ${REPORT}")
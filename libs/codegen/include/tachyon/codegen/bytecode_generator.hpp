@@ -4,10 +4,104 @@
 #include "tachyon/runtime/bytecode.hpp"
 #include "tachyon/runtime/vm.hpp"
 
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
 namespace tachyon::codegen {
+/**
+ * @brief constant pool of a module that is being generated
+ *
+ * Every function of a module indexes the same pool. Constants are interned as they are added, so
+ * identical numbers, strings, matrices and functions are stored once, however many functions use
+ * them. Functions are identical if their name, bytecode and frame layout are, which, since their
+ * constants are interned as well, means that they were generated from the same source and bound to
+ * the same name.
+ *
+ * The pool refers to its functions without owning them, and so do the values that are copied from
+ * it, since a function may hold values that refer to itself, in its memoization cache or in the
+ * registers of a call. The top-level function of the module owns them instead, see
+ * take_functions.
+ */
+class ConstantPoolBuilder {
+    /**
+     * @brief constant equality for interning, which unlike Value::operator== keeps 0 and -0 apart
+     */
+    struct SameConstant {
+        bool operator()(const runtime::Value &a, const runtime::Value &b) const {
+            if (a.is_double() && b.is_double())
+                return std::bit_cast<uint64_t>(a.as_double()) ==
+                       std::bit_cast<uint64_t>(b.as_double());
+            return a == b;
+        }
+    };
+
+    /// name, bytecode, arguments, registers, is_pure and can_generate_irmc of a function
+    using FunctionKey =
+        std::tuple<std::string, std::vector<uint16_t>, size_t, size_t, bool, bool>;
+
+    /// the pool that is being built
+    std::shared_ptr<runtime::ConstantPool> pool = std::make_shared<runtime::ConstantPool>();
+
+    /// indices of the values in the pool, other than functions
+    std::unordered_map<runtime::Value, size_t, runtime::ValueHash, SameConstant> values;
+
+    /// indices of the functions in the pool
+    std::map<FunctionKey, size_t> functions;
+
+    /// the functions in the pool, until the top-level function takes them
+    std::vector<std::shared_ptr<runtime::Proto>> owned_functions;
+
+  public:
+    /**
+     * @brief add a value, unless an identical one is already in the pool
+     * @return index of the value
+     */
+    size_t add(runtime::Value value);
+
+    /**
+     * @brief add a value that is never shared with other constants, such as the template of a
+     *  matrix literal, whose elements are only filled in at run time
+     * @return index of the value
+     */
+    size_t append(runtime::Value value);
+
+    /**
+     * @brief add a function, unless an identical one is already in the pool
+     * @return index of the function
+     */
+    size_t add(runtime::Proto fn);
+
+    /**
+     * @brief constant at an index
+     */
+    runtime::Value &operator[](size_t index) { return (*pool)[index]; }
+
+    /**
+     * @brief owning pointer to the pool, for the top-level function of the module
+     */
+    [[nodiscard]] std::shared_ptr<runtime::ConstantPool> share() const { return pool; }
+
+    /**
+     * @brief non-owning pointer to the pool, for the functions nested in the module, which the
+     *  pool holds in turn
+     */
+    [[nodiscard]] std::shared_ptr<runtime::ConstantPool> borrow() const {
+        return {std::shared_ptr<runtime::ConstantPool>(), pool.get()};
+    }
+
+    /**
+     * @brief owning pointers to the functions in the pool, for the top-level function of the
+     *  module
+     */
+    [[nodiscard]] std::vector<std::shared_ptr<runtime::Proto>> take_functions() {
+        return std::move(owned_functions);
+    }
+};
+
 /**
  * @brief generate bytecode from abstract syntax tree
  *
@@ -29,12 +123,38 @@ struct BytecodeGenerator {
     size_t next_free_register = 1;
     uint16_t curr = 0;
 
+    /// name of the variable that the function being generated is bound to, see LetExpr
+    std::string function_name;
+
+    /**
+     * @brief generate a condition followed by a jump that is taken when it is false
+     * @param condition condition expression
+     * @return position of the jump target, to be filled in by the caller
+     *
+     * Comparisons are fused with the jump, otherwise the condition is evaluated and then tested.
+     */
+    size_t generate_branch_unless(const parser::Expr &condition);
+
+    /**
+     * @brief generate a function call, leaving the result in register 0
+     * @param fnc function call expression
+     * @param tail whether the call is the operand of a return, so that the VM can run the callee
+     *  in the frame of this function
+     */
+    void generate_call(const parser::FnCallExpr &fnc, bool tail);
+
+    /**
+     * @brief address of a constant as an operand, recording an error if it does not fit in one
+     * @param index index of the constant in the pool
+     */
+    uint16_t constant_address(size_t index);
+
   public:
     /// list of bytecode instructions
     std::vector<uint16_t> bc = {};
 
-    /// constant lookup table
-    std::vector<runtime::Value> constants = {};
+    /// constant pool of the module, shared with the generators of nested functions
+    std::shared_ptr<ConstantPoolBuilder> constants = std::make_shared<ConstantPoolBuilder>();
 
     /// variable name lookup table
     // TODO: is this the best way to do this? consider how it is finding vars by
@@ -52,6 +172,11 @@ struct BytecodeGenerator {
 
     BytecodeGenerator() = default;
 
+    /**
+     * @brief number of registers used so far, i.e. the register high-water mark
+     */
+    [[nodiscard]] size_t register_count() const { return next_free_register; }
+
     /**
      * @brief preload a variable name lookup table, for function argument names
      * @param vars existing variable name lookup table
@@ -61,6 +186,17 @@ struct BytecodeGenerator {
         next_free_register = this->vars.size() + 1;
     };
 
+    /**
+     * @brief generate a function nested in a module
+     * @param constants constant pool of the module
+     * @param vars existing variable name lookup table, for function argument names
+     */
+    BytecodeGenerator(std::shared_ptr<ConstantPoolBuilder> constants,
+                      std::unordered_map<std::string, size_t> vars)
+        : constants(std::move(constants)), vars(std::move(vars)) {
+        next_free_register = this->vars.size() + 1;
+    };
+
     void operator()(const parser::LiteralExpr &lit);
     void operator()(const parser::FnExpr &fn);
     void operator()(const parser::UnaryOperatorExpr &unop);
@@ -80,38 +216,47 @@ struct BytecodeGenerator {
     void operator()(const parser::SequenceExpr &seq);
 };
 
-/**
- * @brief generate bytecode from abstract syntax tree
- * @param e abstract syntax tree
- * @return function prototype object or error
- */
-inline std::expected<runtime::Proto, Error> generate_proto(parser::Expr e) {
-    BytecodeGenerator generator;
-    std::visit(generator, e.kind);
-    if (!generator.errors.empty()) return std::unexpected(Error::createMultiple(generator.errors));
-    return runtime::Proto(generator.bc, std::move(generator.constants), 0, generator.is_pure,
-                          generator.can_generate_irmc, "<main>", e.span);
-}
-
 /**
  * @brief generate bytecode from abstract syntax tree, with preloaded variable names for arguments
  * @param e abstract syntax tree
  * @param args ordered list of argument names
+ * @param constants constant pool of the module that the function is nested in, or nullptr to
+ *  generate the top-level function of a new module
  * @return function prototype object or error
  */
-inline std::expected<runtime::Proto, Error> generate_proto(parser::Expr e,
-                                                           std::vector<std::string> args) {
+inline std::expected<runtime::Proto, Error>
+generate_proto(parser::Expr e, std::vector<std::string> args,
+               std::shared_ptr<ConstantPoolBuilder> constants = nullptr) {
     size_t size = args.size();
     std::unordered_map<std::string, size_t> map;
     for (size_t i = 1; i <= size; ++i) {
         map[args[i - 1]] = i;
     }
 
-    BytecodeGenerator generator(std::move(map));
+    const bool nested = constants != nullptr;
+    BytecodeGenerator generator(nested ? std::move(constants)
+                                       : std::make_shared<ConstantPoolBuilder>(),
+                                std::move(map));
     std::visit(generator, e.kind);
     if (!generator.errors.empty()) return std::unexpected(Error::createMultiple(generator.errors));
-    return runtime::Proto(generator.bc, std::move(generator.constants), size, generator.is_pure,
-                          generator.can_generate_irmc, "<main>", e.span);
+    runtime::Proto proto(generator.bc, {}, size, generator.is_pure, generator.can_generate_irmc,
+                         "<main>", e.span, generator.register_count());
+    if (nested) {
+        proto.constants = generator.constants->borrow();
+    } else {
+        proto.constants = generator.constants->share();
+        proto.functions = generator.constants->take_functions();
+    }
+    return proto;
+}
+
+/**
+ * @brief generate bytecode from abstract syntax tree
+ * @param e abstract syntax tree
+ * @return function prototype object or error
+ */
+inline std::expected<runtime::Proto, Error> generate_proto(parser::Expr e) {
+    return generate_proto(std::move(e), {});
 }
 
 /**
@@ -137,6 +282,8 @@ inline std::expected<runtime::Proto, Error> generate_repl_proto(parser::Expr e)
     return generate_proto(std::move(e)).transform([](runtime::Proto proto) {
         proto.is_pure = false;
         proto.can_generate_irmc = false;
+        // the vm echoes the operand right before this when it reaches the end of the source.
+        proto.bytecode.push_back(runtime::RETV);
         return proto;
     });
 }
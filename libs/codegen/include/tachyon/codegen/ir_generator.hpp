@@ -1,60 +1,191 @@
 #pragma once
 #include "tachyon/common/error.hpp"
+#include "tachyon/common/op.hpp"
 #include "tachyon/runtime/proto.hpp"
 
 #include <cstdint>
 #include <expected>
-#include <utility>
+#include <string>
 #include <vector>
 
 namespace tachyon::codegen {
-enum class IRPointerKind {
-    Constant,
-    Register,
+/**
+ * @brief type of an IR value, as far as it is known when the function is compiled
+ */
+enum class IRType : uint8_t {
+    Any, // any kind of value, decided at run time
+    Nil,
+    Double,
+    String,
+    Bool,
+    Matrix,
+    Function,
 };
 
-struct IRPointer {
-    IRPointerKind kind;
-    uint16_t value;
-};
+/**
+ * @brief type of the values of a kind
+ */
+IRType ir_type_of(runtime::Value::Kind kind);
 
-inline IRPointer make_register(const uint16_t value) {
-    return IRPointer{IRPointerKind::Register, value};
-}
+/**
+ * @brief IR value, as the index of the instruction that defines it in IRFunction::instructions
+ */
+using IRValue = uint32_t;
 
-inline IRPointer make_constant(const uint16_t value) {
-    return IRPointer{IRPointerKind::Constant, value};
-}
+/**
+ * @brief operation of an IR instruction
+ *
+ * Binary operations take their left and right operands, in the order of parser::Op for each group.
+ * Lists are values, so instructions that change one produce the changed list as a new value.
+ */
+enum class IROpcode : uint8_t {
+    Parameter, // value of register `immediate` when the function is entered
+    Constant,  // constant `immediate` of the constant pool
+    Phi,       // value from the predecessor that control came from, one operand per predecessor
 
-enum class IRNodeKind {
+    // number -> double
     Add,
     Sub,
     Mul,
     Div,
-    Ret,
+    Pow,
+
+    // number comparison -> bool
+    Eq,
+    Neq,
+    Lst,
+    Grt,
+    Lset,
+    Gret,
+
+    // boolean -> bool
+    Not,
+    And,
+    Or,
+
+    Push,  // list, double -> list with the double appended
+    Pop,   // list -> list without its last element
+    Last,  // list -> last element of list
+    Load,  // list, row, column -> element
+    Store, // list, row, column, double -> list with the element replaced
+
+    Call,     // callee, arguments... -> result
+    TailCall, // callee, arguments... -> result, in the frame of the caller
+    Print,    // value
+
+    // terminators, which end every block
+    Jump,   // to the only successor
+    Branch, // condition, to the first successor if it holds and to the second otherwise
+    Return, // value, or nothing to return nil
 };
 
-struct IRNode {
-    IRNodeKind kind;
-    IRPointer lhs;
-    IRPointer rhs;
-    IRPointer dst;
+/**
+ * @brief whether an opcode ends a block
+ */
+constexpr bool is_terminator(IROpcode opcode) {
+    return opcode == IROpcode::Jump || opcode == IROpcode::Branch || opcode == IROpcode::Return;
+}
+
+/**
+ * @brief name of an opcode, as printed by to_string
+ */
+const char *ir_opcode_to_str(IROpcode opcode);
+
+/**
+ * @brief IR opcode of the operation of a family opcode, see runtime::OpcodeFamily
+ */
+IROpcode family_opcode(parser::Op operation);
+
+/**
+ * @brief IR instruction, which defines the value of its index in the function
+ */
+struct IRInstruction {
+    IROpcode opcode;
+
+    /// type of the value that the instruction defines
+    IRType type = IRType::Any;
+
+    /// index of the block that holds the instruction
+    uint32_t block = 0;
+
+    /// values that the instruction takes
+    std::vector<IRValue> operands = {};
+
+    /// register of a Parameter, or index of a Constant in IRFunction::constants
+    uint32_t immediate = 0;
 };
 
-class IRArena {
-    std::vector<IRNode> nodes;
+/**
+ * @brief basic block, a run of instructions that is only entered at its start
+ */
+struct IRBlock {
+    /// instructions in order, phis first and a terminator last
+    std::vector<IRValue> instructions = {};
+
+    /// blocks that jump here, in the order of the operands of the phis of this block
+    std::vector<uint32_t> predecessors = {};
+
+    /// blocks that the terminator jumps to, see IROpcode::Branch for the order
+    std::vector<uint32_t> successors = {};
+
+    /// index of the decoded bytecode instruction that the block starts at
+    uint32_t start = 0;
+};
 
+/**
+ * @brief function in static single assignment form
+ *
+ * Every value is defined by one instruction, and registers that hold different values where
+ * control flow joins are merged by phis. Instructions are allocated in one arena for the whole
+ * function, and blocks list the ones that they hold. Instructions that a block no longer lists are
+ * dead, but keep their index. The entry is block 0, which has no predecessors and holds the
+ * parameters. Blocks that can not be reached are not generated.
+ */
+class IRFunction {
   public:
-    void alloc(const IRNode &node) { nodes.push_back(node); }
+    std::vector<IRInstruction> instructions;
 
-    template <class... Args> void emplace(Args &&...args) {
-        nodes.emplace_back(std::forward<Args>(args)...);
-    }
+    std::vector<IRBlock> blocks;
+
+    /// number of registers of the function, which the parameters index
+    size_t registers = 0;
+
+    /// constants that the function uses, in the order that it uses them, followed by those that
+    /// optimizations made
+    runtime::ConstantPool constants;
 
-    [[nodiscard]] size_t size() const { return nodes.size(); }
+    /**
+     * @brief add an instruction to the end of a block
+     * @return value that the instruction defines
+     */
+    IRValue append(uint32_t block, IRInstruction instruction);
 
-    IRNode &operator[](const size_t i) { return nodes[i]; }
+    IRInstruction &operator[](IRValue value) { return instructions[value]; }
+    const IRInstruction &operator[](IRValue value) const { return instructions[value]; }
+
+    /**
+     * @brief terminator of a block
+     */
+    [[nodiscard]] const IRInstruction &terminator(uint32_t block) const {
+        return instructions[blocks[block].instructions.back()];
+    }
 };
 
-std::expected<IRArena, Error> generate_ir(const std::shared_ptr<runtime::Proto> &);
-} // namespace tachyon::codegen
\ No newline at end of file
+/**
+ * @brief readable listing of a function, one block at a time
+ */
+std::string to_string(const IRFunction &fn);
+
+/**
+ * @brief convert the bytecode of a function to SSA form
+ *
+ * Every opcode of the bytecode set is converted. Register moves do not produce instructions, since
+ * a moved value is the same value. A call takes the registers that hold its arguments, or every
+ * register from its offset on if the callee is not a constant, and the arguments are dead after
+ * it.
+ *
+ * @param fn function, whose bytecode is decoded again
+ * @return function in SSA form, or error if the bytecode is malformed
+ */
+std::expected<IRFunction, Error> generate_ir(const runtime::Proto &fn);
+} // namespace tachyon::codegen
@@ -0,0 +1,64 @@
+#pragma once
+#include "tachyon/codegen/ir_generator.hpp"
+
+namespace tachyon::codegen {
+/**
+ * @brief passes that optimize runs, each of which can be switched off
+ */
+struct OptimizationPasses {
+    bool fold_constants = true;
+    bool reduce_strength = true;
+    bool number_values = true;
+    bool hoist_invariants = true;
+    bool eliminate_dead_code = true;
+};
+
+/**
+ * @brief evaluate instructions whose operands are all constants, and phis that merge the same
+ *  constant, then turn branches on constants into jumps and remove the blocks that can no longer
+ *  be reached
+ * @return whether the function changed
+ */
+bool fold_constants(IRFunction &fn);
+
+/**
+ * @brief replace operations by cheaper ones with the same result: x ^ 2 by x * x, x ^ 1 and
+ *  x * 1 by x, and division by a power of two by multiplication with its inverse
+ * @return whether the function changed
+ */
+bool reduce_strength(IRFunction &fn);
+
+/**
+ * @brief global value numbering, which replaces an instruction by an equal one that dominates it
+ *
+ * Only instructions without side effects are numbered, and lists are not, so that every push,
+ * pop and store still makes a list of its own.
+ *
+ * @return whether the function changed
+ */
+bool number_values(IRFunction &fn);
+
+/**
+ * @brief loop-invariant code motion, which moves instructions whose operands are defined outside
+ *  of a loop to the block that enters it
+ *
+ * The moved instructions run even if the loop does not, so only those that can not fail are
+ * moved. A loop is only optimized if a single block enters it and only jumps to it.
+ *
+ * @return whether the function changed
+ */
+bool hoist_invariants(IRFunction &fn);
+
+/**
+ * @brief remove instructions whose values are not used, unless they may have an effect: calls,
+ *  prints, terminators and instructions that fail on operands of the wrong kind
+ * @return whether the function changed
+ */
+bool eliminate_dead_code(IRFunction &fn);
+
+/**
+ * @brief run the passes that are switched on, in the order of OptimizationPasses, until none of
+ *  them changes the function
+ */
+void optimize(IRFunction &fn, const OptimizationPasses &passes = {});
+} // namespace tachyon::codegen
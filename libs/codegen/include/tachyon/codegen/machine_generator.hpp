@@ -4,9 +4,47 @@
 #include "tachyon/common/error.hpp"
 #include "tachyon/runtime/proto.hpp"
 
+#include <cstdint>
 #include <expected>
+#include <memory>
+#include <vector>
 
 namespace tachyon::codegen {
-std::expected<void, Error> generate_machine(IRArena, const std::shared_ptr<runtime::Proto> &fn,
-                                            runtime::Value *registers);
-}
\ No newline at end of file
+/**
+ * @brief compile a function to machine code, see runtime::CompiledFunction
+ *
+ * Only functions on doubles and booleans are compiled: arithmetic, including powers, comparisons,
+ * logic, branches and loops. The arguments that they read have to hold doubles. The code only
+ * reads the intermediate representation, so it can be generated on any thread, and runs once it
+ * is installed in runtime::code_cache.
+ *
+ * @param ir optimized intermediate representation of the function
+ * @param arguments number of arguments of the function
+ * @return machine code, or error if the function has instructions or kinds that are not supported
+ */
+std::expected<std::vector<uint8_t>, Error> generate_machine(const IRFunction &ir, size_t arguments);
+
+/**
+ * @brief compile a loop of a function, to continue a running loop in machine code
+ *
+ * Only loops on doubles and booleans are compiled: arithmetic other than powers, comparisons,
+ * logic, loads, moves and jumps. Jumps out of the loop and returns leave the compiled code.
+ *
+ * Loops are compiled from the decoded instructions, not from the intermediate representation,
+ * which is built from the entry of a function, with its arguments as the only values that it
+ * starts with and returns as the only way out. A loop starts from the interpreter registers that
+ * it reads, in the middle of the function, and leaves through any number of exits that each write
+ * back other registers. Until the intermediate representation can model that, the loop has its
+ * own code generator, which shares the assembler with generate_machine but none of the
+ * optimizations or the register allocator.
+ *
+ * @param fn function, whose decoded instructions hold the loop
+ * @param header index of the first instruction of the loop
+ * @param back_edge index of the backward jump to the header that closes the loop
+ * @param keeps_frame whether the registers of the frame are read after fn returns, so that a
+ *  return from the loop has to leave all of them written
+ * @return compiled loop, or error if the loop has instructions or kinds that are not supported
+ */
+std::expected<std::unique_ptr<runtime::CompiledLoop>, Error>
+generate_loop(const runtime::Proto &fn, uint32_t header, uint32_t back_edge, bool keeps_frame);
+} // namespace tachyon::codegen
\ No newline at end of file
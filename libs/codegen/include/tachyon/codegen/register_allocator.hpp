@@ -0,0 +1,67 @@
+#pragma once
+#include "tachyon/codegen/ir_generator.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tachyon::codegen {
+/**
+ * @brief where a value of compiled code is kept, for as long as it is live
+ */
+struct Location {
+    /// whether the value is kept in a stack slot rather than in a register
+    bool is_spilled = false;
+
+    /// register, or stack slot if the value is spilled
+    uint16_t index = 0;
+
+    bool operator==(const Location &) const = default;
+};
+
+/**
+ * @brief positions of the linear order of a function in which a value is live
+ *
+ * Blocks are laid out in the order of the function. Its nth instruction reads its operands at
+ * position 2n and defines its value at 2n + 1, so that a value can take the register of an operand
+ * that it is the last use of. Parameters are defined where the function starts, phis where their
+ * block starts, and the operands of phis are used where the predecessor that they come from ends.
+ */
+struct LiveInterval {
+    IRValue value;
+    uint32_t start;
+    uint32_t end;
+};
+
+/**
+ * @brief locations of the values of a function
+ */
+struct RegisterAllocation {
+    /// live interval of every instruction that blocks hold and that is not a terminator, ordered
+    /// by start
+    std::vector<LiveInterval> intervals;
+
+    /// location of every value, indexed by value. values without an interval are not allocated
+    std::vector<Location> locations;
+
+    /// number of stack slots that spilled values take
+    size_t slots = 0;
+};
+
+/**
+ * @brief find the positions in which the values of a function are live, by data-flow analysis of
+ *  the blocks until their live values do not change
+ * @return live intervals, ordered by start
+ */
+std::vector<LiveInterval> live_intervals(const IRFunction &fn);
+
+/**
+ * @brief give every value of a function a register, by linear scan over its live intervals
+ *
+ * When more values are live than there are registers, the one whose interval ends last is kept in
+ * a stack slot instead. Values that are not live at the same time share registers and slots.
+ *
+ * @param registers number of registers that may be given out, numbered from 0
+ */
+RegisterAllocation allocate_registers(const IRFunction &fn, size_t registers);
+} // namespace tachyon::codegen
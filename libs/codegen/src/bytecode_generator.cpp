@@ -4,40 +4,179 @@
 #include "tachyon/parser/print.hpp"
 #include "tachyon/runtime/bytecode.hpp"
 
+#include <limits>
+#include <optional>
+#include <utility>
+
 namespace tachyon::codegen {
 using namespace tachyon::parser;
 
+namespace {
+/**
+ * @brief whether the last expression to run in a function body is a return
+ */
+bool ends_with_return(const Expr &e) {
+    if (std::holds_alternative<ReturnExpr>(e.kind)) return true;
+    if (const auto *seq = std::get_if<SequenceExpr>(&e.kind); seq && !seq->sequence.empty())
+        return ends_with_return(seq->sequence.back());
+    return false;
+}
+
+/**
+ * @brief whether an operand is generated as a constant, rather than into a register
+ */
+bool is_constant_operand(const Expr &e) { return std::holds_alternative<LiteralExpr>(e.kind); }
+
+/**
+ * @brief whether an operand is generated into a register
+ */
+bool is_register_operand(const Expr &e) {
+    return std::holds_alternative<LetRefExpr>(e.kind) ||
+           std::holds_alternative<MatrixRefExpr>(e.kind) ||
+           std::holds_alternative<UnaryOperatorExpr>(e.kind) ||
+           std::holds_alternative<BinaryOperatorExpr>(e.kind);
+}
+
+/**
+ * @brief opcode of a binary operator of a family on operands of the given kinds
+ */
+uint16_t binary_opcode(runtime::OpcodeFamily family, Op op, runtime::OperandKind lhs,
+                       runtime::OperandKind rhs) {
+    std::optional<uint16_t> opcode = runtime::family_opcode(family, op, lhs, rhs);
+    TY_ASSERT(opcode.has_value());
+    return *opcode;
+}
+
+/**
+ * @brief opcode of a binary operator that writes its result to a register
+ */
+uint16_t binary_opcode(Op op, runtime::OperandKind lhs, runtime::OperandKind rhs) {
+    using enum runtime::OpcodeFamily;
+    return binary_opcode(op < Op::Not ? Logic : op < Op::Add ? Comparison : Arithmetic, op, lhs,
+                         rhs);
+}
+
+/**
+ * @brief kind of the operand that an expression is generated as
+ */
+runtime::OperandKind operand_kind(const Expr &e) {
+    return is_register_operand(e) ? runtime::OperandKind::Register
+                                  : runtime::OperandKind::Constant;
+}
+} // namespace
+
+size_t ConstantPoolBuilder::add(runtime::Value value) {
+    auto [it, inserted] = values.try_emplace(value, pool->size());
+    if (inserted) pool->push_back(std::move(value));
+    return it->second;
+}
+
+size_t ConstantPoolBuilder::append(runtime::Value value) {
+    pool->push_back(std::move(value));
+    return pool->size() - 1;
+}
+
+size_t ConstantPoolBuilder::add(runtime::Proto fn) {
+    auto [it, inserted] = functions.try_emplace(FunctionKey(fn.name, fn.bytecode, fn.arguments,
+                                                            fn.registers, fn.is_pure,
+                                                            fn.can_generate_irmc),
+                                                pool->size());
+    if (!inserted) return it->second;
+    const auto &owned =
+        owned_functions.emplace_back(std::make_shared<runtime::Proto>(std::move(fn)));
+    std::shared_ptr<runtime::Proto> borrowed(std::shared_ptr<runtime::Proto>(), owned.get());
+    pool->emplace_back(std::move(borrowed));
+    return it->second;
+}
+
+uint16_t BytecodeGenerator::constant_address(size_t index) {
+    if (index > std::numeric_limits<uint16_t>::max())
+        errors.push_back(Error::create(ErrorKind::BytecodeGenerationError, SourceSpan(0, 0),
+                                       "too many constants")
+                             .withLongMessage("a module can hold up to 65536 distinct constants."));
+    return static_cast<uint16_t>(index);
+}
+
+size_t BytecodeGenerator::generate_branch_unless(const Expr &condition) {
+    // comparisons between constants and registers jump on their own, without writing the bool to
+    // a register first.
+    if (const auto *binop = std::get_if<BinaryOperatorExpr>(&condition.kind);
+        binop && binop->op >= Op::Eq && binop->op <= Op::Gret) {
+        const Expr &left = *binop->left;
+        const Expr &right = *binop->right;
+        if ((is_constant_operand(left) || is_register_operand(left)) &&
+            (is_constant_operand(right) || is_register_operand(right))) {
+            std::visit(*this, left.kind);
+            uint16_t lhs = curr;
+            std::visit(*this, right.kind);
+            uint16_t rhs = curr;
+
+            bc.push_back(binary_opcode(runtime::OpcodeFamily::Branch, binop->op,
+                                       operand_kind(left), operand_kind(right)));
+            bc.push_back(lhs);
+            bc.push_back(rhs);
+            bc.push_back(0); // to be filled in
+            return bc.size() - 1;
+        }
+    }
+
+    std::visit(*this, condition.kind);
+    if (std::holds_alternative<FnCallExpr>(condition.kind) || is_register_operand(condition)) {
+        // curr holds a register address, use JMRN
+        bc.push_back(runtime::JMRN);
+        bc.push_back(curr);
+        bc.push_back(0); // to be filled in
+    } else if (std::holds_alternative<LiteralExpr>(condition.kind) ||
+               std::holds_alternative<FnExpr>(condition.kind)) {
+        // curr holds a constant address, use JMCN
+        bc.push_back(runtime::JMCN);
+        bc.push_back(curr);
+        bc.push_back(0); // to be filled in
+    } else {
+        errors.push_back(Error::create(ErrorKind::BytecodeGenerationError, SourceSpan(0, 0),
+                                       "could not generate condition")
+                             .withLongMessage("failed to recognize condition type."));
+        bc.push_back(runtime::JMPU);
+        bc.push_back(0);
+    }
+    return bc.size() - 1;
+}
+
 void BytecodeGenerator::operator()(const LiteralExpr &lit) {
-    // convert to value, push to constants, reference that.
+    // convert to value, intern it in the constant pool, reference that.
     runtime::Value val = std::visit([](auto &&v) -> runtime::Value { return v; }, lit.value);
-    constants.push_back(val);
-    curr = constants.size() - 1;
+    curr = constant_address(constants->add(std::move(val)));
 };
 
 void BytecodeGenerator::operator()(const FnExpr &fn) {
-    std::expected<runtime::Proto, Error> maybe_proto;
-    if (fn.arguments.empty()) maybe_proto = generate_proto(std::move(*fn.body));
-    else {
-        std::vector<std::string> arguments;
-        arguments.reserve(fn.arguments.size());
-        std::ranges::transform(fn.arguments, std::back_inserter(arguments),
-                               [](const auto &p) { return p.first; });
-        maybe_proto = generate_proto(std::move(*fn.body), arguments);
-    }
+    // the interpreter does not bounds check the instruction pointer, so every function must end in
+    // a return. this also gives jumps past the last statement something to land on.
+    bool needs_retv = !ends_with_return(*fn.body);
+
+    // the function shares the constant pool of this module.
+    std::vector<std::string> arguments;
+    arguments.reserve(fn.arguments.size());
+    std::ranges::transform(fn.arguments, std::back_inserter(arguments),
+                           [](const auto &p) { return p.first; });
+    std::expected<runtime::Proto, Error> maybe_proto =
+        generate_proto(std::move(*fn.body), std::move(arguments), constants);
 
     // if there was an error, record it. if the function is impure, propagate to self.
-    if (!maybe_proto) errors.push_back(maybe_proto.error());
-    else if (!maybe_proto->is_pure) is_pure = false;
+    if (!maybe_proto) {
+        errors.push_back(maybe_proto.error());
+        curr = 0;
+        return;
+    }
+    if (!maybe_proto->is_pure) is_pure = false;
 
     // if there is no return at the end of the function, RETV
-    if (maybe_proto && (*(maybe_proto->bytecode.end() - 1) != runtime::RETV && *(maybe_proto->bytecode.end() - 2) != runtime::RETC && *(maybe_proto->bytecode.end() - 3) != runtime::RETR )) {
-        maybe_proto->bytecode.push_back(runtime::RETV);
-    }
+    if (needs_retv) maybe_proto->bytecode.push_back(runtime::RETV);
 
-    constants.emplace_back<std::shared_ptr<runtime::Proto>>(
-        std::make_shared<runtime::Proto>(std::move(maybe_proto.value())));
+    // name the function before it is interned, so that it is only shared with functions of the
+    // same name.
+    if (!function_name.empty()) maybe_proto->name = std::exchange(function_name, {});
 
-    curr = constants.size() - 1;
+    curr = constant_address(constants->add(std::move(*maybe_proto)));
 };
 
 void BytecodeGenerator::operator()(const UnaryOperatorExpr &unop) {
@@ -67,7 +206,7 @@ void BytecodeGenerator::operator()(const UnaryOperatorExpr &unop) {
 
 // TODO: handle fn calls
 void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
-    uint16_t op = op_to_uint16_t(binop.op);
+    using enum runtime::OperandKind;
     if (std::holds_alternative<LiteralExpr>(binop.left->kind)) {
         // constant lhs
         if (std::holds_alternative<LiteralExpr>(binop.right->kind)) {
@@ -76,7 +215,7 @@ void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
             uint16_t lhs = curr;
             std::visit(*this, binop.right->kind);
             uint16_t rhs = curr;
-            bc.push_back(op);
+            bc.push_back(binary_opcode(binop.op, Constant, Constant));
             bc.push_back(lhs);
             bc.push_back(rhs);
             bc.push_back(next_free_register); // target
@@ -89,7 +228,7 @@ void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
             uint16_t lhs = curr;
             std::visit(*this, binop.right->kind);
             uint16_t rhs = curr;
-            bc.push_back(get_bytecode_nth_group(op, 2));
+            bc.push_back(binary_opcode(binop.op, Constant, Register));
             bc.push_back(lhs);
             bc.push_back(rhs);
             bc.push_back(next_free_register); // target
@@ -107,7 +246,7 @@ void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
             uint16_t lhs = curr;
             std::visit(*this, binop.right->kind);
             uint16_t rhs = curr;
-            bc.push_back(get_bytecode_nth_group(op, 1));
+            bc.push_back(binary_opcode(binop.op, Register, Constant));
             bc.push_back(lhs);
             bc.push_back(rhs);
             bc.push_back(next_free_register); // target
@@ -120,7 +259,7 @@ void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
             uint16_t lhs = curr;
             std::visit(*this, binop.right->kind);
             uint16_t rhs = curr;
-            bc.push_back(get_bytecode_nth_group(op, 3));
+            bc.push_back(binary_opcode(binop.op, Register, Register));
             bc.push_back(lhs);
             bc.push_back(rhs);
             bc.push_back(next_free_register); // target
@@ -146,6 +285,7 @@ void BytecodeGenerator::operator()(const BinaryOperatorExpr &binop) {
 
 // TODO: does not check for duplicate variables, this should maybe be a step before generation.
 void BytecodeGenerator::operator()(const LetExpr &vdecl) {
+    if (std::holds_alternative<FnExpr>(vdecl.value->kind)) function_name = vdecl.name;
     std::visit(*this, vdecl.value->kind);
 
     // find index of register assigned to this let reference. if it does not exist, create one.
@@ -167,9 +307,6 @@ void BytecodeGenerator::operator()(const LetExpr &vdecl) {
         bc.push_back(runtime::LOCR);
         bc.push_back(curr);
         bc.push_back(index);
-
-        // rename function
-        std::get<std::shared_ptr<runtime::Proto>>(constants.back())->name = vdecl.name;
     } else {
         // curr holds a register address, use LORR
         bc.push_back(runtime::LORR);
@@ -296,8 +433,10 @@ void BytecodeGenerator::operator()(const MatrixRefExpr &mref) {
     curr = dst0;
 }
 
+void BytecodeGenerator::operator()(const FnCallExpr &fnc) { generate_call(fnc, false); }
+
 // TODO: CALC? I don't think the ast can generate that.
-void BytecodeGenerator::operator()(const FnCallExpr &fnc) {
+void BytecodeGenerator::generate_call(const FnCallExpr &fnc, bool tail) {
     // to run a function, we load the arguments in the first [1, n] registers,
     // then call CALC/CALR with a pointer to the prototype.
 
@@ -351,7 +490,7 @@ void BytecodeGenerator::operator()(const FnCallExpr &fnc) {
     // TODO: do matrix (array) push/pop operations go here?
 
     (*this)(fnc.ref); // visit ref
-    bc.push_back(runtime::CALR);
+    bc.push_back(tail ? runtime::TALR : runtime::CALR);
     bc.push_back(curr);
     bc.push_back(start);
 
@@ -360,29 +499,11 @@ void BytecodeGenerator::operator()(const FnCallExpr &fnc) {
 };
 
 void BytecodeGenerator::operator()(const WhileLoopExpr &wlop) {
-    // record the current position, evaluate condition, store register
+    // record the current position, then evaluate the condition and jump past the body when it is
+    // false. store the position that we need to fill in later with the address of the last
+    // instruction in the body.
     size_t condition_start_position = bc.size();
-    std::visit(*this, wlop.condition->kind);
-
-    // store the position that we need to fill in later with the address of the last instruction
-    // in the body.
-    size_t end_reference_position = bc.size() + 2;
-    if (std::holds_alternative<LetRefExpr>(wlop.condition->kind) ||
-        std::holds_alternative<MatrixRefExpr>(wlop.condition->kind) ||
-        std::holds_alternative<FnCallExpr>(wlop.condition->kind) ||
-        std::holds_alternative<UnaryOperatorExpr>(wlop.condition->kind) ||
-        std::holds_alternative<BinaryOperatorExpr>(wlop.condition->kind)) {
-        // curr holds a register address, use JMRN
-        bc.push_back(runtime::JMRN);
-        bc.push_back(curr);
-        bc.push_back(0); // to be filled in
-    } else if (std::holds_alternative<LiteralExpr>(wlop.condition->kind) ||
-               std::holds_alternative<FnExpr>(wlop.condition->kind)) {
-        // curr holds a constant address, use JMCN
-        bc.push_back(runtime::JMCN);
-        bc.push_back(curr);
-        bc.push_back(0); // to be filled in
-    }
+    size_t end_reference_position = generate_branch_unless(*wlop.condition);
 
     // evaluate loop body
     std::visit(*this, wlop.body->kind);
@@ -405,27 +526,9 @@ void BytecodeGenerator::operator()(const ContinueExpr &) {
 };
 
 void BytecodeGenerator::operator()(const IfExpr &iff) {
-    std::visit(*this, iff.condition->kind);
-
     // store the position that we need to fill in later with the address of the last instruction
     // in the body.
-    size_t end_reference_position = bc.size() + 2;
-    if (std::holds_alternative<LetRefExpr>(iff.condition->kind) ||
-        std::holds_alternative<MatrixRefExpr>(iff.condition->kind) ||
-        std::holds_alternative<FnCallExpr>(iff.condition->kind) ||
-        std::holds_alternative<UnaryOperatorExpr>(iff.condition->kind) ||
-        std::holds_alternative<BinaryOperatorExpr>(iff.condition->kind)) {
-        // curr holds a register address, use JMRN
-        bc.push_back(runtime::JMRN);
-        bc.push_back(curr);
-        bc.push_back(0); // to be filled in
-    } else if (std::holds_alternative<LiteralExpr>(iff.condition->kind) ||
-               std::holds_alternative<FnExpr>(iff.condition->kind)) {
-        // curr holds a constant address, use JMCN
-        bc.push_back(runtime::JMCN);
-        bc.push_back(curr);
-        bc.push_back(0); // to be filled in
-    }
+    size_t end_reference_position = generate_branch_unless(*iff.condition);
 
     // evaluate if body
     std::visit(*this, iff.body->kind);
@@ -443,27 +546,9 @@ void BytecodeGenerator::operator()(const IfExpr &iff) {
     // repeat for else-ifs
     std::vector<size_t> success_reference_positions;
     for (size_t i = 0; i < iff.else_if_conditions.size(); ++i) {
-        std::visit(*this, iff.else_if_conditions[i].kind);
-
         // store the position that we need to fill in later with the address of the last instruction
         // in the body.
-        size_t end_reference_position = bc.size() + 2;
-        if (std::holds_alternative<LetRefExpr>(iff.else_if_conditions[i].kind) ||
-            std::holds_alternative<MatrixRefExpr>(iff.else_if_conditions[i].kind) ||
-            std::holds_alternative<FnCallExpr>(iff.else_if_conditions[i].kind) ||
-            std::holds_alternative<UnaryOperatorExpr>(iff.else_if_conditions[i].kind) ||
-            std::holds_alternative<BinaryOperatorExpr>(iff.else_if_conditions[i].kind)) {
-            // curr holds a register address, use JMRN
-            bc.push_back(runtime::JMRN);
-            bc.push_back(curr);
-            bc.push_back(0); // to be filled in
-        } else if (std::holds_alternative<LiteralExpr>(iff.else_if_conditions[i].kind) ||
-                   std::holds_alternative<FnExpr>(iff.else_if_conditions[i].kind)) {
-            // curr holds a constant address, use JMCN
-            bc.push_back(runtime::JMCN);
-            bc.push_back(curr);
-            bc.push_back(0); // to be filled in
-        }
+        size_t end_reference_position = generate_branch_unless(iff.else_if_conditions[i]);
 
         // evaluate if body
         std::visit(*this, iff.else_if_bodies[i].kind);
@@ -503,7 +588,13 @@ void BytecodeGenerator::operator()(const ImportExpr &) {};
 // TODO: should probably check that each function has a return at the end. and
 //  eventually default to return void when there's none.
 void BytecodeGenerator::operator()(const ReturnExpr &ret) {
-    std::visit(*this, ret.returns->kind);
+    // returning a call is a tail call. it is still followed by RETR, which returns the result if
+    // the VM makes a regular call instead.
+    if (const auto *fnc = std::get_if<FnCallExpr>(&ret.returns->kind);
+        fnc != nullptr && fnc->ref.name != "print")
+        generate_call(*fnc, true);
+    else
+        std::visit(*this, ret.returns->kind);
     if (std::holds_alternative<LetRefExpr>(ret.returns->kind) ||
         std::holds_alternative<MatrixRefExpr>(ret.returns->kind) ||
         std::holds_alternative<FnCallExpr>(ret.returns->kind) ||
@@ -521,10 +612,11 @@ void BytecodeGenerator::operator()(const ReturnExpr &ret) {
 };
 
 void BytecodeGenerator::operator()(const MatrixConstructExpr &mc) {
-    constants.emplace_back(Matrix(mc.height, mc.list.size() / mc.height, mc.list.size()));
+    uint16_t matrix = constant_address(
+        constants->append(Matrix(mc.height, mc.list.size() / mc.height, mc.list.size())));
     size_t addr = next_free_register++;
     bc.push_back(runtime::LOCR);
-    bc.push_back(constants.size() - 1);
+    bc.push_back(matrix);
     bc.push_back(addr);
     for (const Expr &expr : mc.list) {
         std::visit(*this, expr.kind);
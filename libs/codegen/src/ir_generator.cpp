@@ -3,41 +3,546 @@
 #include "tachyon/common/error.hpp"
 #include "tachyon/runtime/bytecode.hpp"
 
+#include <algorithm>
 #include <expected>
+#include <format>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <utility>
 
 namespace tachyon::codegen {
-using enum runtime::Bytecode;
-std::expected<IRArena, Error> generate_ir(const std::shared_ptr<runtime::Proto> &fn) {
-    IRArena arena{};
+const char *ir_opcode_to_str(IROpcode opcode) {
+    switch (opcode) {
+    case IROpcode::Parameter: return "parameter";
+    case IROpcode::Constant: return "constant";
+    case IROpcode::Phi: return "phi";
+    case IROpcode::Add: return "add";
+    case IROpcode::Sub: return "sub";
+    case IROpcode::Mul: return "mul";
+    case IROpcode::Div: return "div";
+    case IROpcode::Pow: return "pow";
+    case IROpcode::Eq: return "eq";
+    case IROpcode::Neq: return "neq";
+    case IROpcode::Lst: return "lst";
+    case IROpcode::Grt: return "grt";
+    case IROpcode::Lset: return "lset";
+    case IROpcode::Gret: return "gret";
+    case IROpcode::Not: return "not";
+    case IROpcode::And: return "and";
+    case IROpcode::Or: return "or";
+    case IROpcode::Push: return "push";
+    case IROpcode::Pop: return "pop";
+    case IROpcode::Last: return "last";
+    case IROpcode::Load: return "load";
+    case IROpcode::Store: return "store";
+    case IROpcode::Call: return "call";
+    case IROpcode::TailCall: return "tailcall";
+    case IROpcode::Print: return "print";
+    case IROpcode::Jump: return "jump";
+    case IROpcode::Branch: return "branch";
+    case IROpcode::Return: return "return";
+    }
+    return "unknown";
+}
+
+IRType ir_type_of(runtime::Value::Kind kind) {
+    switch (kind) {
+    case runtime::Value::Kind::Nil: return IRType::Nil;
+    case runtime::Value::Kind::Double: return IRType::Double;
+    case runtime::Value::Kind::String: return IRType::String;
+    case runtime::Value::Kind::Bool: return IRType::Bool;
+    case runtime::Value::Kind::Matrix: return IRType::Matrix;
+    case runtime::Value::Kind::Proto: return IRType::Function;
+    }
+    return IRType::Any;
+}
 
-    for (size_t i = 0; i < fn->bytecode.size(); i++) {
-        switch (fn->bytecode[i]) {
-        case RETR: {
-            IRPointer lhs = make_register(fn->bytecode[++i]);
-            arena.emplace(IRNodeKind::Ret, lhs);
-            break;
+IRValue IRFunction::append(uint32_t block, IRInstruction instruction) {
+    instruction.block = block;
+    instructions.push_back(std::move(instruction));
+    const auto value = static_cast<IRValue>(instructions.size() - 1);
+    blocks[block].instructions.push_back(value);
+    return value;
+}
+
+std::string to_string(const IRFunction &fn) {
+    static constexpr const char *type_names[] = {"any",  "nil",    "double",  "string",
+                                                 "bool", "matrix", "function"};
+    std::string out;
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        const IRBlock &block = fn.blocks[b];
+        out += std::format("block {}", b);
+        for (size_t p = 0; p < block.predecessors.size(); ++p)
+            out += std::format("{}{}", p == 0 ? " <- " : ", ", block.predecessors[p]);
+        out += ":\n";
+        for (IRValue value : block.instructions) {
+            const IRInstruction &instruction = fn[value];
+            out += is_terminator(instruction.opcode) ? "    " : std::format("    %{} = ", value);
+            out += ir_opcode_to_str(instruction.opcode);
+            if (instruction.opcode == IROpcode::Parameter)
+                out += std::format(" r{}", instruction.immediate);
+            if (instruction.opcode == IROpcode::Constant)
+                out += std::format(" #{}", instruction.immediate);
+            for (size_t n = 0; n < instruction.operands.size(); ++n)
+                out += std::format("{}%{}", n == 0 ? " " : ", ", instruction.operands[n]);
+            for (size_t s = 0; s < block.successors.size() && is_terminator(instruction.opcode);
+                 ++s)
+                out += std::format("{}{}", s == 0 ? " -> " : ", ", block.successors[s]);
+            if (!is_terminator(instruction.opcode))
+                out += std::format(" : {}", type_names[static_cast<size_t>(instruction.type)]);
+            out += '\n';
         }
-        case MARR: {
-            IRPointer lhs = make_register(fn->bytecode[++i]);
-            IRPointer rhs = make_register(fn->bytecode[++i]);
-            IRPointer dst = make_register(fn->bytecode[++i]);
-            arena.emplace(IRNodeKind::Add, lhs, rhs, dst);
-            break;
+    }
+    return out;
+}
+
+IROpcode family_opcode(parser::Op operation) {
+    using enum parser::Op;
+    switch (operation) {
+    case And: return IROpcode::And;
+    case Or: return IROpcode::Or;
+    case Not: return IROpcode::Not;
+    case Eq: return IROpcode::Eq;
+    case Neq: return IROpcode::Neq;
+    case Lst: return IROpcode::Lst;
+    case Grt: return IROpcode::Grt;
+    case Lset: return IROpcode::Lset;
+    case Gret: return IROpcode::Gret;
+    case Add: return IROpcode::Add;
+    case Sub: return IROpcode::Sub;
+    case Mul: return IROpcode::Mul;
+    case Div: return IROpcode::Div;
+    case Pow: return IROpcode::Pow;
+    }
+    return IROpcode::Add;
+}
+
+namespace {
+using runtime::Instruction;
+using runtime::OpcodeFamily;
+using runtime::OperandKind;
+
+constexpr uint32_t no_block = std::numeric_limits<uint32_t>::max();
+constexpr IRValue no_value = std::numeric_limits<IRValue>::max();
+
+Error ir_error(std::string hint) {
+    return Error::create(ErrorKind::IRGenerationError, SourceSpan(0, 0), "could not optimize")
+        .withHint(std::move(hint));
+}
+
+bool is_return(uint16_t op) {
+    return op == runtime::RETV || op == runtime::RETC || op == runtime::RETR;
+}
+
+/**
+ * @brief instructions that control continues at after the last instruction of a block, the one
+ *  taken if a condition holds first
+ */
+std::vector<uint32_t> successors(const std::vector<Instruction> &code, uint32_t i) {
+    const Instruction &instruction = code[i];
+    const uint32_t next = i + 1;
+    std::vector<uint32_t> result;
+    if (runtime::opcode_info(instruction.op).family == OpcodeFamily::Branch)
+        result = {next, instruction.operands[2].target};
+    else if (instruction.op == runtime::JMPU || instruction.op == runtime::LOOP)
+        result = {instruction.operands[0].target};
+    else if (instruction.op == runtime::JMCI || instruction.op == runtime::JMRI)
+        result = {instruction.operands[1].target, next};
+    else if (instruction.op == runtime::JMCN || instruction.op == runtime::JMRN)
+        result = {next, instruction.operands[1].target};
+    else if (!is_return(instruction.op))
+        result = {next};
+    // a branch to the next instruction either way only needs a jump.
+    if (result.size() == 2 && result[0] == result[1]) result.pop_back();
+    std::erase_if(result, [&](uint32_t target) { return target >= code.size(); });
+    return result;
+}
+
+/**
+ * @brief converts the decoded instructions of a function to SSA form, block by block
+ *
+ * This follows Braun et al., "Simple and Efficient Construction of Static Single Assignment
+ * Form": the value of a register that a block reads before it writes is looked up in its
+ * predecessors, and merged by a phi if they disagree. A block is sealed once all of its
+ * predecessors are filled, and the phis that it needed before then get their operands as it is.
+ */
+class SSABuilder {
+    const runtime::Proto &proto;
+    const std::vector<Instruction> &code;
+    IRFunction fn;
+
+    /// block that every decoded instruction starts, if it starts one
+    std::vector<uint32_t> block_at;
+
+    /// value of every register at the end of every block, as far as it has been filled
+    std::vector<std::vector<IRValue>> definitions;
+
+    std::vector<bool> is_filled;
+    std::vector<bool> is_sealed;
+
+    /// phis of blocks that were not sealed yet, and the registers that they merge
+    std::vector<std::vector<std::pair<uint16_t, IRValue>>> incomplete_phis;
+
+    /// value that replaces a trivial phi, or no_value
+    std::vector<IRValue> replacements;
+
+    /// index in IRFunction::constants of every constant of the pool that the function uses
+    std::unordered_map<const runtime::Value *, uint32_t> constant_indices;
+
+    /**
+     * @brief add an instruction before the others of a block, after those with the same opcode
+     */
+    IRValue prepend(uint32_t block, IRInstruction instruction) {
+        const IROpcode opcode = instruction.opcode;
+        instruction.block = block;
+        fn.instructions.push_back(std::move(instruction));
+        const auto value = static_cast<IRValue>(fn.instructions.size() - 1);
+        std::vector<IRValue> &list = fn.blocks[block].instructions;
+        const auto position = std::ranges::find_if(
+            list, [&](IRValue other) { return fn[other].opcode != opcode; });
+        list.insert(position, value);
+        return value;
+    }
+
+    IRValue resolve(IRValue value) const {
+        while (value < replacements.size() && replacements[value] != no_value)
+            value = replacements[value];
+        return value;
+    }
+
+    void write(uint16_t reg, uint32_t block, IRValue value) { definitions[block][reg] = value; }
+
+    IRValue read(uint16_t reg, uint32_t block) {
+        if (const IRValue value = definitions[block][reg]; value != no_value) return resolve(value);
+        IRValue value;
+        const std::vector<uint32_t> &predecessors = fn.blocks[block].predecessors;
+        if (!is_sealed[block]) {
+            value = prepend(block, {IROpcode::Phi});
+            incomplete_phis[block].emplace_back(reg, value);
+        } else if (predecessors.empty()) {
+            value = prepend(block, {IROpcode::Parameter, IRType::Any, block, {}, reg});
+        } else if (predecessors.size() == 1) {
+            value = read(reg, predecessors[0]);
+        } else {
+            // the phi is written first, so that a loop back to this block reads it.
+            value = prepend(block, {IROpcode::Phi});
+            write(reg, block, value);
+            value = complete_phi(reg, value);
         }
-        case MARC: {
-            IRPointer lhs = make_register(fn->bytecode[++i]);
-            IRPointer rhs = make_constant(fn->bytecode[++i]);
-            IRPointer dst = make_register(fn->bytecode[++i]);
-            arena.emplace(IRNodeKind::Add, lhs, rhs, dst);
-            break;
+        write(reg, block, value);
+        return value;
+    }
+
+    IRValue complete_phi(uint16_t reg, IRValue phi) {
+        for (uint32_t predecessor : fn.blocks[fn[phi].block].predecessors) {
+            const IRValue value = read(reg, predecessor);
+            fn[phi].operands.push_back(value);
         }
-        default:
-            return std::unexpected(
-                Error::create(ErrorKind::IRGenerationError, SourceSpan(0, 0), "could not optimize")
-                    .withHint(std::format("Selected bytecode 0x{:0x}.", fn->bytecode[i])));
+        return remove_if_trivial(phi);
+    }
+
+    /**
+     * @brief replace a phi whose operands are all the same value, or the phi itself
+     * @return the value that replaces the phi, or the phi
+     */
+    IRValue remove_if_trivial(IRValue phi) {
+        IRValue same = no_value;
+        for (IRValue operand : fn[phi].operands) {
+            operand = resolve(operand);
+            if (operand == same || operand == phi) continue;
+            if (same != no_value) return phi;
+            same = operand;
         }
+        if (same == no_value) return phi;
+        if (replacements.size() <= phi) replacements.resize(phi + 1, no_value);
+        replacements[phi] = same;
+        return same;
+    }
+
+    void seal(uint32_t block) {
+        if (is_sealed[block]) return;
+        is_sealed[block] = true;
+        for (const auto &[reg, phi] : std::exchange(incomplete_phis[block], {}))
+            complete_phi(reg, phi);
+    }
+
+    void seal_filled_successors(uint32_t block) {
+        for (uint32_t successor : fn.blocks[block].successors)
+            if (std::ranges::all_of(fn.blocks[successor].predecessors,
+                                    [&](uint32_t p) { return static_cast<bool>(is_filled[p]); }))
+                seal(successor);
     }
 
-    return std::move(arena);
+    /// copies the constants that the function uses as it comes across them, rather than the pool
+    /// of its module
+    IRValue constant(uint32_t block, const runtime::Value *value) {
+        const auto [index, is_new] =
+            constant_indices.try_emplace(value, static_cast<uint32_t>(fn.constants.size()));
+        if (is_new) fn.constants.push_back(*value);
+        return fn.append(block,
+                         {IROpcode::Constant, ir_type_of(value->kind()), block, {}, index->second});
+    }
+
+    /// source operand n of an instruction, from a register or from the constant pool
+    IRValue source(uint32_t block, const Instruction &instruction, size_t n) {
+        if (runtime::opcode_info(instruction.op).operands[n] == OperandKind::Constant)
+            return constant(block, instruction.operands[n].constant);
+        return read(instruction.operands[n].reg, block);
+    }
+
+    void convert(uint32_t block, const Instruction &instruction);
+
+    void finish();
+
+  public:
+    SSABuilder(const runtime::Proto &proto, const std::vector<Instruction> &code)
+        : proto(proto), code(code) {}
+
+    IRFunction build();
+};
+
+void SSABuilder::convert(uint32_t block, const Instruction &instruction) {
+    const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+    const runtime::Operand *operands = instruction.operands;
+    const auto append = [&](IROpcode opcode, IRType type, std::vector<IRValue> values) {
+        return fn.append(block, {opcode, type, block, std::move(values)});
+    };
+    const auto terminate = [&](IROpcode opcode, std::vector<IRValue> values) {
+        // a branch whose successors are the same block only jumps.
+        if (opcode == IROpcode::Branch && fn.blocks[block].successors.size() == 1) {
+            opcode = IROpcode::Jump;
+            values.clear();
+        }
+        append(opcode, IRType::Nil, std::move(values));
+    };
+
+    switch (info.family) {
+    case OpcodeFamily::Arithmetic:
+    case OpcodeFamily::Quickened:
+    case OpcodeFamily::Comparison:
+    case OpcodeFamily::Logic: {
+        const bool is_number = info.family == OpcodeFamily::Arithmetic ||
+                               info.family == OpcodeFamily::Quickened;
+        std::vector<IRValue> values{source(block, instruction, 0)};
+        if (info.operation != parser::Op::Not) values.push_back(source(block, instruction, 1));
+        const IRValue result = append(family_opcode(info.operation),
+                                      is_number ? IRType::Double : IRType::Bool, std::move(values));
+        write(operands[info.operand_count - 1].reg, block, result);
+        return;
+    }
+    case OpcodeFamily::Branch: {
+        const IRValue lhs = source(block, instruction, 0);
+        const IRValue rhs = source(block, instruction, 1);
+        terminate(IROpcode::Branch,
+                  {append(family_opcode(info.operation), IRType::Bool, {lhs, rhs})});
+        return;
+    }
+    case OpcodeFamily::None: break;
+    }
+
+    using namespace runtime;
+    switch (instruction.op) {
+    case RETV: terminate(IROpcode::Return, {}); break;
+    case RETC:
+    case RETR: terminate(IROpcode::Return, {source(block, instruction, 0)}); break;
+    case NOOP: break;
+    case LOCR: write(operands[1].reg, block, constant(block, operands[0].constant)); break;
+    case LORR: write(operands[1].reg, block, read(operands[0].reg, block)); break;
+    case JMPU:
+    case LOOP: terminate(IROpcode::Jump, {}); break;
+    case JMCI:
+    case JMCN:
+    case JMRI:
+    case JMRN: terminate(IROpcode::Branch, {source(block, instruction, 0)}); break;
+    case LIUC:
+    case LIUR: {
+        const IRValue element = source(block, instruction, 0);
+        const IRValue list = read(operands[1].reg, block);
+        write(operands[1].reg, block, append(IROpcode::Push, IRType::Matrix, {list, element}));
+        break;
+    }
+    case LIOR: {
+        const IRValue list = read(operands[0].reg, block);
+        const IRValue element = append(IROpcode::Last, IRType::Double, {list});
+        write(operands[0].reg, block, append(IROpcode::Pop, IRType::Matrix, {list}));
+        write(operands[1].reg, block, element);
+        break;
+    }
+    case GRRC:
+    case GRRR: {
+        const IRValue row = read(operands[0].reg, block);
+        const IRValue column = read(operands[1].reg, block);
+        const IRValue list = source(block, instruction, 2);
+        write(operands[3].reg, block,
+              append(IROpcode::Load, IRType::Double, {list, row, column}));
+        break;
+    }
+    case SRRC:
+    case SRRR: {
+        const IRValue row = read(operands[0].reg, block);
+        const IRValue column = read(operands[1].reg, block);
+        const IRValue element = source(block, instruction, 2);
+        const IRValue list = read(operands[3].reg, block);
+        write(operands[3].reg, block,
+              append(IROpcode::Store, IRType::Matrix, {list, row, column, element}));
+        break;
+    }
+    case CALC:
+    case CALR:
+    case CAIR:
+    case CAMR:
+    case TALC:
+    case TALR: {
+        // a callee that is a constant takes as many arguments as it has, any other may take every
+        // register from the offset on.
+        const IRValue callee = source(block, instruction, 0);
+        const uint16_t offset = operands[1].reg;
+        size_t arguments = proto.registers - std::min<size_t>(offset, proto.registers);
+        if (fn[callee].opcode == IROpcode::Constant && fn.constants[fn[callee].immediate].is_proto())
+            arguments = fn.constants[fn[callee].immediate].as_proto()->arguments;
+        std::vector<IRValue> values{callee};
+        for (size_t a = 0; a < arguments && offset + a < proto.registers; ++a)
+            values.push_back(read(static_cast<uint16_t>(offset + a), block));
+        const bool is_tail = instruction.op == TALC || instruction.op == TALR;
+        write(0, block,
+              append(is_tail ? IROpcode::TailCall : IROpcode::Call, IRType::Any,
+                     std::move(values)));
+        break;
+    }
+    case PRNC:
+    case PRNR: append(IROpcode::Print, IRType::Nil, {source(block, instruction, 0)}); break;
+    default: break;
+    }
+}
+
+IRFunction SSABuilder::build() {
+    // blocks start at the entry, at jump targets and after instructions that jump or return.
+    std::vector<bool> starts_block(code.size());
+    starts_block[0] = true;
+    for (uint32_t i = 0; i + 1 < code.size(); ++i) {
+        const runtime::OpcodeInfo &info = runtime::opcode_info(code[i].op);
+        bool is_jump = is_return(code[i].op);
+        for (size_t n = 0; n < info.operand_count; ++n) {
+            if (info.operands[n] != OperandKind::Target) continue;
+            starts_block[code[i].operands[n].target] = true;
+            is_jump = true;
+        }
+        if (is_jump) starts_block[i + 1] = true;
+    }
+
+    // only blocks that can be reached get converted, in the order of their instructions. the
+    // entry block gets a block of its own if it is also a jump target.
+    std::vector<bool> is_reachable(code.size());
+    std::vector<uint32_t> worklist{0};
+    bool is_entry_target = false;
+    while (!worklist.empty()) {
+        uint32_t i = worklist.back();
+        worklist.pop_back();
+        if (is_reachable[i]) continue;
+        is_reachable[i] = true;
+        while (i + 1 < code.size() && !starts_block[i + 1])
+            ++i;
+        for (uint32_t target : successors(code, i)) {
+            is_entry_target = is_entry_target || target == 0;
+            worklist.push_back(target);
+        }
+    }
+    block_at.assign(code.size(), no_block);
+    if (is_entry_target) fn.blocks.push_back({});
+    for (uint32_t i = 0; i < code.size(); ++i) {
+        if (!starts_block[i] || !is_reachable[i]) continue;
+        block_at[i] = static_cast<uint32_t>(fn.blocks.size());
+        fn.blocks.push_back({.start = i});
+    }
+    const auto last_instruction = [&](uint32_t block) {
+        uint32_t i = fn.blocks[block].start;
+        while (i + 1 < code.size() && !starts_block[i + 1])
+            ++i;
+        return i;
+    };
+    const auto link = [&](uint32_t from, uint32_t to) {
+        fn.blocks[from].successors.push_back(to);
+        fn.blocks[to].predecessors.push_back(from);
+    };
+    if (is_entry_target) link(0, block_at[0]);
+    for (uint32_t b = is_entry_target ? 1 : 0; b < fn.blocks.size(); ++b)
+        for (uint32_t target : successors(code, last_instruction(b)))
+            link(b, block_at[target]);
+
+    fn.registers = proto.registers;
+    definitions.assign(fn.blocks.size(), std::vector<IRValue>(proto.registers, no_value));
+    is_filled.assign(fn.blocks.size(), false);
+    is_sealed.assign(fn.blocks.size(), false);
+    incomplete_phis.resize(fn.blocks.size());
+
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        if (std::ranges::all_of(fn.blocks[b].predecessors,
+                                [&](uint32_t p) { return static_cast<bool>(is_filled[p]); }))
+            seal(b);
+        if (is_entry_target && b == 0) {
+            fn.append(b, {IROpcode::Jump, IRType::Nil});
+        } else {
+            const uint32_t last = last_instruction(b);
+            for (uint32_t i = fn.blocks[b].start; i <= last; ++i)
+                convert(b, code[i]);
+            // a block that falls through to a jump target continues there, and the end of the
+            // bytecode returns nil.
+            if (fn.blocks[b].instructions.empty() ||
+                !is_terminator(fn[fn.blocks[b].instructions.back()].opcode))
+                fn.append(b, {fn.blocks[b].successors.empty() ? IROpcode::Return : IROpcode::Jump,
+                              IRType::Nil});
+        }
+        is_filled[b] = true;
+        seal_filled_successors(b);
+    }
+    finish();
+    return std::move(fn);
+}
+
+void SSABuilder::finish() {
+    // phis that became trivial once the phis that they take were replaced go as well.
+    std::vector<IRValue> phis;
+    for (const IRBlock &block : fn.blocks)
+        for (IRValue value : block.instructions)
+            if (fn[value].opcode == IROpcode::Phi) phis.push_back(value);
+    for (bool has_changed = true; has_changed;) {
+        has_changed = false;
+        for (IRValue phi : phis)
+            if (resolve(phi) == phi && remove_if_trivial(phi) != phi) has_changed = true;
+    }
+    for (IRInstruction &instruction : fn.instructions)
+        for (IRValue &operand : instruction.operands)
+            operand = resolve(operand);
+    for (IRBlock &block : fn.blocks)
+        std::erase_if(block.instructions, [&](IRValue value) { return resolve(value) != value; });
+
+    // a phi has the type of its operands if they all have the same one.
+    std::vector<bool> is_typed(fn.instructions.size(), true);
+    for (IRValue phi : phis)
+        is_typed[phi] = false;
+    for (bool has_changed = true; has_changed;) {
+        has_changed = false;
+        for (IRValue phi : phis) {
+            if (resolve(phi) != phi) continue;
+            std::optional<IRType> type;
+            for (IRValue operand : fn[phi].operands) {
+                if (operand == phi || !is_typed[operand]) continue;
+                type = !type || *type == fn[operand].type ? fn[operand].type : IRType::Any;
+            }
+            if (!type || (is_typed[phi] && fn[phi].type == *type)) continue;
+            fn[phi].type = *type;
+            is_typed[phi] = true;
+            has_changed = true;
+        }
+    }
+}
+} // namespace
+
+std::expected<IRFunction, Error> generate_ir(const runtime::Proto &fn) {
+    auto code = runtime::decode(fn.bytecode, *fn.constants);
+    if (!code) return std::unexpected(code.error());
+    if (code->empty()) return std::unexpected(ir_error("The function has no instructions."));
+    return SSABuilder(fn, *code).build();
 }
-} // namespace tachyon::codegen
\ No newline at end of file
+} // namespace tachyon::codegen
@@ -0,0 +1,586 @@
+#include "tachyon/codegen/ir_optimizer.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace tachyon::codegen {
+namespace {
+constexpr uint32_t no_block = std::numeric_limits<uint32_t>::max();
+constexpr IRValue no_value = std::numeric_limits<IRValue>::max();
+
+/// number of times that optimize runs the passes at most, since every round may leave work for
+/// the next one
+constexpr size_t max_rounds = 4;
+
+bool is_arithmetic(IROpcode opcode) { return opcode >= IROpcode::Add && opcode <= IROpcode::Pow; }
+
+bool is_comparison(IROpcode opcode) { return opcode >= IROpcode::Eq && opcode <= IROpcode::Gret; }
+
+bool is_logic(IROpcode opcode) { return opcode >= IROpcode::Not && opcode <= IROpcode::Or; }
+
+const runtime::Value *constant_of(const IRFunction &fn, IRValue value) {
+    const IRInstruction &instruction = fn[value];
+    if (instruction.opcode != IROpcode::Constant) return nullptr;
+    return &fn.constants[instruction.immediate];
+}
+
+std::optional<double> number_of(const IRFunction &fn, IRValue value) {
+    const runtime::Value *constant = constant_of(fn, value);
+    if (!constant || !constant->is_double()) return std::nullopt;
+    return constant->as_double();
+}
+
+/**
+ * @brief whether two constants are the same double or boolean
+ */
+bool is_same_constant(const runtime::Value &lhs, const runtime::Value &rhs) {
+    if (lhs.is_double() && rhs.is_double())
+        return std::bit_cast<uint64_t>(lhs.as_double()) == std::bit_cast<uint64_t>(rhs.as_double());
+    return lhs.is_bool() && rhs.is_bool() && lhs.as_bool() == rhs.as_bool();
+}
+
+/**
+ * @brief whether an instruction has no effect other than its value and can not fail, so that it
+ *  can be removed if its value is not used, or run where it would not have run
+ */
+bool is_safe(const IRFunction &fn, IRValue value) {
+    const IRInstruction &instruction = fn[value];
+    const auto has_operands = [&](IRType type) {
+        return std::ranges::all_of(instruction.operands,
+                                   [&](IRValue operand) { return fn[operand].type == type; });
+    };
+    switch (instruction.opcode) {
+    case IROpcode::Parameter:
+    case IROpcode::Constant:
+    case IROpcode::Phi: return true;
+    case IROpcode::Push:
+        return fn[instruction.operands[0]].type == IRType::Matrix &&
+               fn[instruction.operands[1]].type == IRType::Double;
+    default: break;
+    }
+    if (is_arithmetic(instruction.opcode) || is_comparison(instruction.opcode))
+        return has_operands(IRType::Double);
+    if (is_logic(instruction.opcode)) return has_operands(IRType::Bool);
+    return false;
+}
+
+/**
+ * @brief value that replaces a value, following the replacements of replacements
+ */
+IRValue resolve(const std::vector<IRValue> &replacements, IRValue value) {
+    while (value < replacements.size() && replacements[value] != no_value)
+        value = replacements[value];
+    return value;
+}
+
+/**
+ * @brief make the operands whose values were replaced take their replacements, and remove the
+ *  replaced instructions from their blocks
+ * @return whether any value was replaced
+ */
+bool replace(IRFunction &fn, const std::vector<IRValue> &replacements) {
+    if (std::ranges::all_of(replacements, [](IRValue value) { return value == no_value; }))
+        return false;
+    for (IRBlock &block : fn.blocks) {
+        std::erase_if(block.instructions, [&](IRValue value) {
+            return value < replacements.size() && replacements[value] != no_value;
+        });
+        for (IRValue value : block.instructions)
+            for (IRValue &operand : fn[value].operands)
+                operand = resolve(replacements, operand);
+    }
+    return true;
+}
+
+/**
+ * @brief turn an instruction into a constant of the value that it has
+ */
+void make_constant(IRFunction &fn, IRValue value, runtime::Value constant) {
+    IRInstruction &instruction = fn[value];
+    instruction.opcode = IROpcode::Constant;
+    instruction.type = ir_type_of(constant.kind());
+    instruction.operands.clear();
+    instruction.immediate = static_cast<uint32_t>(fn.constants.size());
+    fn.constants.push_back(std::move(constant));
+}
+
+/**
+ * @brief add an instruction to the block of another one, right before it
+ */
+IRValue insert_before(IRFunction &fn, IRValue before, IRInstruction instruction) {
+    const uint32_t block = fn[before].block;
+    instruction.block = block;
+    fn.instructions.push_back(std::move(instruction));
+    const auto value = static_cast<IRValue>(fn.instructions.size() - 1);
+    std::vector<IRValue> &list = fn.blocks[block].instructions;
+    list.insert(std::ranges::find(list, before), value);
+    return value;
+}
+
+/**
+ * @brief move an instruction to the end of a block, before its terminator
+ */
+void move_to_end(IRFunction &fn, IRValue value, uint32_t block) {
+    std::erase(fn.blocks[fn[value].block].instructions, value);
+    std::vector<IRValue> &list = fn.blocks[block].instructions;
+    list.insert(list.end() - 1, value);
+    fn[value].block = block;
+}
+
+/**
+ * @brief remove the edge from a block to one of its successors, and the operands that the phis of
+ *  the successor take from it
+ */
+void unlink(IRFunction &fn, uint32_t from, uint32_t to) {
+    std::erase(fn.blocks[from].successors, to);
+    std::vector<uint32_t> &predecessors = fn.blocks[to].predecessors;
+    const auto p = std::ranges::find(predecessors, from) - predecessors.begin();
+    predecessors.erase(predecessors.begin() + p);
+    for (IRValue value : fn.blocks[to].instructions) {
+        std::vector<IRValue> &operands = fn[value].operands;
+        if (fn[value].opcode == IROpcode::Phi) operands.erase(operands.begin() + p);
+    }
+}
+
+/**
+ * @brief remove the blocks that can not be reached from the entry, and number the others again
+ * @return whether any block was removed
+ */
+bool remove_unreachable_blocks(IRFunction &fn) {
+    std::vector<bool> is_reachable(fn.blocks.size());
+    std::vector<uint32_t> worklist{0};
+    while (!worklist.empty()) {
+        const uint32_t block = worklist.back();
+        worklist.pop_back();
+        if (is_reachable[block]) continue;
+        is_reachable[block] = true;
+        worklist.insert(worklist.end(), fn.blocks[block].successors.begin(),
+                        fn.blocks[block].successors.end());
+    }
+    if (std::ranges::all_of(is_reachable, [](bool reachable) { return reachable; })) return false;
+
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b)
+        if (!is_reachable[b])
+            for (uint32_t successor : std::vector(fn.blocks[b].successors))
+                unlink(fn, b, successor);
+    std::vector<uint32_t> index(fn.blocks.size(), no_block);
+    std::vector<IRBlock> blocks;
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        if (!is_reachable[b]) continue;
+        index[b] = static_cast<uint32_t>(blocks.size());
+        blocks.push_back(std::move(fn.blocks[b]));
+    }
+    for (IRBlock &block : blocks) {
+        for (uint32_t &successor : block.successors)
+            successor = index[successor];
+        for (uint32_t &predecessor : block.predecessors)
+            predecessor = index[predecessor];
+        for (IRValue value : block.instructions)
+            fn[value].block = index[fn[value].block];
+    }
+    fn.blocks = std::move(blocks);
+    return true;
+}
+
+/**
+ * @brief dominator tree of the blocks of a function
+ *
+ * This follows Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm": the immediate
+ * dominator of every block is found by intersecting the dominators of its predecessors, in reverse
+ * postorder until they no longer change.
+ */
+class Dominators {
+    /// immediate dominator of every block, which is the entry itself for the entry
+    std::vector<uint32_t> idom;
+
+    /// position of every block in the reverse postorder
+    std::vector<uint32_t> position;
+
+  public:
+    explicit Dominators(const IRFunction &fn)
+        : idom(fn.blocks.size(), no_block), position(fn.blocks.size(), no_block) {
+        std::vector<uint32_t> order;
+        std::vector<std::pair<uint32_t, size_t>> stack{{0, 0}};
+        std::vector<bool> is_visited(fn.blocks.size());
+        is_visited[0] = true;
+        while (!stack.empty()) {
+            const uint32_t block = stack.back().first;
+            const size_t next = stack.back().second++;
+            if (next == fn.blocks[block].successors.size()) {
+                order.push_back(block);
+                stack.pop_back();
+            } else if (const uint32_t successor = fn.blocks[block].successors[next];
+                       !is_visited[successor]) {
+                is_visited[successor] = true;
+                stack.emplace_back(successor, 0);
+            }
+        }
+        std::ranges::reverse(order);
+        for (uint32_t i = 0; i < order.size(); ++i)
+            position[order[i]] = i;
+
+        const auto intersect = [&](uint32_t lhs, uint32_t rhs) {
+            while (lhs != rhs) {
+                while (position[lhs] > position[rhs])
+                    lhs = idom[lhs];
+                while (position[rhs] > position[lhs])
+                    rhs = idom[rhs];
+            }
+            return lhs;
+        };
+        idom[0] = 0;
+        for (bool has_changed = true; has_changed;) {
+            has_changed = false;
+            for (uint32_t block : order) {
+                if (block == 0) continue;
+                uint32_t dominator = no_block;
+                for (uint32_t predecessor : fn.blocks[block].predecessors) {
+                    if (idom[predecessor] == no_block) continue;
+                    dominator =
+                        dominator == no_block ? predecessor : intersect(predecessor, dominator);
+                }
+                if (idom[block] == dominator) continue;
+                idom[block] = dominator;
+                has_changed = true;
+            }
+        }
+    }
+
+    /**
+     * @brief whether every path from the entry to a block goes through another block first, or is
+     *  the same block
+     */
+    [[nodiscard]] bool dominates(uint32_t dominator, uint32_t block) const {
+        if (idom[block] == no_block) return false;
+        while (block != dominator && block != idom[block])
+            block = idom[block];
+        return block == dominator;
+    }
+
+    /**
+     * @brief blocks that every block immediately dominates
+     */
+    [[nodiscard]] std::vector<std::vector<uint32_t>> children() const {
+        std::vector<std::vector<uint32_t>> result(idom.size());
+        for (uint32_t block = 1; block < idom.size(); ++block)
+            if (idom[block] != no_block) result[idom[block]].push_back(block);
+        return result;
+    }
+};
+
+/**
+ * @brief value of an instruction whose operands are all constants of the kinds that it takes
+ */
+std::optional<runtime::Value> evaluate(const IRFunction &fn, const IRInstruction &instruction) {
+    const IROpcode opcode = instruction.opcode;
+    if (is_logic(opcode)) {
+        bool operands[2] = {};
+        for (size_t n = 0; n < instruction.operands.size(); ++n) {
+            const runtime::Value *constant = constant_of(fn, instruction.operands[n]);
+            if (!constant || !constant->is_bool()) return std::nullopt;
+            operands[n] = constant->as_bool();
+        }
+        if (opcode == IROpcode::Not) return runtime::Value(!operands[0]);
+        if (opcode == IROpcode::And) return runtime::Value(operands[0] && operands[1]);
+        return runtime::Value(operands[0] || operands[1]);
+    }
+    if (!is_arithmetic(opcode) && !is_comparison(opcode)) return std::nullopt;
+    const std::optional<double> lhs = number_of(fn, instruction.operands[0]);
+    const std::optional<double> rhs = number_of(fn, instruction.operands[1]);
+    if (!lhs || !rhs) return std::nullopt;
+    switch (opcode) {
+    case IROpcode::Add: return runtime::Value(*lhs + *rhs);
+    case IROpcode::Sub: return runtime::Value(*lhs - *rhs);
+    case IROpcode::Mul: return runtime::Value(*lhs * *rhs);
+    case IROpcode::Div: return runtime::Value(*lhs / *rhs);
+    case IROpcode::Pow: return runtime::Value(std::pow(*lhs, *rhs));
+    case IROpcode::Eq: return runtime::Value(*lhs == *rhs);
+    case IROpcode::Neq: return runtime::Value(*lhs != *rhs);
+    case IROpcode::Lst: return runtime::Value(*lhs < *rhs);
+    case IROpcode::Grt: return runtime::Value(*lhs > *rhs);
+    case IROpcode::Lset: return runtime::Value(*lhs <= *rhs);
+    default: return runtime::Value(*lhs >= *rhs);
+    }
+}
+
+/// key that instructions with the same value share, see number_values
+using ValueKey = std::tuple<IROpcode, IRType, uint64_t, std::vector<IRValue>>;
+
+std::optional<ValueKey> key_of(const IRFunction &fn, IRValue value) {
+    const IRInstruction &instruction = fn[value];
+    std::vector<IRValue> operands = instruction.operands;
+    uint64_t immediate = instruction.immediate;
+    switch (instruction.opcode) {
+    case IROpcode::Constant: {
+        // constants are numbered by their value where it is known, so that equal constants from
+        // different places in the pool are merged.
+        const runtime::Value &constant = fn.constants[instruction.immediate];
+        if (constant.is_double()) immediate = std::bit_cast<uint64_t>(constant.as_double());
+        else if (constant.is_bool()) immediate = constant.as_bool();
+        break;
+    }
+    // phis of different blocks merge values from different places.
+    case IROpcode::Phi: immediate = instruction.block; break;
+    case IROpcode::Add:
+    case IROpcode::Mul:
+    case IROpcode::Eq:
+    case IROpcode::Neq:
+    case IROpcode::And:
+    case IROpcode::Or: std::ranges::sort(operands); break;
+    case IROpcode::Sub:
+    case IROpcode::Div:
+    case IROpcode::Pow:
+    case IROpcode::Lst:
+    case IROpcode::Grt:
+    case IROpcode::Lset:
+    case IROpcode::Gret:
+    case IROpcode::Not:
+    case IROpcode::Last:
+    case IROpcode::Load: break;
+    default: return std::nullopt;
+    }
+    return ValueKey{instruction.opcode, instruction.type, immediate, std::move(operands)};
+}
+} // namespace
+
+bool fold_constants(IRFunction &fn) {
+    std::vector<IRValue> replacements(fn.instructions.size(), no_value);
+    bool has_changed = false;
+    for (bool is_folding = true; is_folding;) {
+        is_folding = false;
+        for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+            for (IRValue value : fn.blocks[b].instructions) {
+                if (replacements[value] != no_value) continue;
+                IRInstruction &instruction = fn[value];
+                for (IRValue &operand : instruction.operands)
+                    operand = resolve(replacements, operand);
+                const std::vector<IRValue> &operands = instruction.operands;
+
+                if (instruction.opcode == IROpcode::Phi) {
+                    // a phi that merges a single value is that value, and one that merges the same
+                    // constant from everywhere is that constant.
+                    const auto other = std::ranges::find_if(
+                        operands, [&](IRValue operand) { return operand != value; });
+                    if (other == operands.end()) continue;
+                    if (std::ranges::all_of(operands, [&](IRValue operand) {
+                            return operand == value || operand == *other;
+                        })) {
+                        replacements[value] = *other;
+                    } else if (const runtime::Value *constant = constant_of(fn, *other);
+                               constant && std::ranges::all_of(operands, [&](IRValue operand) {
+                                   const runtime::Value *same = constant_of(fn, operand);
+                                   return same && is_same_constant(*same, *constant);
+                               })) {
+                        make_constant(fn, value, *constant);
+                    } else {
+                        continue;
+                    }
+                } else if (instruction.opcode == IROpcode::Branch) {
+                    const runtime::Value *condition = constant_of(fn, operands[0]);
+                    if (!condition || !condition->is_bool() || fn.blocks[b].successors.size() != 2)
+                        continue;
+                    unlink(fn, b, fn.blocks[b].successors[condition->as_bool() ? 1 : 0]);
+                    fn[value].opcode = IROpcode::Jump;
+                    fn[value].operands.clear();
+                } else if (std::optional<runtime::Value> result = evaluate(fn, instruction)) {
+                    make_constant(fn, value, std::move(*result));
+                } else {
+                    continue;
+                }
+                is_folding = has_changed = true;
+            }
+            // phis that became constants go after the phis that are left.
+            std::ranges::stable_partition(fn.blocks[b].instructions, [&](IRValue value) {
+                return fn[value].opcode == IROpcode::Phi;
+            });
+        }
+        // the phis of blocks that folded branches no longer reach lose their operands from there.
+        remove_unreachable_blocks(fn);
+    }
+    replace(fn, replacements);
+    return has_changed;
+}
+
+bool reduce_strength(IRFunction &fn) {
+    std::vector<IRValue> replacements(fn.instructions.size(), no_value);
+    bool has_changed = false;
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        for (IRValue value : std::vector(fn.blocks[b].instructions)) {
+            const IRInstruction &instruction = fn[value];
+            if (instruction.operands.size() != 2) continue;
+            const IRValue lhs = instruction.operands[0];
+            const IRValue rhs = instruction.operands[1];
+            const std::optional<double> right = number_of(fn, rhs);
+            switch (instruction.opcode) {
+            case IROpcode::Pow:
+                if (right == 2.0) {
+                    fn[value].opcode = IROpcode::Mul;
+                    fn[value].operands = {lhs, lhs};
+                } else if (right == 1.0 && fn[lhs].type == IRType::Double) {
+                    replacements[value] = lhs;
+                } else {
+                    continue;
+                }
+                break;
+            case IROpcode::Mul: {
+                const std::optional<double> left = number_of(fn, lhs);
+                const IRValue other = right == 1.0 ? lhs : rhs;
+                if ((right != 1.0 && left != 1.0) || fn[other].type != IRType::Double) continue;
+                replacements[value] = other;
+                break;
+            }
+            case IROpcode::Div: {
+                // the inverse of a power of two is exact, unless it is too small to be normal.
+                int exponent;
+                if (!right || std::abs(std::frexp(*right, &exponent)) != 0.5 ||
+                    !std::isnormal(1 / *right))
+                    continue;
+                fn.constants.emplace_back(1 / *right);
+                const IRValue inverse = insert_before(
+                    fn, value,
+                    {IROpcode::Constant, IRType::Double, b, {},
+                     static_cast<uint32_t>(fn.constants.size() - 1)});
+                fn[value].opcode = IROpcode::Mul;
+                fn[value].operands = {lhs, inverse};
+                break;
+            }
+            default: continue;
+            }
+            has_changed = true;
+        }
+    }
+    replace(fn, replacements);
+    return has_changed;
+}
+
+bool number_values(IRFunction &fn) {
+    const std::vector<std::vector<uint32_t>> children = Dominators(fn).children();
+    std::vector<IRValue> replacements(fn.instructions.size(), no_value);
+
+    // the dominator tree is walked depth first, so that the table holds the values of the blocks
+    // that dominate the block being numbered, and only those.
+    std::map<ValueKey, IRValue> table;
+    std::vector<std::vector<ValueKey>> added(fn.blocks.size());
+    std::vector<std::pair<uint32_t, bool>> stack{{0, false}};
+    while (!stack.empty()) {
+        const auto [block, is_leaving] = stack.back();
+        stack.pop_back();
+        if (is_leaving) {
+            for (const ValueKey &key : added[block])
+                table.erase(key);
+            continue;
+        }
+        stack.emplace_back(block, true);
+        for (uint32_t child : children[block])
+            stack.emplace_back(child, false);
+        for (IRValue value : fn.blocks[block].instructions) {
+            for (IRValue &operand : fn[value].operands)
+                operand = resolve(replacements, operand);
+            std::optional<ValueKey> key = key_of(fn, value);
+            if (!key) continue;
+            if (const auto [found, is_new] = table.try_emplace(*key, value); !is_new)
+                replacements[value] = found->second;
+            else added[block].push_back(std::move(*key));
+        }
+    }
+    return replace(fn, replacements);
+}
+
+bool hoist_invariants(IRFunction &fn) {
+    const Dominators dominators(fn);
+
+    // the blocks of every natural loop, by its header. a jump back to a block that dominates the
+    // jump closes a loop, whose blocks are those that reach the jump without the header.
+    std::map<uint32_t, std::vector<bool>> loops;
+    for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+        for (uint32_t header : fn.blocks[b].successors) {
+            if (!dominators.dominates(header, b)) continue;
+            std::vector<bool> &body = loops[header];
+            body.resize(fn.blocks.size());
+            body[header] = true;
+            std::vector<uint32_t> worklist{b};
+            while (!worklist.empty()) {
+                const uint32_t block = worklist.back();
+                worklist.pop_back();
+                if (body[block]) continue;
+                body[block] = true;
+                worklist.insert(worklist.end(), fn.blocks[block].predecessors.begin(),
+                                fn.blocks[block].predecessors.end());
+            }
+        }
+    }
+    // inner loops go first, so that what leaves them can then leave the loops around them.
+    std::vector<std::pair<uint32_t, std::vector<bool>>> ordered(loops.begin(), loops.end());
+    std::ranges::stable_sort(ordered, {}, [](const auto &loop) {
+        return std::ranges::count(loop.second, true);
+    });
+
+    bool has_changed = false;
+    for (const auto &[header, body] : ordered) {
+        std::vector<uint32_t> entries;
+        std::ranges::copy_if(fn.blocks[header].predecessors, std::back_inserter(entries),
+                             [&](uint32_t predecessor) { return !body[predecessor]; });
+        if (entries.size() != 1 || fn.blocks[entries[0]].successors.size() != 1) continue;
+        const uint32_t preheader = entries[0];
+
+        for (bool is_moving = true; is_moving;) {
+            is_moving = false;
+            for (uint32_t b = 0; b < fn.blocks.size(); ++b) {
+                if (!body[b]) continue;
+                for (IRValue value : std::vector(fn.blocks[b].instructions)) {
+                    const IRInstruction &instruction = fn[value];
+                    if (instruction.opcode == IROpcode::Phi || !is_safe(fn, value) ||
+                        !std::ranges::all_of(instruction.operands, [&](IRValue operand) {
+                            return !body[fn[operand].block];
+                        }))
+                        continue;
+                    move_to_end(fn, value, preheader);
+                    is_moving = has_changed = true;
+                }
+            }
+        }
+    }
+    return has_changed;
+}
+
+bool eliminate_dead_code(IRFunction &fn) {
+    // everything that an instruction with an effect uses is live.
+    std::vector<bool> is_live(fn.instructions.size());
+    std::vector<IRValue> worklist;
+    for (const IRBlock &block : fn.blocks)
+        std::ranges::copy_if(block.instructions, std::back_inserter(worklist),
+                             [&](IRValue value) { return !is_safe(fn, value); });
+    while (!worklist.empty()) {
+        const IRValue value = worklist.back();
+        worklist.pop_back();
+        if (is_live[value]) continue;
+        is_live[value] = true;
+        worklist.insert(worklist.end(), fn[value].operands.begin(), fn[value].operands.end());
+    }
+
+    bool has_changed = false;
+    for (IRBlock &block : fn.blocks)
+        if (std::erase_if(block.instructions, [&](IRValue value) { return !is_live[value]; }) > 0)
+            has_changed = true;
+    return has_changed;
+}
+
+void optimize(IRFunction &fn, const OptimizationPasses &passes) {
+    for (size_t round = 0; round < max_rounds; ++round) {
+        bool has_changed = false;
+        if (passes.fold_constants) has_changed = fold_constants(fn) || has_changed;
+        if (passes.reduce_strength) has_changed = reduce_strength(fn) || has_changed;
+        if (passes.number_values) has_changed = number_values(fn) || has_changed;
+        if (passes.hoist_invariants) has_changed = hoist_invariants(fn) || has_changed;
+        if (passes.eliminate_dead_code) has_changed = eliminate_dead_code(fn) || has_changed;
+        if (!has_changed) return;
+    }
+}
+} // namespace tachyon::codegen
@@ -1,118 +1,878 @@
 #include "tachyon/codegen/machine_generator.hpp"
 
 #include "tachyon/codegen/ir_generator.hpp"
+#include "tachyon/codegen/register_allocator.hpp"
 #include "tachyon/common/log.hpp"
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/code_cache.hpp"
+#include "x86_assembler.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <format>
+#include <optional>
+#include <utility>
 
-#include <sys/mman.h>
 
 #ifndef __x86_64__
 #error "machine code compilation for Tachyon only supports x86_64 machines."
 #endif
 
 namespace tachyon::codegen {
-std::expected<void, Error> generate_machine(IRArena ir, const std::shared_ptr<runtime::Proto> &fn,
-                                            runtime::Value *registers) {
-    TY_TRACE("generating machine code");
-    TY_TRACE(sizeof(runtime::Value) << " " << fn->constants.size());
-    TY_TRACE(sizeof(double) << " " << sizeof(bool) << " " << sizeof(std::string) << " "
-                            << sizeof(std::shared_ptr<runtime::Proto>) << " " << sizeof(Matrix)
-                            << " " << sizeof(unsigned char));
+namespace {
+/**
+ * @brief power for compiled code, which calls it for Pow
+ */
+double power(double base, double exponent) { return std::pow(base, exponent); }
+
+bool is_comparison(IROpcode opcode) { return opcode >= IROpcode::Eq && opcode <= IROpcode::Gret; }
+
+/**
+ * @brief cmpsd predicate of a comparison. cmpsd has no greater-than predicates, so those swap
+ *  their operands and use the less-than ones
+ */
+uint8_t cmpsd_predicate(IROpcode opcode) {
+    switch (opcode) {
+    case IROpcode::Eq: return 0;
+    case IROpcode::Neq: return 4;
+    case IROpcode::Lst:
+    case IROpcode::Grt: return 1;
+    default: return 2;
+    }
+}
 
-    auto size = 10000; // TODO: fix
+/**
+ * @brief jump to a label unless a comparison of two registers holds
+ *
+ * The comparison is unordered if an operand is NaN, for which ucomisd sets zero, parity and carry,
+ * and only != holds.
+ */
+void emit_jump_unless(Assembler &a, IROpcode opcode, uint8_t lhs, uint8_t rhs,
+                      Assembler::Label to) {
+    switch (opcode) {
+    case IROpcode::Eq:
+        a.ucomisd(lhs, rhs);
+        a.jcc(Condition::NotEqual, to);
+        a.jcc(Condition::Parity, to);
+        break;
+    case IROpcode::Neq: {
+        const Assembler::Label unordered = a.new_label();
+        a.ucomisd(lhs, rhs);
+        a.jcc(Condition::Parity, unordered);
+        a.jcc(Condition::Equal, to);
+        a.bind(unordered);
+        break;
+    }
+    case IROpcode::Lst:
+    case IROpcode::Lset:
+        a.ucomisd(rhs, lhs);
+        a.jcc(opcode == IROpcode::Lst ? Condition::BelowOrEqual : Condition::Below, to);
+        break;
+    default:
+        a.ucomisd(lhs, rhs);
+        a.jcc(opcode == IROpcode::Grt ? Condition::BelowOrEqual : Condition::Below, to);
+        break;
+    }
+}
+
+/**
+ * @brief whether generate_machine supports every instruction of a function, on the kinds of its
+ *  operands
+ *
+ * Values are doubles, and booleans, which are only made by constants, comparisons and logic.
+ * Parameters have to be arguments, which the compiled code checks to hold doubles.
+ */
+bool is_supported(const IRFunction &ir, size_t arguments) {
+    const auto is_bool = [&](IRValue value) { return ir[value].type == IRType::Bool; };
+    for (const IRBlock &block : ir.blocks) {
+        // an edge has to move the operands of one predecessor into the phis.
+        for (uint32_t predecessor : block.predecessors)
+            if (std::ranges::count(block.predecessors, predecessor) != 1) return false;
+        for (IRValue value : block.instructions) {
+            const IRInstruction &instruction = ir[value];
+            const auto operands_are_bools = [&](bool is_boolean) {
+                return std::ranges::all_of(instruction.operands, [&](IRValue operand) {
+                    return is_bool(operand) == is_boolean;
+                });
+            };
+            switch (instruction.opcode) {
+            case IROpcode::Parameter:
+                if (instruction.immediate == 0 || instruction.immediate > arguments) return false;
+                break;
+            case IROpcode::Jump: break;
+            case IROpcode::Constant: {
+                const runtime::Value &constant = ir.constants[instruction.immediate];
+                if (!constant.is_double() && !constant.is_bool()) return false;
+                break;
+            }
+            case IROpcode::Phi:
+                if (!operands_are_bools(is_bool(value))) return false;
+                break;
+            case IROpcode::Add:
+            case IROpcode::Sub:
+            case IROpcode::Mul:
+            case IROpcode::Div:
+            case IROpcode::Pow:
+            case IROpcode::Eq:
+            case IROpcode::Neq:
+            case IROpcode::Lst:
+            case IROpcode::Grt:
+            case IROpcode::Lset:
+            case IROpcode::Gret:
+                if (!operands_are_bools(false)) return false;
+                break;
+            case IROpcode::Not:
+            case IROpcode::And:
+            case IROpcode::Or:
+            case IROpcode::Branch:
+                if (!operands_are_bools(true)) return false;
+                break;
+            case IROpcode::Return:
+                if (instruction.operands.size() != 1) return false;
+                break;
+            default: return false;
+            }
+        }
+    }
+    return true;
+}
+} // namespace
 
-    const auto code = static_cast<uint8_t *>(
-        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
-    if (code == MAP_FAILED) {
-        perror("mmap");
+std::expected<std::vector<uint8_t>, Error> generate_machine(const IRFunction &ir,
+                                                           size_t arguments) {
+    using runtime::Value;
+    TY_TRACE("generating machine code");
+    if (!is_supported(ir, arguments))
         return std::unexpected(
-            Error::create(ErrorKind::MachineGenerationError, SourceSpan(0, 0), "mmap failed"));
-    }
-
-    // const auto get = [fn](IRPointer ptr) -> uint16_t {
-    //     switch (ptr.kind) {
-    //     case IRPointerKind::Constant:
-    //         return static_cast<uint16_t>(std::get<double>(fn->constants[ptr.value]));
-    //     case IRPointerKind::Register: return ptr.value;
-    //     }
-    // };
-
-    for (size_t i = 0, j = 0; i < ir.size(); i++) {
-        switch (ir[i].kind) {
-        case IRNodeKind::Add: {
-            // TODO: support xmm8-xmm15
-            // TODO: gaurd against something larger than xmm7/15
-            // TODO: handle overflow. can we go to stack?
-
-            // TODO: bench whether we should have multiple emplace_backs, etc...
-            // mov rax, addr
-            code[j++] = 0x48;
-            code[j++] = 0xB8;
-            switch (ir[i].lhs.kind) {
-            case IRPointerKind::Constant:
-                *reinterpret_cast<uint64_t *>(code + j) =
-                    reinterpret_cast<uint64_t>(fn->constants.data() + ir[i].lhs.value);
-                break;
-            case IRPointerKind::Register:
-                *reinterpret_cast<uint64_t *>(code + j) =
-                    reinterpret_cast<uint64_t>(registers + ir[i].lhs.value);
-                break;
-            }
-            j += 8;
-            // movsd xmm0, [rax]
-            code[j++] = 0xF2;
-            code[j++] = 0x0F;
-            code[j++] = 0x10;
-            code[j++] = 0x00;
-
-            // mov rbx, addr
-            code[j++] = 0x48;
-            code[j++] = 0xBB;
-            switch (ir[i].rhs.kind) {
-            case IRPointerKind::Constant:
-                *reinterpret_cast<uint64_t *>(code + j) =
-                    reinterpret_cast<uint64_t>(fn->constants.data() + ir[i].rhs.value);
-                break;
-            case IRPointerKind::Register:
-                *reinterpret_cast<uint64_t *>(code + j) =
-                    reinterpret_cast<uint64_t>(registers + ir[i].rhs.value);
-                break;
-            }
-            j += 8;
-            // movsd xmm1, [rbx]
-            code[j++] = 0xF2;
-            code[j++] = 0x0F;
-            code[j++] = 0x10;
-            code[j++] = 0x0B;
-
-            // addsd xmm0, xmm1
-            code[j++] = 0xF2;
-            code[j++] = 0x0F;
-            code[j++] = 0x58;
-            code[j++] = 0xC1;
+            Error::create(ErrorKind::InternalError, SourceSpan(0, 0),
+                          "could not generate machine code for intermediate representation node"));
 
-            break;
+    // values live in xmm0 to xmm13 and in stack slots, and booleans are masks, as produced by
+    // cmpsd. xmm14 and xmm15 are scratch registers, for operands in stack slots and for results
+    // that would overwrite an operand that is still needed.
+    constexpr uint8_t lhs_scratch = 14;
+    constexpr uint8_t rhs_scratch = 15;
+    const RegisterAllocation allocation = allocate_registers(ir, lhs_scratch);
+    const auto location = [&](IRValue value) { return allocation.locations[value]; };
+    const auto in_register = [](uint8_t reg) { return Location{false, reg}; };
+
+    // positions of the instructions, as in the live intervals.
+    std::vector<uint32_t> position(ir.instructions.size());
+    std::vector<uint32_t> end(ir.instructions.size());
+    uint32_t n = 0;
+    bool has_calls = false;
+    for (const IRBlock &block : ir.blocks) {
+        for (IRValue value : block.instructions) {
+            position[value] = 2 * n++;
+            if (ir[value].opcode == IROpcode::Pow) has_calls = true;
+        }
+    }
+    for (const LiveInterval &interval : allocation.intervals) end[interval.value] = interval.end;
+
+    // the frame holds the stack slots, then a place for every register and for the pointer to the
+    // result, where they are kept during calls. calls need rsp to be aligned to 16 bytes, which it
+    // is not after the return address is pushed.
+    const size_t saved = has_calls ? lhs_scratch : 0;
+    const size_t result_slot = allocation.slots + saved;
+    auto frame = static_cast<uint32_t>(8 * (allocation.slots + saved + (has_calls ? 1 : 0)));
+    if (has_calls && frame % 16 == 0) frame += 8;
+    const auto slot = [](size_t index) { return static_cast<int32_t>(8 * index); };
+
+    // a comparison right before the branch on it, which nothing else reads, sets the flags for the
+    // branch instead of making a mask.
+    std::vector<bool> is_fused(ir.instructions.size());
+    for (uint32_t b = 0; b < ir.blocks.size(); ++b) {
+        const std::vector<IRValue> &body = ir.blocks[b].instructions;
+        const IRInstruction &terminator = ir.terminator(b);
+        if (terminator.opcode != IROpcode::Branch || body.size() < 2) continue;
+        const IRValue condition = terminator.operands[0];
+        if (condition == body[body.size() - 2] && is_comparison(ir[condition].opcode) &&
+            end[condition] == position[body.back()])
+            is_fused[condition] = true;
+    }
+
+    Assembler a;
+    std::vector<Assembler::Label> labels;
+    for (size_t b = 0; b < ir.blocks.size(); ++b)
+        labels.push_back(a.new_label());
+    const Assembler::Label bail = a.new_label();
+
+    const auto move = [&](Location dst, Location src) {
+        if (dst == src) return;
+        if (src.is_spilled && dst.is_spilled) {
+            a.movsd_load(rhs_scratch, Gpr::Rsp, slot(src.index));
+            a.movsd_store(Gpr::Rsp, slot(dst.index), rhs_scratch);
+        } else if (src.is_spilled) {
+            a.movsd_load(static_cast<uint8_t>(dst.index), Gpr::Rsp, slot(src.index));
+        } else if (dst.is_spilled) {
+            a.movsd_store(Gpr::Rsp, slot(dst.index), static_cast<uint8_t>(src.index));
+        } else {
+            a.movapd(static_cast<uint8_t>(dst.index), static_cast<uint8_t>(src.index));
+        }
+    };
+    // moves values at once, so that no move overwrites the source of another one that is still to
+    // be made. a cycle of moves is broken by moving one of its values to a scratch register.
+    const auto move_all = [&](std::vector<std::pair<Location, Location>> moves) {
+        std::erase_if(moves, [](const auto &m) { return m.first == m.second; });
+        while (!moves.empty()) {
+            const auto ready = std::ranges::find_if(moves, [&](const auto &m) {
+                return std::ranges::none_of(
+                    moves, [&](const auto &other) { return other.second == m.first; });
+            });
+            if (ready != moves.end()) {
+                move(ready->first, ready->second);
+                moves.erase(ready);
+                continue;
+            }
+            const Location blocked = moves.front().first;
+            move(in_register(lhs_scratch), blocked);
+            for (auto &m : moves)
+                if (m.second == blocked) m.second = in_register(lhs_scratch);
+        }
+    };
+    // register that holds a value, which is loaded to a scratch register if it is spilled.
+    const auto operand = [&](IRValue value, uint8_t scratch) {
+        const Location from = location(value);
+        if (!from.is_spilled) return static_cast<uint8_t>(from.index);
+        a.movsd_load(scratch, Gpr::Rsp, slot(from.index));
+        return scratch;
+    };
+    // value = lhs <operation> rhs, for an instruction that overwrites its first operand.
+    const auto binary = [&](IRValue value, IRValue lhs, IRValue rhs, bool is_commutative,
+                            auto &&operation) {
+        const Location result = location(value);
+        if (is_commutative && location(rhs) == result) std::swap(lhs, rhs);
+        const uint8_t dst = result.is_spilled || (location(rhs) == result && lhs != rhs)
+                                ? lhs_scratch
+                                : static_cast<uint8_t>(result.index);
+        move(in_register(dst), location(lhs));
+        operation(dst, operand(rhs, rhs_scratch));
+        move(result, in_register(dst));
+    };
+    const auto load_constant = [&](Location dst, uint64_t bits) {
+        if (!dst.is_spilled && bits == 0) {
+            a.xorpd(static_cast<uint8_t>(dst.index), static_cast<uint8_t>(dst.index));
+            return;
+        }
+        a.mov_rax(bits);
+        if (dst.is_spilled) a.mov_store(Gpr::Rsp, slot(dst.index), Gpr::Rax);
+        else a.movq_from_rax(static_cast<uint8_t>(dst.index));
+    };
+    // jumps to a label unless a boolean holds, see emit_jump_unless.
+    const auto jump_unless = [&](IRValue condition, Assembler::Label to) {
+        if (!is_fused[condition]) {
+            a.movq_to_rax(operand(condition, lhs_scratch));
+            a.test_rax();
+            a.jcc(Condition::Equal, to);
+            return;
+        }
+        const IRInstruction &comparison = ir[condition];
+        const uint8_t lhs = operand(comparison.operands[0], lhs_scratch);
+        const uint8_t rhs = operand(comparison.operands[1], rhs_scratch);
+        emit_jump_unless(a, comparison.opcode, lhs, rhs, to);
+    };
+    // moves the operands of the phis of a successor that come from a block into the phis.
+    const auto phi_moves = [&](uint32_t from, uint32_t to) {
+        const IRBlock &successor = ir.blocks[to];
+        const auto j = std::ranges::find(successor.predecessors, from) -
+                       successor.predecessors.begin();
+        std::vector<std::pair<Location, Location>> moves;
+        for (IRValue value : successor.instructions)
+            if (ir[value].opcode == IROpcode::Phi)
+                moves.emplace_back(location(value), location(ir[value].operands[j]));
+        std::erase_if(moves, [](const auto &m) { return m.first == m.second; });
+        return moves;
+    };
+    const auto edge = [&](uint32_t from, uint32_t to, bool can_fall_through) {
+        move_all(phi_moves(from, to));
+        if (!can_fall_through || to != from + 1) a.jmp(labels[to]);
+    };
+
+    // the arguments are in rdi and the result goes to rsi, which calls may overwrite. every
+    // argument that the function reads has to hold a double, or it leaves without a result.
+    if (frame != 0) a.sub_rsp(frame);
+    if (has_calls) a.mov_store(Gpr::Rsp, slot(result_slot), Gpr::Rsi);
+    a.mov_rcx(Value::nil_tag);
+    for (IRValue value : ir.blocks[0].instructions) {
+        const IRInstruction &instruction = ir[value];
+        if (instruction.opcode != IROpcode::Parameter) continue;
+        const Location result = location(value);
+        a.mov_load(Gpr::Rax, Gpr::Rdi, slot(instruction.immediate - 1));
+        a.cmp_rax_rcx();
+        a.jcc(Condition::AboveOrEqual, bail);
+        if (result.is_spilled) a.mov_store(Gpr::Rsp, slot(result.index), Gpr::Rax);
+        else a.movq_from_rax(static_cast<uint8_t>(result.index));
+    }
+
+    for (uint32_t b = 0; b < ir.blocks.size(); ++b) {
+        const IRBlock &block = ir.blocks[b];
+        a.bind(labels[b]);
+        for (IRValue value : block.instructions) {
+            const IRInstruction &instruction = ir[value];
+            const Location result = location(value);
+            switch (instruction.opcode) {
+            case IROpcode::Constant: {
+                const runtime::Value &constant = ir.constants[instruction.immediate];
+                if (constant.is_double())
+                    load_constant(result, std::bit_cast<uint64_t>(constant.as_double()));
+                else load_constant(result, constant.as_bool() ? ~uint64_t{0} : 0);
+                break;
+            }
+            case IROpcode::Parameter:
+            case IROpcode::Phi: break;
+            case IROpcode::Add:
+                binary(value, instruction.operands[0], instruction.operands[1], true,
+                       [&](uint8_t dst, uint8_t src) { a.addsd(dst, src); });
+                break;
+            case IROpcode::Sub:
+                binary(value, instruction.operands[0], instruction.operands[1], false,
+                       [&](uint8_t dst, uint8_t src) { a.subsd(dst, src); });
+                break;
+            case IROpcode::Mul:
+                binary(value, instruction.operands[0], instruction.operands[1], true,
+                       [&](uint8_t dst, uint8_t src) { a.mulsd(dst, src); });
+                break;
+            case IROpcode::Div:
+                binary(value, instruction.operands[0], instruction.operands[1], false,
+                       [&](uint8_t dst, uint8_t src) { a.divsd(dst, src); });
+                break;
+            case IROpcode::Pow: {
+                // the registers of values that are live across the call are kept in the frame.
+                std::vector<uint8_t> live;
+                for (const LiveInterval &interval : allocation.intervals) {
+                    const Location held = location(interval.value);
+                    if (!held.is_spilled && interval.start <= position[value] &&
+                        interval.end > position[value])
+                        live.push_back(static_cast<uint8_t>(held.index));
+                }
+                for (uint8_t reg : live)
+                    a.movsd_store(Gpr::Rsp, slot(allocation.slots + reg), reg);
+                move_all({{in_register(0), location(instruction.operands[0])},
+                          {in_register(1), location(instruction.operands[1])}});
+                a.mov_rax(reinterpret_cast<uint64_t>(&power));
+                a.call_rax();
+                move(result, in_register(0));
+                for (uint8_t reg : live)
+                    a.movsd_load(reg, Gpr::Rsp, slot(allocation.slots + reg));
+                break;
+            }
+            case IROpcode::Eq:
+            case IROpcode::Neq:
+            case IROpcode::Lst:
+            case IROpcode::Grt:
+            case IROpcode::Lset:
+            case IROpcode::Gret: {
+                if (is_fused[value]) break;
+                const IROpcode opcode = instruction.opcode;
+                const bool is_swapped = opcode == IROpcode::Grt || opcode == IROpcode::Gret;
+                const uint8_t predicate = cmpsd_predicate(opcode);
+                binary(value, instruction.operands[is_swapped ? 1 : 0],
+                       instruction.operands[is_swapped ? 0 : 1],
+                       opcode == IROpcode::Eq || opcode == IROpcode::Neq,
+                       [&](uint8_t dst, uint8_t src) { a.cmpsd(dst, src, predicate); });
+                break;
+            }
+            case IROpcode::Not: {
+                const uint8_t dst =
+                    result.is_spilled ? lhs_scratch : static_cast<uint8_t>(result.index);
+                move(in_register(dst), location(instruction.operands[0]));
+                a.pcmpeqd(rhs_scratch, rhs_scratch);
+                a.xorpd(dst, rhs_scratch);
+                move(result, in_register(dst));
+                break;
+            }
+            case IROpcode::And:
+                binary(value, instruction.operands[0], instruction.operands[1], true,
+                       [&](uint8_t dst, uint8_t src) { a.andpd(dst, src); });
+                break;
+            case IROpcode::Or:
+                binary(value, instruction.operands[0], instruction.operands[1], true,
+                       [&](uint8_t dst, uint8_t src) { a.orpd(dst, src); });
+                break;
+            case IROpcode::Jump: edge(b, block.successors[0], true); break;
+            case IROpcode::Branch: {
+                // the second successor is jumped to directly if no phi there needs a move.
+                const uint32_t taken = block.successors[0];
+                const uint32_t fallen = block.successors[1];
+                const bool has_moves = !phi_moves(b, fallen).empty();
+                const Assembler::Label otherwise = has_moves ? a.new_label() : labels[fallen];
+                jump_unless(instruction.operands[0], otherwise);
+                edge(b, taken, !has_moves);
+                if (has_moves) {
+                    a.bind(otherwise);
+                    edge(b, fallen, true);
+                }
+                break;
+            }
+            case IROpcode::Return: {
+                // the result is stored as a value: booleans are boxed, and NaNs made canonical.
+                const IRValue returned = instruction.operands[0];
+                const uint8_t src = operand(returned, lhs_scratch);
+                a.movq_to_rax(src);
+                if (ir[returned].type == IRType::Bool) {
+                    a.and_eax(1);
+                    a.mov_rcx(Value::bool_tag);
+                    a.or_rax_rcx();
+                } else {
+                    const Assembler::Label ordered = a.new_label();
+                    a.ucomisd(src, src);
+                    a.jcc(Condition::NotParity, ordered);
+                    a.mov_rax(Value::canonical_nan);
+                    a.bind(ordered);
+                }
+                if (has_calls) a.mov_load(Gpr::Rsi, Gpr::Rsp, slot(result_slot));
+                a.mov_store(Gpr::Rsi, 0, Gpr::Rax);
+                a.mov_eax(1);
+                if (frame != 0) a.add_rsp(frame);
+                a.ret();
+                break;
+            }
+            default: break;
+            }
+        }
+    }
+
+    a.bind(bail);
+    a.xor_eax();
+    if (frame != 0) a.add_rsp(frame);
+    a.ret();
+
+    return a.finish();
+}
+
+namespace {
+using runtime::Instruction;
+using runtime::OpcodeFamily;
+using runtime::OperandKind;
+using Kind = runtime::Value::Kind;
+using Registers = std::vector<bool>;
+
+Error loop_error(std::string hint) {
+    return Error::create(ErrorKind::MachineGenerationError, SourceSpan(0, 0),
+                         "could not compile loop")
+        .withHint(std::move(hint));
+}
+
+bool is_return(uint16_t op) {
+    return op == runtime::RETV || op == runtime::RETC || op == runtime::RETR;
+}
+
+/**
+ * @brief register that the last operand of an instruction names, which is the destination of the
+ *  instructions that write one, or register 0 for any other instruction
+ */
+uint16_t destination(const Instruction &instruction) {
+    const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+    if (info.operand_count == 0 || info.operands[info.operand_count - 1] != OperandKind::Register)
+        return 0;
+    return instruction.operands[info.operand_count - 1].reg;
+}
+
+/**
+ * @brief registers that an instruction reads, and the one that it writes
+ *
+ * Instructions other than those that the loop compiler knows are taken to read all of their
+ * register operands, and to write none.
+ *
+ * @return false for calls, which may read any register from their offset on
+ */
+bool accesses(const Instruction &instruction, std::vector<uint16_t> &uses,
+              std::optional<uint16_t> &def) {
+    const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+    uses.clear();
+    def.reset();
+    switch (info.family) {
+    case OpcodeFamily::None: break;
+    case OpcodeFamily::Branch:
+        for (size_t n = 0; n < 2; ++n)
+            if (info.operands[n] == OperandKind::Register)
+                uses.push_back(instruction.operands[n].reg);
+        return true;
+    default:
+        for (size_t n = 0; n + 1 < info.operand_count; ++n)
+            if (info.operands[n] == OperandKind::Register)
+                uses.push_back(instruction.operands[n].reg);
+        def = instruction.operands[info.operand_count - 1].reg;
+        return true;
+    }
+    switch (instruction.op) {
+    case runtime::LOCR: def = instruction.operands[1].reg; return true;
+    case runtime::LORR:
+        uses.push_back(instruction.operands[0].reg);
+        def = instruction.operands[1].reg;
+        return true;
+    case runtime::JMRI:
+    case runtime::JMRN:
+    case runtime::RETR: uses.push_back(instruction.operands[0].reg); return true;
+    case runtime::JMCI:
+    case runtime::JMCN:
+    case runtime::JMPU:
+    case runtime::LOOP:
+    case runtime::NOOP:
+    case runtime::RETV:
+    case runtime::RETC: return true;
+    case runtime::CALC:
+    case runtime::CALR:
+    case runtime::TALC:
+    case runtime::TALR:
+    case runtime::CAIR:
+    case runtime::CAMR: return false;
+    default:
+        for (size_t n = 0; n < info.operand_count; ++n)
+            if (info.operands[n] == OperandKind::Register)
+                uses.push_back(instruction.operands[n].reg);
+        return true;
+    }
+}
+
+/**
+ * @brief instructions that control may continue at after an instruction
+ */
+std::vector<uint32_t> successors(const std::vector<Instruction> &code, uint32_t i) {
+    const Instruction &instruction = code[i];
+    const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+    std::vector<uint32_t> next;
+    for (size_t n = 0; n < info.operand_count; ++n)
+        if (info.operands[n] == OperandKind::Target)
+            next.push_back(instruction.operands[n].target);
+    const bool falls_through = instruction.op != runtime::JMPU &&
+                               instruction.op != runtime::LOOP && !is_return(instruction.op);
+    if (falls_through && i + 1 < code.size()) next.push_back(i + 1);
+    return next;
+}
+
+/**
+ * @brief registers that may be read before they are written again, at the start of every
+ *  instruction of a function
+ *
+ * Calls may read any register, and so may returns if the frame is read after it returns.
+ */
+std::vector<Registers> live_registers(const runtime::Proto &fn, bool keeps_frame) {
+    const std::vector<Instruction> &code = fn.code;
+    std::vector<Registers> live(code.size(), Registers(fn.registers));
+    std::vector<uint16_t> uses;
+    std::optional<uint16_t> def;
+    for (bool has_changed = true; has_changed;) {
+        has_changed = false;
+        for (auto i = static_cast<uint32_t>(code.size()); i-- > 0;) {
+            Registers registers(fn.registers);
+            if (!accesses(code[i], uses, def) || (keeps_frame && is_return(code[i].op))) {
+                registers.flip();
+            } else {
+                for (uint32_t next : successors(code, i))
+                    for (size_t r = 0; r < fn.registers; ++r)
+                        if (live[next][r]) registers[r] = true;
+                if (def) registers[*def] = false;
+                for (uint16_t use : uses)
+                    registers[use] = true;
+            }
+            if (registers != live[i]) {
+                live[i] = std::move(registers);
+                has_changed = true;
+            }
         }
-        case IRNodeKind::Ret:
-            // TODO: this is not actually RETR/RETC-ing.
-            code[j++] = 0xC3;
+    }
+    return live;
+}
+} // namespace
+
+std::expected<std::unique_ptr<runtime::CompiledLoop>, Error>
+generate_loop(const runtime::Proto &fn, uint32_t header, uint32_t back_edge, bool keeps_frame) {
+    using enum parser::Op;
+    using Binding = runtime::CompiledLoop::Binding;
+    const std::vector<Instruction> &code = fn.code;
+    if (header > back_edge || back_edge >= code.size())
+        return std::unexpected(loop_error("The loop is outside of the function."));
+    const auto is_in_loop = [&](uint32_t index) { return index >= header && index <= back_edge; };
+
+    // find the one kind that every register that the loop uses holds.
+    std::vector<std::optional<Kind>> kinds(fn.registers);
+    Registers is_used(fn.registers);
+    Registers is_written(fn.registers);
+    bool has_conflict = false;
+    const auto require = [&](uint16_t reg, Kind kind) {
+        if (kinds[reg] && *kinds[reg] != kind) has_conflict = true;
+        kinds[reg] = kind;
+        is_used[reg] = true;
+    };
+    const auto define = [&](uint16_t reg, Kind kind) {
+        require(reg, kind);
+        is_written[reg] = true;
+    };
+    // whether source operand n of an instruction holds a kind, or has to once the loop runs.
+    const auto source_is = [&](const Instruction &instruction, size_t n, Kind kind) {
+        if (runtime::opcode_info(instruction.op).operands[n] == OperandKind::Constant)
+            return instruction.operands[n].constant->kind() == kind;
+        require(instruction.operands[n].reg, kind);
+        return true;
+    };
+
+    for (uint32_t i = header; i <= back_edge; ++i) {
+        const Instruction &instruction = code[i];
+        const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+        const uint16_t result = destination(instruction);
+        bool is_supported = true;
+        switch (info.family) {
+        case OpcodeFamily::Arithmetic:
+        case OpcodeFamily::Quickened:
+            is_supported = info.operation != Pow && source_is(instruction, 0, Kind::Double) &&
+                           source_is(instruction, 1, Kind::Double);
+            define(result, Kind::Double);
+            break;
+        case OpcodeFamily::Comparison:
+            is_supported = source_is(instruction, 0, Kind::Double) &&
+                           source_is(instruction, 1, Kind::Double);
+            define(result, Kind::Bool);
+            break;
+        case OpcodeFamily::Branch:
+            is_supported = source_is(instruction, 0, Kind::Double) &&
+                           source_is(instruction, 1, Kind::Double);
+            break;
+        case OpcodeFamily::Logic:
+            is_supported = source_is(instruction, 0, Kind::Bool) &&
+                           (info.operation == Not || source_is(instruction, 1, Kind::Bool));
+            define(result, Kind::Bool);
+            break;
+        case OpcodeFamily::None:
+            switch (instruction.op) {
+            case runtime::LOCR: {
+                const Kind kind = instruction.operands[0].constant->kind();
+                is_supported = kind == Kind::Double || kind == Kind::Bool;
+                define(result, kind);
+                break;
+            }
+            case runtime::LORR:
+                is_used[instruction.operands[0].reg] = is_used[result] = true;
+                is_written[result] = true;
+                break;
+            case runtime::JMCI:
+            case runtime::JMCN:
+            case runtime::JMRI:
+            case runtime::JMRN: is_supported = source_is(instruction, 0, Kind::Bool); break;
+            case runtime::JMPU:
+            case runtime::LOOP:
+            case runtime::NOOP:
+            case runtime::RETV:
+            case runtime::RETC:
+            case runtime::RETR: break;
+            default: is_supported = false; break;
+            }
             break;
-        default:
-            return std::unexpected(Error::create(
-                ErrorKind::InternalError, SourceSpan(0, 0),
-                "could not generate machine code for intermediate representation node"));
         }
+        if (!is_supported)
+            return std::unexpected(loop_error(std::format(
+                "Selected bytecode {} is not supported.", runtime::bytecode_to_str(code[i].op))));
     }
 
-    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
-        perror("mprotect");
-        munmap(code, size);
+    // moves copy the kind of their source, in either direction, until every register has one.
+    for (bool has_changed = true; has_changed && !has_conflict;) {
+        has_changed = false;
+        for (uint32_t i = header; i <= back_edge; ++i) {
+            if (code[i].op != runtime::LORR) continue;
+            std::optional<Kind> &src = kinds[code[i].operands[0].reg];
+            std::optional<Kind> &dst = kinds[code[i].operands[1].reg];
+            if (src == dst) continue;
+            if (src && dst) {
+                has_conflict = true;
+            } else {
+                (src ? dst : src) = src ? src : dst;
+                has_changed = true;
+            }
+        }
+    }
+    for (size_t r = 0; r < fn.registers; ++r)
+        if (is_used[r] && !kinds[r]) has_conflict = true;
+    if (has_conflict)
         return std::unexpected(
-            Error::create(ErrorKind::MachineGenerationError, SourceSpan(0, 0), "mprotect failed"));
+            loop_error("A register does not hold one kind of double or boolean."));
+
+    // registers share a slot unless one is written while the other is live, or both are live when
+    // the loop is entered. moves do not keep their source and destination apart, since both hold
+    // the same value afterwards.
+    const std::vector<Registers> live = live_registers(fn, keeps_frame);
+    std::vector<Registers> interferes(fn.registers, Registers(fn.registers));
+    const auto interfere = [&](size_t a, size_t b) {
+        if (a != b && is_used[a] && is_used[b]) interferes[a][b] = interferes[b][a] = true;
+    };
+    for (size_t a = 0; a < fn.registers; ++a)
+        for (size_t b = 0; b < fn.registers; ++b)
+            if (live[header][a] && live[header][b]) interfere(a, b);
+    std::vector<uint16_t> uses;
+    std::optional<uint16_t> def;
+    for (uint32_t i = header; i <= back_edge; ++i) {
+        if (!accesses(code[i], uses, def) || !def) continue;
+        for (uint32_t next : successors(code, i))
+            for (size_t r = 0; r < fn.registers; ++r)
+                if (live[next][r] && !(code[i].op == runtime::LORR && r == uses[0]))
+                    interfere(*def, r);
+    }
+    std::vector<uint8_t> slots(fn.registers);
+    for (size_t r = 0; r < fn.registers; ++r) {
+        if (!is_used[r]) continue;
+        std::vector<bool> is_taken(runtime::CompiledLoop::max_slots + 1);
+        for (size_t other = 0; other < r; ++other)
+            if (interferes[r][other]) is_taken[slots[other]] = true;
+        slots[r] = static_cast<uint8_t>(std::ranges::find(is_taken, false) - is_taken.begin());
+        if (slots[r] == runtime::CompiledLoop::max_slots)
+            return std::unexpected(loop_error("The loop has too many live registers."));
+    }
+
+    auto loop = std::make_unique<runtime::CompiledLoop>();
+    const auto bindings = [&](const Registers &registers, const Registers &among) {
+        std::vector<Binding> result;
+        for (size_t r = 0; r < fn.registers; ++r)
+            if (registers[r] && among[r])
+                result.push_back({static_cast<uint16_t>(r), slots[r], *kinds[r]});
+        return result;
+    };
+    loop->inputs = bindings(live[header], is_used);
+
+    // every slot lives in the XMM register of its index, and the last two are scratch registers
+    // for constants. booleans are masks, as produced by cmpsd.
+    constexpr uint8_t lhs_scratch = 14;
+    constexpr uint8_t rhs_scratch = 15;
+    Assembler a;
+    std::vector<Assembler::Label> labels;
+    for (uint32_t i = header; i <= back_edge; ++i)
+        labels.push_back(a.new_label());
+    std::vector<Assembler::Label> exit_labels;
+    // leaves to the instruction at an index, which a return runs again in the interpreter.
+    const auto exit = [&](uint32_t index) {
+        for (size_t k = 0; k < loop->exits.size(); ++k)
+            if (loop->exits[k].target == index) return exit_labels[k];
+        loop->exits.push_back({index, bindings(live[index], is_written)});
+        return exit_labels.emplace_back(a.new_label());
+    };
+    const auto target = [&](uint32_t index) {
+        return is_in_loop(index) ? labels[index - header] : exit(index);
+    };
+    const auto load_constant = [&](uint8_t dst, const runtime::Value &value) {
+        if (value.is_double()) a.mov_rax(std::bit_cast<uint64_t>(value.as_double()));
+        else a.mov_rax(value.as_bool() ? ~uint64_t{0} : 0);
+        a.movq_from_rax(dst);
+    };
+    const auto source = [&](const Instruction &instruction, size_t n, uint8_t scratch) {
+        if (runtime::opcode_info(instruction.op).operands[n] != OperandKind::Constant)
+            return slots[instruction.operands[n].reg];
+        load_constant(scratch, *instruction.operands[n].constant);
+        return scratch;
+    };
+    // dst = lhs <operation> rhs, for an instruction that overwrites its first operand.
+    const auto binary = [&](uint8_t dst, uint8_t lhs, uint8_t rhs, auto &&operation) {
+        if (dst == lhs) {
+            operation(dst, rhs);
+        } else if (dst != rhs) {
+            a.movapd(dst, lhs);
+            operation(dst, rhs);
+        } else {
+            if (lhs != lhs_scratch) a.movapd(lhs_scratch, lhs);
+            operation(lhs_scratch, rhs);
+            a.movapd(dst, lhs_scratch);
+        }
+    };
+
+    for (const Binding &input : loop->inputs)
+        a.movsd_load(input.slot, 8 * input.slot);
+
+    for (uint32_t i = header; i <= back_edge; ++i) {
+        const Instruction &instruction = code[i];
+        const runtime::OpcodeInfo &info = runtime::opcode_info(instruction.op);
+        const uint8_t result = slots[destination(instruction)];
+        a.bind(labels[i - header]);
+        switch (info.family) {
+        case OpcodeFamily::Arithmetic:
+        case OpcodeFamily::Quickened:
+            binary(result, source(instruction, 0, lhs_scratch),
+                   source(instruction, 1, rhs_scratch), [&](uint8_t dst, uint8_t src) {
+                       switch (info.operation) {
+                       case Add: a.addsd(dst, src); break;
+                       case Sub: a.subsd(dst, src); break;
+                       case Mul: a.mulsd(dst, src); break;
+                       default: a.divsd(dst, src); break;
+                       }
+                   });
+            break;
+        case OpcodeFamily::Comparison: {
+            const uint8_t lhs = source(instruction, 0, lhs_scratch);
+            const uint8_t rhs = source(instruction, 1, rhs_scratch);
+            const bool is_swapped = info.operation == Grt || info.operation == Gret;
+            const uint8_t predicate = cmpsd_predicate(family_opcode(info.operation));
+            binary(result, is_swapped ? rhs : lhs, is_swapped ? lhs : rhs,
+                   [&](uint8_t dst, uint8_t src) { a.cmpsd(dst, src, predicate); });
+            break;
+        }
+        case OpcodeFamily::Branch: {
+            const uint8_t lhs = source(instruction, 0, lhs_scratch);
+            const uint8_t rhs = source(instruction, 1, rhs_scratch);
+            emit_jump_unless(a, family_opcode(info.operation), lhs, rhs,
+                             target(instruction.operands[2].target));
+            break;
+        }
+        case OpcodeFamily::Logic: {
+            const uint8_t lhs = source(instruction, 0, lhs_scratch);
+            if (info.operation == Not) {
+                if (result != lhs) a.movapd(result, lhs);
+                a.pcmpeqd(rhs_scratch, rhs_scratch);
+                a.xorpd(result, rhs_scratch);
+                break;
+            }
+            binary(result, lhs, source(instruction, 1, rhs_scratch),
+                   [&](uint8_t dst, uint8_t src) {
+                       if (info.operation == And) a.andpd(dst, src);
+                       else a.orpd(dst, src);
+                   });
+            break;
+        }
+        case OpcodeFamily::None:
+            switch (instruction.op) {
+            case runtime::LOCR: load_constant(result, *instruction.operands[0].constant); break;
+            case runtime::LORR:
+                if (result != slots[instruction.operands[0].reg])
+                    a.movapd(result, slots[instruction.operands[0].reg]);
+                break;
+            case runtime::JMCI:
+                if (instruction.operands[0].constant->as_bool())
+                    a.jmp(target(instruction.operands[1].target));
+                break;
+            case runtime::JMCN:
+                if (!instruction.operands[0].constant->as_bool())
+                    a.jmp(target(instruction.operands[1].target));
+                break;
+            case runtime::JMRI:
+            case runtime::JMRN:
+                a.movq_to_rax(slots[instruction.operands[0].reg]);
+                a.test_rax();
+                a.jcc(instruction.op == runtime::JMRI ? Condition::NotEqual : Condition::Equal,
+                      target(instruction.operands[1].target));
+                break;
+            case runtime::JMPU:
+            case runtime::LOOP: a.jmp(target(instruction.operands[0].target)); break;
+            case runtime::RETV:
+            case runtime::RETC:
+            case runtime::RETR: a.jmp(exit(i)); break;
+            default: break;
+            }
+            break;
+        }
     }
 
-    fn->compiled = code;
-    fn->compiled_length = size;
+    // leaving the loop stores the slots that the exit needs back to the frame, and returns the
+    // index of the exit.
+    for (size_t k = 0; k < loop->exits.size(); ++k) {
+        a.bind(exit_labels[k]);
+        for (const Binding &output : loop->exits[k].outputs)
+            a.movsd_store(8 * output.slot, output.slot);
+        a.mov_eax(static_cast<uint32_t>(k));
+        a.ret();
+    }
 
-    return {};
+    const std::vector<uint8_t> bytes = a.finish();
+    auto mapped = runtime::code_cache().allocate(bytes);
+    if (!mapped) return std::unexpected(mapped.error());
+    loop->code = *mapped;
+    loop->length = bytes.size();
+    loop->entry = reinterpret_cast<uint32_t (*)(uint64_t *)>(*mapped);
+    return loop;
 }
-} // namespace tachyon::codegen
\ No newline at end of file
+} // namespace tachyon::codegen
@@ -0,0 +1,159 @@
+#include "tachyon/codegen/register_allocator.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+namespace tachyon::codegen {
+namespace {
+using Values = std::vector<bool>;
+} // namespace
+
+std::vector<LiveInterval> live_intervals(const IRFunction &fn) {
+    const size_t count = fn.instructions.size();
+    const size_t blocks = fn.blocks.size();
+
+    // lay the blocks out one after another, and note where each one starts and ends.
+    std::vector<uint32_t> position(count);
+    std::vector<uint32_t> first(blocks);
+    std::vector<uint32_t> last(blocks);
+    uint32_t n = 0;
+    for (uint32_t b = 0; b < blocks; ++b) {
+        first[b] = 2 * n;
+        for (IRValue value : fn.blocks[b].instructions) position[value] = 2 * n++;
+        last[b] = 2 * n - 1;
+    }
+
+    // values that a block reads before it defines them, and those that it defines. in SSA form a
+    // value that a block defines is only read after its definition, except by phis, whose operands
+    // are read at the end of the predecessors instead.
+    std::vector<Values> reads(blocks, Values(count));
+    std::vector<Values> defines(blocks, Values(count));
+    for (uint32_t b = 0; b < blocks; ++b) {
+        for (IRValue value : fn.blocks[b].instructions) {
+            defines[b][value] = true;
+            if (fn[value].opcode == IROpcode::Phi) continue;
+            for (IRValue operand : fn[value].operands)
+                if (!defines[b][operand]) reads[b][operand] = true;
+        }
+    }
+
+    std::vector<Values> live_in(blocks, Values(count));
+    std::vector<Values> live_out(blocks, Values(count));
+    for (bool has_changed = true; has_changed;) {
+        has_changed = false;
+        for (uint32_t b = blocks; b-- > 0;) {
+            Values out(count);
+            for (uint32_t successor : fn.blocks[b].successors) {
+                const IRBlock &block = fn.blocks[successor];
+                for (size_t v = 0; v < count; ++v)
+                    if (live_in[successor][v]) out[v] = true;
+                for (IRValue value : block.instructions) {
+                    const IRInstruction &phi = fn[value];
+                    if (phi.opcode != IROpcode::Phi) continue;
+                    for (size_t j = 0; j < phi.operands.size(); ++j)
+                        if (block.predecessors[j] == b) out[phi.operands[j]] = true;
+                }
+            }
+            Values in = reads[b];
+            for (size_t v = 0; v < count; ++v)
+                if (out[v] && !defines[b][v]) in[v] = true;
+            if (in != live_in[b] || out != live_out[b]) has_changed = true;
+            live_in[b] = std::move(in);
+            live_out[b] = std::move(out);
+        }
+    }
+
+    // an interval spans the definition, every use and the blocks that the value is live through.
+    std::vector<LiveInterval> intervals;
+    std::vector<size_t> interval_of(count);
+    for (uint32_t b = 0; b < blocks; ++b) {
+        for (IRValue value : fn.blocks[b].instructions) {
+            const IRInstruction &instruction = fn[value];
+            if (is_terminator(instruction.opcode)) continue;
+            const uint32_t start = instruction.opcode == IROpcode::Parameter ? 0
+                                   : instruction.opcode == IROpcode::Phi     ? first[b]
+                                                                             : position[value] + 1;
+            interval_of[value] = intervals.size();
+            intervals.push_back({value, start, start});
+        }
+    }
+    const auto extend = [&](IRValue value, uint32_t at) {
+        LiveInterval &interval = intervals[interval_of[value]];
+        interval.start = std::min(interval.start, at);
+        interval.end = std::max(interval.end, at);
+    };
+    for (uint32_t b = 0; b < blocks; ++b) {
+        const IRBlock &block = fn.blocks[b];
+        for (IRValue value : block.instructions) {
+            const IRInstruction &instruction = fn[value];
+            for (size_t j = 0; j < instruction.operands.size(); ++j)
+                extend(instruction.operands[j], instruction.opcode == IROpcode::Phi
+                                                    ? last[block.predecessors[j]]
+                                                    : position[value]);
+        }
+        for (size_t v = 0; v < count; ++v) {
+            if (live_in[b][v]) extend(static_cast<IRValue>(v), first[b]);
+            if (live_out[b][v]) extend(static_cast<IRValue>(v), last[b]);
+        }
+    }
+
+    std::ranges::sort(intervals, {}, [](const LiveInterval &interval) {
+        return std::tuple(interval.start, interval.value);
+    });
+    return intervals;
+}
+
+RegisterAllocation allocate_registers(const IRFunction &fn, size_t registers) {
+    RegisterAllocation allocation;
+    allocation.intervals = live_intervals(fn);
+    allocation.locations.resize(fn.instructions.size());
+    const std::vector<LiveInterval> &intervals = allocation.intervals;
+    std::vector<Location> &locations = allocation.locations;
+
+    std::vector<bool> is_free(registers, true);
+    // end of the last interval that each stack slot was given to.
+    std::vector<uint32_t> slot_ends;
+    // intervals that hold a register, as indices into intervals.
+    std::vector<size_t> active;
+
+    const auto spill = [&](size_t i) {
+        const LiveInterval &interval = intervals[i];
+        auto slot = std::ranges::find_if(slot_ends,
+                                         [&](uint32_t end) { return end < interval.start; });
+        if (slot == slot_ends.end()) slot = slot_ends.insert(slot_ends.end(), interval.end);
+        else *slot = interval.end;
+        locations[interval.value] = {true, static_cast<uint16_t>(slot - slot_ends.begin())};
+    };
+
+    for (size_t i = 0; i < intervals.size(); ++i) {
+        const LiveInterval &interval = intervals[i];
+        std::erase_if(active, [&](size_t other) {
+            if (intervals[other].end >= interval.start) return false;
+            is_free[locations[intervals[other].value].index] = true;
+            return true;
+        });
+
+        const auto reg = std::ranges::find(is_free, true);
+        if (reg != is_free.end()) {
+            *reg = false;
+            locations[interval.value] = {false, static_cast<uint16_t>(reg - is_free.begin())};
+            active.push_back(i);
+            continue;
+        }
+
+        // every register is taken, so the interval that ends last gives up its register.
+        const auto furthest = std::ranges::max_element(
+            active, {}, [&](size_t other) { return intervals[other].end; });
+        if (furthest != active.end() && intervals[*furthest].end > interval.end) {
+            locations[interval.value] = locations[intervals[*furthest].value];
+            spill(*furthest);
+            *furthest = i;
+        } else {
+            spill(i);
+        }
+    }
+
+    allocation.slots = slot_ends.size();
+    return allocation;
+}
+} // namespace tachyon::codegen
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace tachyon::codegen {
+/**
+ * @brief x86-64 condition code, as encoded in the low nibble of jcc
+ */
+enum class Condition : uint8_t {
+    Below = 0x2,
+    AboveOrEqual = 0x3,
+    Equal = 0x4,
+    NotEqual = 0x5,
+    BelowOrEqual = 0x6,
+    Above = 0x7,
+    Parity = 0xA,
+    NotParity = 0xB,
+};
+
+/**
+ * @brief general purpose register, which memory operands are relative to
+ */
+enum class Gpr : uint8_t {
+    Rax = 0,
+    Rcx = 1,
+    Rsp = 4,
+    Rsi = 6,
+    Rdi = 7,
+};
+
+/**
+ * @brief x86-64 machine code buffer, for the scalar double SSE2 instructions of compiled code
+ *
+ * XMM registers are numbered 0 to 15. Memory operands are relative to rdi, which holds the frame
+ * that compiled loops run on, unless they name another base. Jumps go to labels, which may be
+ * bound after the jump; their displacements are filled in by finish.
+ */
+class Assembler {
+    std::vector<uint8_t> bytes;
+
+    /// position of every label, or -1 while it is not bound
+    std::vector<int64_t> labels;
+
+    /// positions of rel32 displacements, and the labels that they jump to
+    std::vector<std::pair<size_t, size_t>> fixups;
+
+    void emit(uint8_t byte) { bytes.push_back(byte); }
+
+    template <class T> void emit_value(T value) {
+        uint8_t raw[sizeof(T)];
+        std::memcpy(raw, &value, sizeof(T));
+        bytes.insert(bytes.end(), raw, raw + sizeof(T));
+    }
+
+    void rel32(size_t label) {
+        fixups.emplace_back(bytes.size(), label);
+        emit_value<int32_t>(0);
+    }
+
+    /**
+     * @brief SSE instruction on two XMM registers, or on an XMM register and rax if wide
+     */
+    void sse(uint8_t prefix, uint8_t opcode, uint8_t reg, uint8_t rm, bool wide = false) {
+        emit(prefix);
+        const uint8_t rex = (wide ? 0x48 : 0x40) | (reg >> 3) << 2 | rm >> 3;
+        if (rex != 0x40) emit(rex);
+        emit(0x0F);
+        emit(opcode);
+        emit(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    /**
+     * @brief ModRM byte of [base + offset], whose 32 bit displacement follows, and the SIB byte
+     *  that rsp needs
+     */
+    void memory(uint8_t reg, Gpr base, int32_t offset) {
+        emit(0x80 | (reg & 7) << 3 | static_cast<uint8_t>(base));
+        if (base == Gpr::Rsp) emit(0x24);
+        emit_value(offset);
+    }
+
+    /**
+     * @brief SSE instruction on an XMM register and the memory at [base + offset]
+     */
+    void sse_memory(uint8_t prefix, uint8_t opcode, uint8_t reg, Gpr base, int32_t offset) {
+        emit(prefix);
+        if (reg >= 8) emit(0x44);
+        emit(0x0F);
+        emit(opcode);
+        memory(reg, base, offset);
+    }
+
+  public:
+    using Label = size_t;
+
+    Label new_label() {
+        labels.push_back(-1);
+        return labels.size() - 1;
+    }
+
+    void bind(Label label) { labels[label] = static_cast<int64_t>(bytes.size()); }
+
+    void movapd(uint8_t dst, uint8_t src) { sse(0x66, 0x28, dst, src); }
+    void movsd_load(uint8_t dst, int32_t offset) { movsd_load(dst, Gpr::Rdi, offset); }
+    void movsd_store(int32_t offset, uint8_t src) { movsd_store(Gpr::Rdi, offset, src); }
+    void movsd_load(uint8_t dst, Gpr base, int32_t offset) {
+        sse_memory(0xF2, 0x10, dst, base, offset);
+    }
+    void movsd_store(Gpr base, int32_t offset, uint8_t src) {
+        sse_memory(0xF2, 0x11, src, base, offset);
+    }
+    void addsd(uint8_t dst, uint8_t src) { sse(0xF2, 0x58, dst, src); }
+    void mulsd(uint8_t dst, uint8_t src) { sse(0xF2, 0x59, dst, src); }
+    void subsd(uint8_t dst, uint8_t src) { sse(0xF2, 0x5C, dst, src); }
+    void divsd(uint8_t dst, uint8_t src) { sse(0xF2, 0x5E, dst, src); }
+    void andpd(uint8_t dst, uint8_t src) { sse(0x66, 0x54, dst, src); }
+    void orpd(uint8_t dst, uint8_t src) { sse(0x66, 0x56, dst, src); }
+    void xorpd(uint8_t dst, uint8_t src) { sse(0x66, 0x57, dst, src); }
+    void pcmpeqd(uint8_t dst, uint8_t src) { sse(0x66, 0x76, dst, src); }
+    void ucomisd(uint8_t lhs, uint8_t rhs) { sse(0x66, 0x2E, lhs, rhs); }
+
+    /**
+     * @brief set dst to all ones if dst <predicate> src, and to all zeros otherwise
+     */
+    void cmpsd(uint8_t dst, uint8_t src, uint8_t predicate) {
+        sse(0xF2, 0xC2, dst, src);
+        emit(predicate);
+    }
+
+    /// movq xmm, rax
+    void movq_from_rax(uint8_t dst) { sse(0x66, 0x6E, dst, 0, true); }
+
+    /// movq rax, xmm
+    void movq_to_rax(uint8_t src) { sse(0x66, 0x7E, src, 0, true); }
+
+    /// mov rax, imm64
+    void mov_rax(uint64_t value) {
+        emit(0x48);
+        emit(0xB8);
+        emit_value(value);
+    }
+
+    /// mov rcx, imm64
+    void mov_rcx(uint64_t value) {
+        emit(0x48);
+        emit(0xB9);
+        emit_value(value);
+    }
+
+    /// mov dst, [base + offset]
+    void mov_load(Gpr dst, Gpr base, int32_t offset) {
+        emit(0x48);
+        emit(0x8B);
+        memory(static_cast<uint8_t>(dst), base, offset);
+    }
+
+    /// mov [base + offset], src
+    void mov_store(Gpr base, int32_t offset, Gpr src) {
+        emit(0x48);
+        emit(0x89);
+        memory(static_cast<uint8_t>(src), base, offset);
+    }
+
+    /// cmp rax, rcx
+    void cmp_rax_rcx() {
+        emit(0x48);
+        emit(0x39);
+        emit(0xC8);
+    }
+
+    /// or rax, rcx
+    void or_rax_rcx() {
+        emit(0x48);
+        emit(0x09);
+        emit(0xC8);
+    }
+
+    /// and eax, imm8, which clears the upper half of rax
+    void and_eax(int8_t value) {
+        emit(0x83);
+        emit(0xE0);
+        emit_value(value);
+    }
+
+    /// xor eax, eax
+    void xor_eax() {
+        emit(0x31);
+        emit(0xC0);
+    }
+
+    /// sub rsp, imm32
+    void sub_rsp(uint32_t value) {
+        emit(0x48);
+        emit(0x81);
+        emit(0xEC);
+        emit_value(value);
+    }
+
+    /// add rsp, imm32
+    void add_rsp(uint32_t value) {
+        emit(0x48);
+        emit(0x81);
+        emit(0xC4);
+        emit_value(value);
+    }
+
+    /// call rax
+    void call_rax() {
+        emit(0xFF);
+        emit(0xD0);
+    }
+
+    /// mov eax, imm32
+    void mov_eax(uint32_t value) {
+        emit(0xB8);
+        emit_value(value);
+    }
+
+    /// test rax, rax
+    void test_rax() {
+        emit(0x48);
+        emit(0x85);
+        emit(0xC0);
+    }
+
+    void jmp(Label label) {
+        emit(0xE9);
+        rel32(label);
+    }
+
+    void jcc(Condition condition, Label label) {
+        emit(0x0F);
+        emit(0x80 | static_cast<uint8_t>(condition));
+        rel32(label);
+    }
+
+    void ret() { emit(0xC3); }
+
+    /**
+     * @brief fill in the displacements of all jumps, whose labels must be bound by now
+     * @return machine code
+     */
+    std::vector<uint8_t> finish() {
+        for (const auto &[position, label] : fixups) {
+            const auto displacement =
+                static_cast<int32_t>(labels[label] - static_cast<int64_t>(position + 4));
+            std::memcpy(bytes.data() + position, &displacement, sizeof(displacement));
+        }
+        return std::move(bytes);
+    }
+};
+} // namespace tachyon::codegen
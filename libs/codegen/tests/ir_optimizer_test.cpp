@@ -0,0 +1,220 @@
+#include "tachyon/codegen/ir_generator.hpp"
+#include "tachyon/codegen/ir_optimizer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace tachyon::codegen;
+using tachyon::runtime::Value;
+
+// builds a function by hand, block by block.
+struct Builder
+{
+    IRFunction fn;
+
+    explicit Builder(size_t blocks)
+    {
+        fn.blocks.resize(blocks);
+        fn.registers = 4;
+    }
+
+    IRValue parameter(uint32_t reg)
+    {
+        return fn.append(0, {IROpcode::Parameter, IRType::Any, 0, {}, reg});
+    }
+
+    IRValue constant(uint32_t block, Value value)
+    {
+        fn.constants.push_back(value);
+        return fn.append(block, {IROpcode::Constant, ir_type_of(value.kind()), block, {},
+                                 static_cast<uint32_t>(fn.constants.size() - 1)});
+    }
+
+    IRValue op(uint32_t block, IROpcode opcode, IRType type, std::vector<IRValue> operands = {})
+    {
+        return fn.append(block, {opcode, type, block, std::move(operands)});
+    }
+
+    void link(uint32_t from, uint32_t to)
+    {
+        fn.blocks[from].successors.push_back(to);
+        fn.blocks[to].predecessors.push_back(from);
+    }
+};
+
+static bool holds(const IRFunction &fn, IRValue value)
+{
+    return std::ranges::any_of(fn.blocks, [&](const IRBlock &block) {
+        return std::ranges::find(block.instructions, value) != block.instructions.end();
+    });
+}
+
+static const Value &constant_value(const IRFunction &fn, IRValue value)
+{
+    EXPECT_EQ(fn[value].opcode, IROpcode::Constant);
+    return fn.constants[fn[value].immediate];
+}
+
+// return (2 + 3) * 4
+TEST(IROptimizerTest, FoldsConstants)
+{
+    Builder b(1);
+    const IRValue sum = b.op(0, IROpcode::Add, IRType::Double,
+                             {b.constant(0, Value(2.0)), b.constant(0, Value(3.0))});
+    const IRValue product =
+        b.op(0, IROpcode::Mul, IRType::Double, {sum, b.constant(0, Value(4.0))});
+    b.op(0, IROpcode::Return, IRType::Nil, {product});
+
+    ASSERT_TRUE(fold_constants(b.fn));
+    const IRValue returned = b.fn.terminator(0).operands[0];
+    ASSERT_EQ(constant_value(b.fn, returned).as_double(), 20.0);
+    ASSERT_FALSE(fold_constants(b.fn));
+}
+
+// if 1 < 2 { x = 10 } else { x = 20 }, return x. the else block goes, and so does the phi.
+TEST(IROptimizerTest, FoldsBranchesOnConstants)
+{
+    Builder b(4);
+    const IRValue condition = b.op(0, IROpcode::Lst, IRType::Bool,
+                                   {b.constant(0, Value(1.0)), b.constant(0, Value(2.0))});
+    b.op(0, IROpcode::Branch, IRType::Nil, {condition});
+    const IRValue ten = b.constant(1, Value(10.0));
+    b.op(1, IROpcode::Jump, IRType::Nil);
+    const IRValue twenty = b.constant(2, Value(20.0));
+    b.op(2, IROpcode::Jump, IRType::Nil);
+    b.link(0, 1);
+    b.link(0, 2);
+    b.link(1, 3);
+    b.link(2, 3);
+    const IRValue phi = b.op(3, IROpcode::Phi, IRType::Double, {ten, twenty});
+    b.op(3, IROpcode::Return, IRType::Nil, {phi});
+
+    ASSERT_TRUE(fold_constants(b.fn));
+    ASSERT_EQ(b.fn.blocks.size(), 3);
+    ASSERT_EQ(b.fn.terminator(0).opcode, IROpcode::Jump);
+    ASSERT_EQ(b.fn.blocks[2].predecessors, std::vector<uint32_t>{1});
+    ASSERT_FALSE(holds(b.fn, phi));
+    ASSERT_EQ(b.fn.terminator(2).operands[0], ten);
+}
+
+TEST(IROptimizerTest, ReducesStrength)
+{
+    Builder b(1);
+    const IRValue x = b.op(0, IROpcode::Add, IRType::Double,
+                           {b.parameter(1), b.constant(0, Value(1.0))});
+    const IRValue square =
+        b.op(0, IROpcode::Pow, IRType::Double, {x, b.constant(0, Value(2.0))});
+    const IRValue quarter =
+        b.op(0, IROpcode::Div, IRType::Double, {x, b.constant(0, Value(4.0))});
+    const IRValue third = b.op(0, IROpcode::Div, IRType::Double, {x, b.constant(0, Value(3.0))});
+    const IRValue same = b.op(0, IROpcode::Mul, IRType::Double, {b.constant(0, Value(1.0)), x});
+    b.op(0, IROpcode::Print, IRType::Nil, {square});
+    b.op(0, IROpcode::Print, IRType::Nil, {quarter});
+    b.op(0, IROpcode::Print, IRType::Nil, {third});
+    b.op(0, IROpcode::Return, IRType::Nil, {same});
+
+    ASSERT_TRUE(reduce_strength(b.fn));
+    ASSERT_EQ(b.fn[square].opcode, IROpcode::Mul);
+    ASSERT_EQ(b.fn[square].operands, (std::vector<IRValue>{x, x}));
+    ASSERT_EQ(b.fn[quarter].opcode, IROpcode::Mul);
+    ASSERT_EQ(constant_value(b.fn, b.fn[quarter].operands[1]).as_double(), 0.25);
+    ASSERT_EQ(b.fn[third].opcode, IROpcode::Div);
+    ASSERT_EQ(b.fn.terminator(0).operands[0], x);
+}
+
+// a + b and b + a are the same value, also in a block that the first one dominates, but a - b and
+// b - a are not.
+TEST(IROptimizerTest, NumbersValues)
+{
+    Builder b(2);
+    const IRValue lhs = b.parameter(1);
+    const IRValue rhs = b.parameter(2);
+    const IRValue sum = b.op(0, IROpcode::Add, IRType::Double, {lhs, rhs});
+    const IRValue difference = b.op(0, IROpcode::Sub, IRType::Double, {lhs, rhs});
+    b.op(0, IROpcode::Jump, IRType::Nil);
+    b.link(0, 1);
+    const IRValue other_sum = b.op(1, IROpcode::Add, IRType::Double, {rhs, lhs});
+    const IRValue other_difference = b.op(1, IROpcode::Sub, IRType::Double, {rhs, lhs});
+    const IRValue product =
+        b.op(1, IROpcode::Mul, IRType::Double, {other_sum, other_difference});
+    b.op(1, IROpcode::Print, IRType::Nil, {difference});
+    b.op(1, IROpcode::Return, IRType::Nil, {product});
+
+    ASSERT_TRUE(number_values(b.fn));
+    ASSERT_FALSE(holds(b.fn, other_sum));
+    ASSERT_TRUE(holds(b.fn, other_difference));
+    ASSERT_EQ(b.fn[product].operands, (std::vector<IRValue>{sum, other_difference}));
+    ASSERT_FALSE(number_values(b.fn));
+}
+
+// a = r1 + 1, i = 0, while i < 10 { i = i + a * a; r2[i, i] }, return i. a * a and the constant
+// move out of the loop, but the load may fail and i changes in it.
+TEST(IROptimizerTest, HoistsLoopInvariants)
+{
+    Builder b(4);
+    const IRValue list = b.parameter(2);
+    const IRValue a = b.op(0, IROpcode::Add, IRType::Double,
+                           {b.parameter(1), b.constant(0, Value(1.0))});
+    const IRValue zero = b.constant(0, Value(0.0));
+    b.op(0, IROpcode::Jump, IRType::Nil);
+    b.link(0, 1);
+    b.link(1, 2);
+    b.link(1, 3);
+    b.link(2, 1);
+
+    const IRValue i = b.op(1, IROpcode::Phi, IRType::Double);
+    const IRValue ten = b.constant(1, Value(10.0));
+    const IRValue condition = b.op(1, IROpcode::Lst, IRType::Bool, {i, ten});
+    b.op(1, IROpcode::Branch, IRType::Nil, {condition});
+    const IRValue square = b.op(2, IROpcode::Mul, IRType::Double, {a, a});
+    const IRValue next = b.op(2, IROpcode::Add, IRType::Double, {i, square});
+    const IRValue load = b.op(2, IROpcode::Load, IRType::Double, {list, next, next});
+    b.op(2, IROpcode::Print, IRType::Nil, {load});
+    b.op(2, IROpcode::Jump, IRType::Nil);
+    b.fn[i].operands = {zero, next};
+    b.op(3, IROpcode::Return, IRType::Nil, {i});
+
+    ASSERT_TRUE(hoist_invariants(b.fn));
+    ASSERT_EQ(b.fn[square].block, 0);
+    ASSERT_EQ(b.fn[ten].block, 0);
+    ASSERT_EQ(b.fn[next].block, 2);
+    ASSERT_EQ(b.fn[load].block, 2);
+    ASSERT_EQ(b.fn[b.fn.blocks[0].instructions.back()].opcode, IROpcode::Jump);
+    ASSERT_FALSE(hoist_invariants(b.fn));
+}
+
+// arithmetic on doubles can not fail, so it goes if it is not used, but arithmetic on arguments
+// of any kind stays.
+TEST(IROptimizerTest, EliminatesDeadCode)
+{
+    Builder b(1);
+    const IRValue argument = b.parameter(1);
+    const IRValue one = b.constant(0, Value(1.0));
+    const IRValue checked = b.op(0, IROpcode::Add, IRType::Double, {argument, one});
+    const IRValue unused = b.op(0, IROpcode::Mul, IRType::Double, {checked, one});
+    const IRValue printed = b.op(0, IROpcode::Sub, IRType::Double, {checked, one});
+    b.op(0, IROpcode::Print, IRType::Nil, {printed});
+    b.op(0, IROpcode::Return, IRType::Nil);
+
+    ASSERT_TRUE(eliminate_dead_code(b.fn));
+    ASSERT_TRUE(holds(b.fn, checked));
+    ASSERT_FALSE(holds(b.fn, unused));
+    ASSERT_TRUE(holds(b.fn, printed));
+    ASSERT_FALSE(eliminate_dead_code(b.fn));
+}
+
+TEST(IROptimizerTest, RunsOnlyPassesThatAreSwitchedOn)
+{
+    Builder b(1);
+    const IRValue sum = b.op(0, IROpcode::Add, IRType::Double,
+                             {b.constant(0, Value(2.0)), b.constant(0, Value(3.0))});
+    b.op(0, IROpcode::Return, IRType::Nil, {sum});
+
+    optimize(b.fn, {.fold_constants = false});
+    ASSERT_EQ(b.fn[sum].opcode, IROpcode::Add);
+    optimize(b.fn);
+    ASSERT_EQ(constant_value(b.fn, b.fn.terminator(0).operands[0]).as_double(), 5.0);
+    ASSERT_EQ(b.fn.blocks[0].instructions.size(), 2);
+}
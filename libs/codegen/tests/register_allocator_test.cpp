@@ -0,0 +1,144 @@
+#include "tachyon/codegen/ir_generator.hpp"
+#include "tachyon/codegen/register_allocator.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace tachyon::codegen;
+
+static IRValue op(IRFunction &fn, uint32_t block, IROpcode opcode,
+                  std::vector<IRValue> operands = {})
+{
+    return fn.append(block, {opcode, IRType::Double, block, std::move(operands)});
+}
+
+static IRValue parameter(IRFunction &fn, uint32_t reg)
+{
+    return fn.append(0, {IROpcode::Parameter, IRType::Double, 0, {}, reg});
+}
+
+static const LiveInterval &interval_of(const RegisterAllocation &allocation, IRValue value)
+{
+    return *std::ranges::find(allocation.intervals, value, &LiveInterval::value);
+}
+
+// values whose intervals overlap never share a register or a stack slot.
+static void expect_disjoint(const RegisterAllocation &allocation)
+{
+    for (const LiveInterval &a : allocation.intervals)
+    {
+        for (const LiveInterval &b : allocation.intervals)
+        {
+            if (a.value == b.value || a.end < b.start || b.end < a.start) continue;
+            EXPECT_NE(allocation.locations[a.value], allocation.locations[b.value]);
+        }
+    }
+}
+
+// p1 + p2 + ... + p8, added up after every parameter is loaded, so that all of them are live at
+// once.
+static IRFunction sum_of_parameters()
+{
+    IRFunction fn;
+    fn.blocks.resize(1);
+    fn.registers = 9;
+    std::vector<IRValue> parameters;
+    for (uint32_t r = 1; r <= 8; ++r) parameters.push_back(parameter(fn, r));
+    IRValue sum = parameters[0];
+    for (size_t i = 1; i < parameters.size(); ++i)
+        sum = op(fn, 0, IROpcode::Add, {sum, parameters[i]});
+    op(fn, 0, IROpcode::Return, {sum});
+    return fn;
+}
+
+TEST(RegisterAllocatorTest, KeepsValuesInRegistersWhileTheyLast)
+{
+    const RegisterAllocation allocation = allocate_registers(sum_of_parameters(), 16);
+    ASSERT_EQ(allocation.slots, 0);
+    ASSERT_EQ(allocation.intervals.size(), 15);
+    expect_disjoint(allocation);
+
+    // each sum is the last use of its operands, so it takes one of their registers.
+    size_t highest = 0;
+    for (const LiveInterval &interval : allocation.intervals)
+    {
+        ASSERT_FALSE(allocation.locations[interval.value].is_spilled);
+        highest = std::max<size_t>(highest, allocation.locations[interval.value].index);
+    }
+    ASSERT_EQ(highest, 7);
+}
+
+TEST(RegisterAllocatorTest, SpillsValuesThatEndLast)
+{
+    const IRFunction fn = sum_of_parameters();
+    const RegisterAllocation allocation = allocate_registers(fn, 4);
+    expect_disjoint(allocation);
+    ASSERT_EQ(allocation.slots, 4);
+
+    // the first parameter is added up first, so it keeps a register, and the last one ends last.
+    const std::vector<IRValue> &body = fn.blocks[0].instructions;
+    ASSERT_FALSE(allocation.locations[body[0]].is_spilled);
+    ASSERT_TRUE(allocation.locations[body[7]].is_spilled);
+    ASSERT_LT(interval_of(allocation, body[0]).end, interval_of(allocation, body[7]).end);
+}
+
+// two values that are never live at once share a stack slot. parameters are live from the start,
+// so the second product is of constants.
+TEST(RegisterAllocatorTest, ReusesStackSlots)
+{
+    IRFunction fn;
+    fn.blocks.resize(1);
+    fn.registers = 3;
+    fn.constants = {tachyon::runtime::Value(2.0), tachyon::runtime::Value(3.0)};
+    const IRValue a = parameter(fn, 1);
+    const IRValue b = parameter(fn, 2);
+    const IRValue first = op(fn, 0, IROpcode::Mul, {a, b});
+    const IRValue c = fn.append(0, {IROpcode::Constant, IRType::Double, 0, {}, 0});
+    const IRValue d = fn.append(0, {IROpcode::Constant, IRType::Double, 0, {}, 1});
+    const IRValue second = op(fn, 0, IROpcode::Mul, {c, d});
+    op(fn, 0, IROpcode::Return, {op(fn, 0, IROpcode::Add, {first, second})});
+
+    const RegisterAllocation allocation = allocate_registers(fn, 1);
+    expect_disjoint(allocation);
+    ASSERT_EQ(allocation.slots, 2);
+}
+
+// i = 0, while i < n { i = i + step }, return i. n and step are read in every iteration, so they
+// stay live until the loop ends, and the phi of i is live from the start of the header.
+TEST(RegisterAllocatorTest, KeepsValuesLiveAcrossLoops)
+{
+    IRFunction fn;
+    fn.blocks.resize(4);
+    fn.registers = 3;
+    const auto link = [&](uint32_t from, uint32_t to) {
+        fn.blocks[from].successors.push_back(to);
+        fn.blocks[to].predecessors.push_back(from);
+    };
+    link(0, 1);
+    link(1, 2);
+    link(1, 3);
+    link(2, 1);
+    const IRValue n = parameter(fn, 1);
+    const IRValue step = parameter(fn, 2);
+    fn.constants.push_back(tachyon::runtime::Value(0.0));
+    const IRValue zero = fn.append(0, {IROpcode::Constant, IRType::Double, 0, {}, 0});
+    op(fn, 0, IROpcode::Jump);
+    const IRValue i = op(fn, 1, IROpcode::Phi);
+    const IRValue condition = op(fn, 1, IROpcode::Lst, {i, n});
+    op(fn, 1, IROpcode::Branch, {condition});
+    const IRValue next = op(fn, 2, IROpcode::Add, {i, step});
+    op(fn, 2, IROpcode::Jump);
+    fn[i].operands = {zero, next};
+    op(fn, 3, IROpcode::Return, {i});
+
+    const RegisterAllocation allocation = allocate_registers(fn, 16);
+    expect_disjoint(allocation);
+    const uint32_t back_edge = interval_of(allocation, next).end;
+    ASSERT_GE(interval_of(allocation, n).end, back_edge);
+    ASSERT_GE(interval_of(allocation, step).end, back_edge);
+    ASSERT_LT(interval_of(allocation, zero).end, interval_of(allocation, i).start);
+    ASSERT_GT(interval_of(allocation, i).end, back_edge);
+    ASSERT_EQ(allocation.slots, 0);
+}
@@ -2,6 +2,8 @@
 
 #include "tachyon/common/assert.hpp"
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 // TODO: support for data other than double?
@@ -10,27 +12,46 @@
 
 /**
  * @brief 1-indexed matrix
+ *
+ * Copies share their storage, so copying is O(1). The storage is only duplicated when a matrix
+ * that shares it is about to be modified, through the non-const element accessors or push_back.
  */
 class Matrix {
     size_t current;
     size_t height;
     size_t width;
     size_t capacity;
-    double *data;
+    std::shared_ptr<double[]> data;
+
+    /**
+     * @brief allocate uninitialized storage
+     */
+    static std::shared_ptr<double[]> allocate(size_t capacity) {
+        return std::make_shared_for_overwrite<double[]>(capacity);
+    }
+
+    /**
+     * @brief give this matrix storage of its own before it is modified, if it shares it
+     */
+    void detach() {
+        if (data.use_count() <= 1) return;
+        std::shared_ptr<double[]> copy = allocate(capacity);
+        std::uninitialized_copy_n(data.get(), size(), copy.get());
+        data = std::move(copy);
+    }
 
   public:
     Matrix() : current(0), height(0), width(0), capacity(0), data(nullptr) {}
 
     explicit Matrix(size_t capacity)
-        : height(0), width(0), capacity(capacity), data(new double[capacity]) {}
+        : current(0), height(0), width(0), capacity(capacity), data(allocate(capacity)) {}
 
     Matrix(size_t height, size_t width)
         : current(0), height(height), width(width), capacity(height * width * 2),
-          data(new double[capacity]) {}
+          data(allocate(capacity)) {}
 
     Matrix(size_t height, size_t width, size_t capacity)
-        : current(0), height(height), width(width), capacity(capacity), data(new double[capacity]) {
-    }
+        : current(0), height(height), width(width), capacity(capacity), data(allocate(capacity)) {}
 
     /**
      * @brief creates a row matrix (1 by values.size())
@@ -38,8 +59,8 @@ class Matrix {
      */
     explicit Matrix(const std::vector<double> &list)
         : current(list.size()), height(1), width(list.size()), capacity(height * width * 2),
-          data(new double[capacity]) {
-        std::uninitialized_copy(list.begin(), list.end(), data);
+          data(allocate(capacity)) {
+        std::uninitialized_copy(list.begin(), list.end(), data.get());
     }
 
     /**
@@ -48,8 +69,8 @@ class Matrix {
      */
     explicit Matrix(std::vector<double> &&list)
         : current(list.size()), height(1), width(list.size()), capacity(height * width * 2),
-          data(new double[capacity]) {
-        std::uninitialized_move(list.begin(), list.end(), data);
+          data(allocate(capacity)) {
+        std::uninitialized_move(list.begin(), list.end(), data.get());
     }
 
     /**
@@ -59,9 +80,9 @@ class Matrix {
      */
     Matrix(const std::vector<double> &list, size_t width)
         : current(list.size()), height(list.size() / width), width(width),
-          capacity(height * width * 2), data(new double[capacity]) {
+          capacity(height * width * 2), data(allocate(capacity)) {
         TY_ASSERT("matrix is square" && list.size() % width == 0);
-        std::uninitialized_copy(list.begin(), list.end(), data);
+        std::uninitialized_copy(list.begin(), list.end(), data.get());
     }
 
     /**
@@ -71,16 +92,9 @@ class Matrix {
      */
     Matrix(std::vector<double> &&list, size_t width)
         : current(list.size()), height(list.size() / width), width(width),
-          capacity(height * width * 2), data(new double[capacity]) {
+          capacity(height * width * 2), data(allocate(capacity)) {
         TY_ASSERT("matrix is square" && list.size() % width == 0);
-        std::uninitialized_move(list.begin(), list.end(), data);
-    }
-
-    Matrix(const Matrix &other)
-        : current(other.current), height(other.height), width(other.width),
-          capacity(other.capacity) {
-        data = new double[capacity];
-        std::uninitialized_copy_n(other.data, height * width, data);
+        std::uninitialized_move(list.begin(), list.end(), data.get());
     }
 
     size_t size() const { return width * height; }
@@ -93,6 +107,11 @@ class Matrix {
 
     size_t get_height() const { return height; }
 
+    /**
+     * @brief storage of the matrix, which is shared with its copies until either is modified
+     */
+    const double *get_data() const { return data.get(); }
+
     void push_back(double elem) {
         if (height <= 1) {
             // if row matrix (i.e. array), always increase current width
@@ -105,11 +124,14 @@ class Matrix {
         } else // else, increase current
             ++current;
         if (size() > capacity) {
-            capacity *= 2;
-            double *tmp = data;
-            data = new double[capacity];
-            std::uninitialized_copy_n(tmp, current - 1, data);
-            delete[] tmp;
+            // growing gives the matrix storage of its own, so it does not have to be detached. an
+            // empty matrix may have no capacity to double.
+            capacity = std::max(capacity * 2, size());
+            std::shared_ptr<double[]> grown = allocate(capacity);
+            std::uninitialized_copy_n(data.get(), current - 1, grown.get());
+            data = std::move(grown);
+        } else {
+            detach();
         }
         data[current - 1] = elem;
     }
@@ -120,40 +142,49 @@ class Matrix {
         return data[--width];
     }
 
-    Matrix &operator=(const Matrix &other) {
-        if (this == &other) return *this;
-
-        current = other.current;
-        height = other.height;
-        width = other.width;
-        capacity = other.capacity;
-
-        delete[] data;
-        data = new double[capacity];
-
-        std::uninitialized_copy_n(other.data, height * width, data);
-
-        return *this;
+    /**
+     * @brief get reference to value at position, detaching shared storage first
+     * @param index index
+     * @return value reference
+     */
+    double &operator()(size_t index) {
+        TY_ASSERT("index is over or equal to 1" && index >= 1);
+        TY_ASSERT("index is within size" && index <= size());
+        detach();
+        return data[index - 1];
     }
 
     /**
-     * @brief get reference to value at position
+     * @brief get value at position
      * @param index index
      * @return value reference
      */
-    double &operator()(size_t index) const {
+    const double &operator()(size_t index) const {
         TY_ASSERT("index is over or equal to 1" && index >= 1);
         TY_ASSERT("index is within size" && index <= size());
         return data[index - 1];
     }
 
     /**
-     * @brief get reference to value at position
+     * @brief get reference to value at position, detaching shared storage first
+     * @param row value row
+     * @param col value column
+     * @return value reference
+     */
+    double &operator()(size_t row, size_t col) {
+        TY_ASSERT("row and col are over or equal to 1" && row >= 1 && col >= 1);
+        TY_ASSERT("row and col are within height and width" && row <= height && col <= width);
+        detach();
+        return data[(row - 1) * width + (col - 1)];
+    }
+
+    /**
+     * @brief get value at position
      * @param row value row
      * @param col value column
      * @return value reference
      */
-    double &operator()(size_t row, size_t col) const {
+    const double &operator()(size_t row, size_t col) const {
         TY_ASSERT("row and col are over or equal to 1" && row >= 1 && col >= 1);
         TY_ASSERT("row and col are within height and width" && row <= height && col <= width);
         return data[(row - 1) * width + (col - 1)];
@@ -167,11 +198,12 @@ class Matrix {
         if (current != other.current || width != other.width || height != other.height)
             return false;
 
+        // copies that have not been modified share their storage.
+        if (data == other.data) return true;
+
         for (size_t i = 0; i < size(); ++i) {
             if (data[i] != other.data[i]) return false;
         }
         return true;
     }
-
-    ~Matrix() { delete[] data; }
-};
\ No newline at end of file
+};
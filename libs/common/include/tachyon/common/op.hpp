@@ -1,7 +1,5 @@
 #pragma once
 
-#include <cstdint>
-
 namespace tachyon::parser {
 /**
  * @brief basic operators
@@ -51,28 +49,4 @@ inline const char *op_to_str(Op op) {
     default: return "unknown";
     }
 }
-
-/**
- * @brief convert op to vm bytecode constant operations
- *
- * Doesn't support Op::Not, since it's the only unary operator.
- */
-inline uint16_t op_to_uint16_t(Op op) {
-    if (auto num = static_cast<uint16_t>(op); num < 3) return num + 0x32;
-    else if (num < 9) return num - 3 + 0x70;
-    else return num - 9 + 0x50;
-}
-
-// TODO: this is not a good solution.
-/**
- * @brief get nth next group of bytecode
- */
-inline uint16_t get_bytecode_nth_group(uint16_t addr, int n) {
-    if (addr < 0x50) // boolean operators
-        return addr + 2 * n;
-    if (addr < 0x70) // comparison operators
-        return addr + 5 * n;
-    else // number operators
-        return addr + 6 * n;
-}
 } // namespace tachyon::parser
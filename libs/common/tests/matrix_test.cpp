@@ -40,6 +40,34 @@ TEST(MatrixTest, Assignment)
     ASSERT_EQ(m(3, 2), 6);
 }
 
+TEST(MatrixTest, CopiesShareStorage)
+{
+    Matrix a({1, 2, 3, 4}, 2);
+    Matrix b = a;
+    const Matrix &c = b;
+    ASSERT_EQ(c(2, 1), 3);
+    ASSERT_EQ(a.get_data(), b.get_data());
+
+    // writing gives the copy storage of its own, and leaves the original as it was.
+    b(2, 1) = 10;
+    ASSERT_NE(a.get_data(), b.get_data());
+    ASSERT_EQ(a(2, 1), 3);
+    ASSERT_EQ(b(2, 1), 10);
+}
+
+TEST(MatrixTest, PushBackDetachesCopy)
+{
+    Matrix a(std::vector<double>{1, 2});
+    Matrix b = a;
+    b.push_back(3);
+
+    ASSERT_NE(a.get_data(), b.get_data());
+    ASSERT_EQ(a.size(), 2);
+    ASSERT_EQ(b.size(), 3);
+    ASSERT_EQ(b(1, 2), 2);
+    ASSERT_EQ(b(1, 3), 3);
+}
+
 #ifdef TY_DEBUG
 TEST(MatrixTest, DeathUnsquareMatrix)
 {
@@ -3,106 +3,23 @@
 
 #include <benchmark/benchmark.h>
 #include <fstream>
+#include <optional>
 #include <string>
 
 using namespace tachyon;
 
 // TODO: ./cache_benchmark.cpp
 
-// define a map from strings to bytecode values
-static const std::map<std::string, runtime::Bytecode> bytecode_map = {
-    /* machine */
-    {"RETV", runtime::RETV},
-    {"RETC", runtime::RETC},
-    {"RETR", runtime::RETR},
-    {"NOOP", runtime::NOOP},
-
-    /* register */
-    {"LOCR", runtime::LOCR},
-    {"LORR", runtime::LORR},
-
-    /* boolean logic */
-    {"BNOC", runtime::BNOC},
-    {"BNOR", runtime::BNOR},
-    {"BACC", runtime::BACC},
-    {"BOCC", runtime::BOCC},
-    {"BARC", runtime::BARC},
-    {"BORC", runtime::BORC},
-    {"BACR", runtime::BACR},
-    {"BOCR", runtime::BOCR},
-    {"BARR", runtime::BARR},
-    {"BORR", runtime::BORR},
-
-    /* positional */
-    {"JMPU", runtime::JMPU},
-    {"JMCI", runtime::JMCI},
-    {"JMCN", runtime::JMCN},
-    {"JMRI", runtime::JMRI},
-    {"JMRN", runtime::JMRN},
-
-    /* arithmetic */
-    {"MACC", runtime::MACC},
-    {"MSCC", runtime::MSCC},
-    {"MMCC", runtime::MMCC},
-    {"MDCC", runtime::MDCC},
-    {"MPCC", runtime::MPCC},
-    {"MARC", runtime::MARC},
-    {"MSRC", runtime::MSRC},
-    {"MMRC", runtime::MMRC},
-    {"MDRC", runtime::MDRC},
-    {"MPRC", runtime::MPRC},
-    {"MACR", runtime::MACR},
-    {"MSCR", runtime::MSCR},
-    {"MMCR", runtime::MMCR},
-    {"MDCR", runtime::MDCR},
-    {"MPCR", runtime::MPCR},
-    {"MARR", runtime::MARR},
-    {"MSRR", runtime::MSRR},
-    {"MMRR", runtime::MMRR},
-    {"MDRR", runtime::MDRR},
-    {"MPRR", runtime::MPRR},
-
-    /* comparison */
-    {"CECC", runtime::CECC},
-    {"CNCC", runtime::CNCC},
-    {"CLCC", runtime::CLCC},
-    {"CGCC", runtime::CGCC},
-    {"CHCC", runtime::CHCC},
-    {"CFCC", runtime::CFCC},
-    {"CERC", runtime::CERC},
-    {"CNRC", runtime::CNRC},
-    {"CLRC", runtime::CLRC},
-    {"CGRC", runtime::CGRC},
-    {"CHRC", runtime::CHRC},
-    {"CFRC", runtime::CFRC},
-    {"CECR", runtime::CECR},
-    {"CNCR", runtime::CNCR},
-    {"CLCR", runtime::CLCR},
-    {"CGCR", runtime::CGCR},
-    {"CHCR", runtime::CHCR},
-    {"CFCR", runtime::CFCR},
-    {"CERR", runtime::CERR},
-    {"CNRR", runtime::CNRR},
-    {"CLRR", runtime::CLRR},
-    {"CGRR", runtime::CGRR},
-    {"CHRR", runtime::CHRR},
-    {"CFRR", runtime::CFRR},
-
-    /* function */
-    {"CALC", runtime::CALC},
-    {"CALR", runtime::CALR},
-
-    /* intrinsic */
-    {"PRNC", runtime::PRNC},
-    {"PRNR", runtime::PRNR},
-};
-
 class VMDataFixture : public benchmark::Fixture {
   public:
     void SetUp(const ::benchmark::State &) override {
         const std::string included_files[] = {
             "00-blank",
             "01-basic",
+            "02-loop",
+            "02-loop-fused",
+            "03-call",
+            "03-call-callee",
         };
 
         for (const std::string &included_file : included_files) {
@@ -131,9 +48,10 @@ class VMDataFixture : public benchmark::Fixture {
                     uint16_t number = std::stoi(instruction);
                     instructions.push_back(number);
                 } else {
-                    // parse as Bytecode
-                    runtime::Bytecode number = bytecode_map.at(instruction);
-                    instructions.push_back(number);
+                    // parse as mnemonic
+                    std::optional<uint16_t> op = runtime::opcode_named(instruction);
+                    if (!op) throw std::runtime_error("unknown mnemonic: " + instruction);
+                    instructions.push_back(*op);
                 }
             }
 
@@ -170,4 +88,60 @@ BENCHMARK_F(VMDataFixture, RunBasic)(benchmark::State &state) {
     }
 };
 
+// counts to 1000 while summing the counter. the loop would be hot by the end of the first run and
+// continue in machine code from then on, so loop compilation is off, which leaves almost entirely
+// dispatch overhead. the same program is run under both dispatch strategies so that they can be
+// compared directly.
+static void run_loop(benchmark::State &state, const std::vector<uint16_t> &bytecode,
+                     runtime::Dispatch dispatch) {
+    runtime::Proto proto(bytecode, {runtime::Value(0.), runtime::Value(1.), runtime::Value(1000.)},
+                         0, false, false, "<main>", SourceSpan(0, 0));
+
+    // keep vm construction out of the timed loop so that only dispatch is measured.
+    runtime::VM vm;
+    vm.set_dispatch(dispatch);
+    vm.set_loop_compilation(false);
+    for (auto _ : state) {
+        vm.run(proto).value();
+        benchmark::DoNotOptimize(vm);
+    }
+}
+
+BENCHMARK_F(VMDataFixture, RunLoopSwitch)(benchmark::State &state) {
+    run_loop(state, vm_data["02-loop"], runtime::Dispatch::Switch);
+};
+
+BENCHMARK_F(VMDataFixture, RunLoopThreaded)(benchmark::State &state) {
+    if (!runtime::VM::has_threaded_dispatch()) {
+        state.SkipWithError("built without threaded dispatch");
+        return;
+    }
+    run_loop(state, vm_data["02-loop"], runtime::Dispatch::Threaded);
+};
+
+// the same loop with its condition compiled to a fused compare-and-branch.
+BENCHMARK_F(VMDataFixture, RunLoopFused)(benchmark::State &state) {
+    run_loop(state, vm_data["02-loop-fused"],
+             runtime::VM::has_threaded_dispatch() ? runtime::Dispatch::Threaded
+                                                  : runtime::Dispatch::Switch);
+};
+
+// calls a small function 1000 times, so that the cost of setting up and tearing down call frames
+// dominates.
+BENCHMARK_F(VMDataFixture, RunCalls)(benchmark::State &state) {
+    auto callee = std::make_shared<runtime::Proto>(vm_data["03-call-callee"],
+                                                   std::vector{runtime::Value(1.)}, 1, false,
+                                                   false, "callee", SourceSpan(0, 0), 3);
+    runtime::Proto proto(vm_data["03-call"],
+                         {runtime::Value(0.), runtime::Value(1.), runtime::Value(1000.),
+                          runtime::Value(callee)},
+                         0, false, false, "<main>", SourceSpan(0, 0), 4);
+
+    runtime::VM vm;
+    for (auto _ : state) {
+        vm.run(proto).value();
+        benchmark::DoNotOptimize(vm);
+    }
+};
+
 BENCHMARK_MAIN();
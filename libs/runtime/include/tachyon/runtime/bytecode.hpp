@@ -1,6 +1,12 @@
 #pragma once
 
+#include "tachyon/common/op.hpp"
+
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <optional>
+#include <string_view>
 
 namespace tachyon::runtime
 {
@@ -18,6 +24,8 @@ namespace tachyon::runtime
  * | 0x50  | arithmetic      |
  * | 0x70  | comparison      |
  * | 0x90  | lists           |
+ * | 0xA0  | branch          |
+ * | 0xC0  | quickened       |
  * | 0xE0  | function        |
  * | 0xF0  | intrinsic       |
  * +-------+-----------------+
@@ -122,13 +130,310 @@ enum Bytecode : uint16_t
     SRRC = 0x95, // set register row register col constant val of register
     SRRR = 0x96, // set register row register col register val of register
 
+    /* branch */
+    // comparisons fused with JMRN, for loop and if conditions.
+    JECC = 0xA0, // jump unless constant == constant to bytecode address
+    JNCC = 0xA1, // jump unless constant != constant to bytecode address
+    JLCC = 0xA2, // jump unless constant <  constant to bytecode address
+    JGCC = 0xA3, // jump unless constant >  constant to bytecode address
+    JHCC = 0xA4, // jump unless constant <= constant to bytecode address
+    JFCC = 0xA5, // jump unless constant >= constant to bytecode address
+    JERC = 0xA6, // jump unless register == constant to bytecode address
+    JNRC = 0xA7, // jump unless register != constant to bytecode address
+    JLRC = 0xA8, // jump unless register <  constant to bytecode address
+    JGRC = 0xA9, // jump unless register >  constant to bytecode address
+    JHRC = 0xAA, // jump unless register <= constant to bytecode address
+    JFRC = 0xAB, // jump unless register >= constant to bytecode address
+    JECR = 0xAC, // jump unless constant == register to bytecode address
+    JNCR = 0xAD, // jump unless constant != register to bytecode address
+    JLCR = 0xAE, // jump unless constant <  register to bytecode address
+    JGCR = 0xAF, // jump unless constant >  register to bytecode address
+    JHCR = 0xB0, // jump unless constant <= register to bytecode address
+    JFCR = 0xB1, // jump unless constant >= register to bytecode address
+    JERR = 0xB2, // jump unless register == register to bytecode address
+    JNRR = 0xB3, // jump unless register != register to bytecode address
+    JLRR = 0xB4, // jump unless register <  register to bytecode address
+    JGRR = 0xB5, // jump unless register >  register to bytecode address
+    JHRR = 0xB6, // jump unless register <= register to bytecode address
+    JFRR = 0xB7, // jump unless register >= register to bytecode address
+
+    /* quickened */
+    // double-only arithmetic, in the same order as the generic instructions. these never appear in
+    // bytecode: the VM rewrites decoded arithmetic instructions to them once they have seen double
+    // operands, and back if a register operand stops holding a double.
+    DACC = 0xC0, // constant +  constant -> register, both doubles
+    DSCC = 0xC1, // constant -  constant -> register, both doubles
+    DMCC = 0xC2, // constant *  constant -> register, both doubles
+    DDCC = 0xC3, // constant /  constant -> register, both doubles
+    DPCC = 0xC4, // constant ^  constant -> register, both doubles
+    DARC = 0xC5, // register +  constant -> register, both doubles
+    DSRC = 0xC6, // register -  constant -> register, both doubles
+    DMRC = 0xC7, // register *  constant -> register, both doubles
+    DDRC = 0xC8, // register /  constant -> register, both doubles
+    DPRC = 0xC9, // register ^  constant -> register, both doubles
+    DACR = 0xCA, // constant +  register -> register, both doubles
+    DSCR = 0xCB, // constant -  register -> register, both doubles
+    DMCR = 0xCC, // constant *  register -> register, both doubles
+    DDCR = 0xCD, // constant /  register -> register, both doubles
+    DPCR = 0xCE, // constant ^  register -> register, both doubles
+    DARR = 0xCF, // register +  register -> register, both doubles
+    DSRR = 0xD0, // register -  register -> register, both doubles
+    DMRR = 0xD1, // register *  register -> register, both doubles
+    DDRR = 0xD2, // register /  register -> register, both doubles
+    DPRR = 0xD3, // register ^  register -> register, both doubles
+    // calls of a register fn that remember their last callee in the decoded instruction, rewritten
+    // from CALR. they go back to CALR when the register holds another fn, and CALR stops rewriting
+    // itself once a call site has missed too often.
+    CAIR = 0xD4, // call register fn, cached interpreted callee
+    CAMR = 0xD5, // call register fn, cached compiled callee
+    // backward JMPU that enters the machine code of its loop, rewritten from JMPU once the loop is
+    // hot and compiled. it goes back to JMPU when the registers keep failing to hold the kinds that
+    // the compiled code takes.
+    LOOP = 0xD6, // jump to loop header, in compiled code
+
     /* function */
+    // arguments are moved out of the registers following the offset, leaving them empty.
     CALC = 0xE0, // call constant fn
     CALR = 0xE1, // call register fn
+    // tail calls run the callee in the frame of the caller, so they must be followed by a return of
+    // register 0 for when the VM makes a regular call instead.
+    TALC = 0xE2, // tail call constant fn
+    TALR = 0xE3, // tail call register fn
 
     /* intrinsic */
     PRNC = 0xF0, // print constant
     PRNR = 0xF1, // print register
     // TODO: type(x) -> "num", sizeof(x), exit(), time()?, str()?
 };
-} // namespace tachyon::runtime
\ No newline at end of file
+
+/**
+ * @brief kind of an instruction operand
+ */
+enum class OperandKind : uint8_t
+{
+    Register, // register offset into the call frame, also used for call offsets
+    Constant, // index into the constant pool
+    Target,   // bytecode address to jump to
+};
+
+/**
+ * @brief group of opcodes whose VM handlers are generated from their metadata
+ *
+ * The opcodes of a family apply an operation to their source operands and store or branch on the
+ * result, and only differ in their operation and in which source operands are constants. Handlers
+ * of opcodes outside of a family are written out by hand.
+ */
+enum class OpcodeFamily : uint8_t
+{
+    None,
+    Logic,      // boolean operation -> register
+    Arithmetic, // number operation -> register, quickened once it has seen doubles
+    Quickened,  // number operation on doubles -> register, falls back once it sees anything else
+    Comparison, // number comparison -> register
+    Branch,     // number comparison, jump to bytecode address unless it holds
+};
+
+/**
+ * @brief opcode metadata
+ * @sa opcode_info
+ */
+struct OpcodeInfo
+{
+    /// mnemonic, empty if the opcode is unused
+    std::array<char, 5> name = {};
+
+    /// number of operands that follow the opcode
+    uint8_t operand_count = 0;
+
+    /// operand kinds, in bytecode order
+    std::array<OperandKind, 4> operands = {};
+
+    /// family of the opcode, see OpcodeFamily
+    OpcodeFamily family = OpcodeFamily::None;
+
+    /// operation of a family opcode
+    parser::Op operation = parser::Op::And;
+
+    /// whether the instruction only reads and writes the registers of its call frame. calls and
+    /// i/o are impure
+    bool is_pure = true;
+
+    /// whether the opcode is only ever rewritten to by the VM, and may not appear in bytecode
+    bool is_quickened = false;
+
+    /// opcode that an arithmetic instruction is quickened to, or that a quickened one falls back to
+    uint16_t counterpart = 0;
+
+    constexpr bool is_known() const { return name[0] != '\0'; }
+
+    constexpr std::string_view mnemonic() const { return name.data(); }
+};
+
+/**
+ * @brief metadata of every opcode, indexed by opcode
+ *
+ * Families are generated from their operations: the opcodes of each are laid out form by form,
+ * constant and constant, register and constant, constant and register, then register and
+ * register, and each form has every operation of the family in the order of parser::Op.
+ */
+inline constexpr std::array<OpcodeInfo, 0x100> opcode_table = []
+{
+    using enum OpcodeFamily;
+    using parser::Op;
+
+    std::array<OpcodeInfo, 0x100> table{};
+
+    // the layout has one character per operand: 'R' for a register, 'C' for a constant and 'J' for
+    // a jump target.
+    const auto define = [&table](uint16_t op, std::string_view name, std::string_view layout,
+                                 bool is_pure = true) -> OpcodeInfo &
+    {
+        OpcodeInfo &info = table[op];
+        std::ranges::copy(name, info.name.begin());
+        info.operand_count = static_cast<uint8_t>(layout.size());
+        for (size_t i = 0; i < layout.size(); ++i)
+            info.operands[i] = layout[i] == 'C'   ? OperandKind::Constant
+                               : layout[i] == 'J' ? OperandKind::Target
+                                                  : OperandKind::Register;
+        info.is_pure = is_pure;
+        return info;
+    };
+    const auto define_family = [&define](uint16_t first, char prefix, std::string_view letters,
+                                         Op first_operation, OpcodeFamily family, char result)
+    {
+        uint16_t op = first;
+        for (std::string_view form : {"CC", "RC", "CR", "RR"})
+            for (size_t i = 0; i < letters.size(); ++i)
+            {
+                const char name[] = {prefix, letters[i], form[0], form[1]};
+                const char layout[] = {form[0], form[1], result};
+                OpcodeInfo &info = define(op++, {name, 4}, {layout, 3});
+                info.family = family;
+                info.operation = static_cast<Op>(static_cast<int>(first_operation) + i);
+                info.is_quickened = family == Quickened;
+            }
+    };
+
+    /* machine */
+    define(RETV, "RETV", "");
+    define(RETC, "RETC", "C");
+    define(RETR, "RETR", "R");
+    define(NOOP, "NOOP", "");
+
+    /* register */
+    define(LOCR, "LOCR", "CR");
+    define(LORR, "LORR", "RR");
+
+    /* boolean logic */
+    define(BNOC, "BNOC", "CR");
+    define(BNOR, "BNOR", "RR");
+    for (uint16_t op : {BNOC, BNOR})
+    {
+        table[op].family = Logic;
+        table[op].operation = Op::Not;
+    }
+    define_family(BACC, 'B', "AO", Op::And, Logic, 'R');
+
+    /* positional */
+    define(JMPU, "JMPU", "J");
+    define(JMCI, "JMCI", "CJ");
+    define(JMCN, "JMCN", "CJ");
+    define(JMRI, "JMRI", "RJ");
+    define(JMRN, "JMRN", "RJ");
+
+    /* arithmetic */
+    define_family(MACC, 'M', "ASMDP", Op::Add, Arithmetic, 'R');
+
+    /* comparison */
+    define_family(CECC, 'C', "ENLGHF", Op::Eq, Comparison, 'R');
+
+    /* lists */
+    define(LIUC, "LIUC", "CR");
+    define(LIUR, "LIUR", "RR");
+    define(LIOR, "LIOR", "RR");
+    define(GRRC, "GRRC", "RRCR");
+    define(GRRR, "GRRR", "RRRR");
+    define(SRRC, "SRRC", "RRCR");
+    define(SRRR, "SRRR", "RRRR");
+
+    /* branch */
+    define_family(JECC, 'J', "ENLGHF", Op::Eq, Branch, 'J');
+
+    /* quickened */
+    define_family(DACC, 'D', "ASMDP", Op::Add, Quickened, 'R');
+    for (uint16_t i = 0; i <= MPRR - MACC; ++i)
+    {
+        table[MACC + i].counterpart = DACC + i;
+        table[DACC + i].counterpart = MACC + i;
+    }
+    define(CAIR, "CAIR", "RR", false).is_quickened = true;
+    define(CAMR, "CAMR", "RR", false).is_quickened = true;
+    define(LOOP, "LOOP", "J").is_quickened = true;
+
+    /* function */
+    define(CALC, "CALC", "CR", false);
+    define(CALR, "CALR", "RR", false);
+    define(TALC, "TALC", "CR", false);
+    define(TALR, "TALR", "RR", false);
+
+    /* intrinsic */
+    define(PRNC, "PRNC", "C", false);
+    define(PRNR, "PRNR", "R", false);
+
+    return table;
+}();
+
+// the generated families have to line up with the enumerators.
+static_assert(opcode_table[BORR].mnemonic() == "BORR");
+static_assert(opcode_table[MPRR].mnemonic() == "MPRR");
+static_assert(opcode_table[CFRR].mnemonic() == "CFRR");
+static_assert(opcode_table[JFRR].mnemonic() == "JFRR");
+static_assert(opcode_table[DPRR].mnemonic() == "DPRR");
+static_assert(!opcode_table.back().is_known());
+
+/**
+ * @brief metadata of an opcode
+ * @sa opcode_table
+ */
+constexpr const OpcodeInfo &opcode_info(uint16_t op)
+{
+    // the last opcode is unused, so it stands in for everything past the table.
+    return opcode_table[op < opcode_table.size() ? op : opcode_table.size() - 1];
+}
+
+/**
+ * @brief opcode with a mnemonic
+ * @return opcode, or nullopt if no opcode has the mnemonic
+ */
+constexpr std::optional<uint16_t> opcode_named(std::string_view mnemonic)
+{
+    for (uint16_t op = 0; op < opcode_table.size(); ++op)
+        if (opcode_table[op].is_known() && opcode_table[op].mnemonic() == mnemonic) return op;
+    return std::nullopt;
+}
+
+/**
+ * @brief opcode of a family for a binary operation on operands of the given kinds
+ * @return opcode, or nullopt if the family has no such opcode
+ */
+constexpr std::optional<uint16_t> family_opcode(OpcodeFamily family, parser::Op operation,
+                                                OperandKind lhs, OperandKind rhs)
+{
+    for (uint16_t op = 0; op < opcode_table.size(); ++op)
+        if (const OpcodeInfo &info = opcode_table[op];
+            info.family == family && info.operation == operation && info.operand_count == 3 &&
+            info.operands[0] == lhs && info.operands[1] == rhs)
+            return op;
+    return std::nullopt;
+}
+
+/**
+ * @brief show bytecode mnemonic
+ * @sa Bytecode
+ */
+constexpr const char *bytecode_to_str(uint16_t op)
+{
+    const OpcodeInfo &info = opcode_info(op);
+    return info.is_known() ? info.name.data() : "unknown";
+}
+} // namespace tachyon::runtime
@@ -3,6 +3,7 @@
 #include "tachyon/runtime/value.hpp"
 
 #include <list>
+#include <span>
 #include <unordered_map>
 
 namespace tachyon::runtime {
@@ -14,8 +15,10 @@ namespace tachyon::runtime {
  * Uses a linked list to store a list of arguments and function return values, and a map from
  * argument values to positions inside the list for fast lookup. When a value is put into the
  * cache, the value itself is placed at the front of the linked list, and a map entry is inserted
- * that records the list.front() iterator. It also evicts any old items from the back of the list,
- * if the estimated size exceeds Cache::max_size_bytes. When a value is retrieved from the cache,
+ * that records the list.front() iterator. The map is keyed by views of the arguments stored in the
+ * list, so each entry keeps a single copy of its arguments, and lookups need no copy at all. It
+ * also evicts any old items from the back of the list, if the estimated size exceeds
+ * Cache::max_size_bytes. When a value is retrieved from the cache,
  * and there is a cache hit, the value is retrieved from the linked list and the list node is moved
  * to the front.
  */
@@ -36,8 +39,9 @@ class Cache {
     /// node linked list, most recently used at front
     std::list<Node> list;
 
-    /// map from argument values to positions in the linked list
-    std::unordered_map<Values, std::list<Node>::iterator, ValuesHash> map;
+    /// map from argument values (viewing Node::key) to positions in the linked list
+    std::unordered_map<std::span<const Value>, std::list<Node>::iterator, ValuesHash, ValuesEqual>
+        map;
 
     /// estimated current size of the cache
     size_t current_size_bytes = sizeof(list) + sizeof(map);
@@ -62,16 +66,16 @@ class Cache {
     /**
      * @brief try to get a cached value based on arguments list
      * @param vs argument list
-     * @return cached return value if exists
+     * @return cached return value if exists, valid until the next put
      */
-    std::optional<Value> get(const Values &vs);
+    const Value *get(std::span<const Value> vs);
 
   private:
     /**
      * @brief get size of an entry
      *
      * We approximate the size of the entry with the sum of:
-     *   * sizeof(Value) for each key
+     *   * sizeof(Value) for each key, plus the size of its view in the map
      *   * sizeof(Value) for the one value
      *   * some approximate node overhead
      *   * any heap space allocated by std::string
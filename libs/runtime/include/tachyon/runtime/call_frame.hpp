@@ -2,19 +2,41 @@
 
 #include "tachyon/runtime/value.hpp"
 
-#include <array>
+#include <cstddef>
 
 namespace tachyon::runtime
 {
+struct Instruction;
+struct Proto;
+
 /**
  * @brief function call frame
  *
- * Stores 256 registers per functon call.
+ * The registers of a call are a window into the register stack of the VM, sized to the register
+ * high-water mark of the function. The window of a callee starts right after the window of its
+ * caller.
+ *
+ * Calls do not recurse on the native stack: the VM pushes a frame and keeps dispatching in the
+ * callee, and a return pops the frame and resumes the caller at the instruction saved in it. A tail
+ * call reuses the frame of its caller instead, so it returns straight to the caller's caller.
  */
 struct CallFrame
 {
-    // TODO: maybe optimization point. store large values in their own regs?
-    std::array<Value, 256> registers;
+    /// index of the first register of this frame in the register stack
+    size_t base;
+
+    /// number of registers in this frame
+    size_t size;
+
+    /// function running in this frame, kept alive by the caller's register or constant
+    Proto *proto = nullptr;
+
+    /// instruction of the caller to resume when this frame returns
+    Instruction *return_ip = nullptr;
+
+    /// function value of a tail call, which keeps proto alive once the registers that held it
+    /// are reset
+    Value function;
 
     Value returns;
 };
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "tachyon/common/error.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace tachyon::runtime {
+struct Proto;
+
+/**
+ * @brief executable memory that compiled functions and loops are placed in
+ *
+ * Memory is mapped in large chunks, each of which is mapped twice: once readable and executable,
+ * where the code runs, and once readable and writable, where it is copied to. No page is ever
+ * writable and executable through the same mapping, and placing code needs no system call once its
+ * chunk is mapped, so code can be added while other code in the same chunk runs.
+ *
+ * Blocks are sized to their code and taken from the start of the lowest free range of a chunk that
+ * they fit in, which is the unused end of the last chunk unless blocks were freed. Freed blocks
+ * merge with the free ranges next to them, and a chunk is unmapped once all of it is free, unless
+ * it is the only one.
+ *
+ * Compiled functions are installed rather than allocated, so that the cache can evict them to
+ * stay within its budget. Every call of a compiled function counts towards its hotness, and the
+ * functions that were called least since the last eviction are evicted first, back to the
+ * interpreter, which compiles them again once they are hot again. Compiled loops count towards the
+ * budget, but are kept for as long as their function is.
+ *
+ * The cache is shared by every VM, and a function that is evicted may be running on another
+ * thread than the one that installs code. Eviction therefore only marks a function, see
+ * Proto::is_evicted, and its code is freed by the thread that calls it next, before it would run
+ * it, or when it is destroyed. The code of marked functions counts as freed when the cache decides
+ * what else to evict, so the cache may stay over its budget until they are called again.
+ */
+class CodeCache {
+    /// a chunk of executable memory and the writable mapping of the same pages
+    struct Chunk {
+        uint8_t *executable;
+        uint8_t *writable;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+
+    /// free ranges of every chunk, from their executable address to their size
+    std::map<uint8_t *, size_t> free_ranges;
+
+    /// compiled functions whose code is in the cache, which may be evicted
+    std::vector<Proto *> functions;
+
+    /// bytes that blocks take, and bytes that chunks take
+    size_t used_bytes = 0;
+    size_t reserved_bytes = 0;
+
+    /// bytes of code of the functions that are marked as evicted, but not freed yet
+    size_t evicted_bytes = 0;
+
+    /// bytes of code that the cache is allowed to hold before it evicts functions
+    size_t budget_bytes = std::numeric_limits<size_t>::max();
+
+    /// smallest size of a chunk
+    size_t chunk_size;
+
+    mutable std::mutex mutex;
+
+  public:
+    /// chunk size of the cache that compiled code is placed in
+    static constexpr size_t default_chunk_size = 1 << 20;
+
+    explicit CodeCache(size_t chunk_size = default_chunk_size) : chunk_size(chunk_size) {}
+
+    CodeCache(const CodeCache &) = delete;
+    CodeCache &operator=(const CodeCache &) = delete;
+
+    ~CodeCache();
+
+    /**
+     * @brief copy code to a block of executable memory, mapping a new chunk if no free range fits
+     *  it
+     * @param code machine code
+     * @param alignment alignment of the block, a power of two
+     * @return executable address of the block, which stays valid until it is freed
+     */
+    std::expected<void *, Error> allocate(std::span<const uint8_t> code, size_t alignment = 16);
+
+    /**
+     * @brief free a block, so that its memory can be reused
+     * @param code address that allocate returned
+     * @param length length of the code that was allocated
+     */
+    void free(void *code, size_t length);
+
+    /**
+     * @brief place the code of a compiled function in the cache, then mark the coldest other
+     *  functions as evicted until the cache is within its budget
+     * @param fn function, which must not be compiled yet
+     * @param code machine code, see CompiledFunction
+     */
+    std::expected<void, Error> install(Proto &fn, std::span<const uint8_t> code);
+
+    /**
+     * @brief free the code of a compiled function, which is interpreted from then on until it is
+     *  compiled again
+     *
+     * Only the thread that runs the function may evict it, at a point where it does not run its
+     * code, such as before it would call it.
+     */
+    void evict(Proto &fn);
+
+    /**
+     * @brief point the cache to where a compiled function was moved to
+     */
+    void relocate(const Proto &from, Proto &to);
+
+    /**
+     * @brief set the number of bytes of code that the cache may hold, which applies from the next
+     *  install on
+     *
+     * The function that is installed is never evicted for it, so a budget that is too small for
+     * any code keeps the one function that was compiled last.
+     */
+    void set_budget(size_t bytes);
+
+    size_t budget() const;
+
+    /// bytes of code in the cache
+    size_t used() const;
+
+    /// bytes of memory that the cache has mapped, which includes free ranges
+    size_t reserved() const;
+
+  private:
+    /// allocate, with the mutex held
+    std::expected<void *, Error> place(std::span<const uint8_t> code, size_t alignment);
+
+    /// evict, with the mutex held
+    void remove(Proto &fn);
+
+    /// map a chunk of at least size bytes, and add all of it as a free range
+    std::expected<void, Error> map_chunk(size_t size);
+
+    /// add a free range, merged with the free ranges right before and after it
+    void release(uint8_t *start, size_t size);
+};
+
+/**
+ * @brief cache that compiled code is placed in, shared by every VM
+ */
+CodeCache &code_cache();
+} // namespace tachyon::runtime
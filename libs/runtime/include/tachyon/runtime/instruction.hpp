@@ -0,0 +1,68 @@
+#pragma once
+
+#include "tachyon/common/error.hpp"
+#include "tachyon/runtime/value.hpp"
+
+#include <cstdint>
+#include <expected>
+#include <vector>
+
+namespace tachyon::runtime {
+// fwd-decl, see proto.hpp
+struct Proto;
+struct CompiledLoop;
+
+/**
+ * @brief decoded instruction operand
+ *
+ * Which member is active depends on the opcode and the position of the operand, in the same way
+ * that the raw bytecode word would be interpreted.
+ */
+union Operand {
+    /// register offset into the call frame (also used for call offsets)
+    uint16_t reg;
+
+    /// constant operand, resolved to its slot in Proto::constants
+    const Value *constant;
+
+    /// jump target, as an index into the decoded instruction stream
+    uint32_t target;
+
+    /// callee remembered by a call instruction, see CAIR and CAMR
+    Proto *callee;
+
+    /// number of times a backward jump was taken, see VM::set_hot_loop_hook
+    uint32_t count;
+
+    /// compiled loop that a back edge enters, see LOOP
+    CompiledLoop *loop;
+};
+
+/**
+ * @brief fixed-size pre-decoded instruction
+ *
+ * The bytecode is variable length and indexes the constant pool, so running it directly means
+ * decoding every operand again on every execution. It is decoded once per Proto into an array of
+ * these records, which the VM executes instead.
+ */
+struct Instruction {
+    /// handler address, filled in by the VM for threaded dispatch
+    const void *handler = nullptr;
+
+    /// original opcode
+    uint16_t op = 0;
+
+    /// operands, in bytecode order
+    Operand operands[4] = {};
+};
+
+/**
+ * @brief decode bytecode into instruction records
+ * @param bytecode function bytecode, which must end in a return instruction
+ * @param constants constant pool that constant operands are resolved against. it must not be
+ *  modified while the records are in use
+ * @return instruction records or error
+ */
+std::expected<std::vector<Instruction>, Error> decode(const std::vector<uint16_t> &bytecode,
+                                                      const std::vector<Value> &constants);
+} // namespace tachyon::runtime
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace tachyon::runtime {
+/**
+ * @brief executed opcode counts
+ *
+ * Counts every executed opcode, along with each pair and triple of opcodes that were executed one
+ * right after the other. The VM only records into one when it is built with
+ * TACHYON_ENABLE_PROFILING, see VM. The counts show which superinstructions, quickened
+ * instructions and compiled IR nodes are worth adding.
+ *
+ * It also counts how often every loop went around, by the function it is in and the index of the
+ * instruction that its back edge jumps to, which shows the loops worth compiling.
+ *
+ * Profiles are written as a table sorted by count, or as JSON with one entry per line. Both
+ * formats can be read back and merged, so that the profiles of several runs add up to one report.
+ */
+class Profile {
+    /// opcode counts
+    std::array<uint64_t, 0x100> singles{};
+
+    /// opcode pair counts, indexed by first << 8 | second
+    std::vector<uint64_t> pairs = std::vector<uint64_t>(0x10000);
+
+    /// opcode triple counts, keyed by first << 16 | second << 8 | third
+    std::unordered_map<uint32_t, uint64_t> triples;
+
+    /// the last two recorded opcodes, most recent in the low byte
+    uint32_t history = 0;
+
+    /// number of valid opcodes in history
+    uint8_t history_length = 0;
+
+    /// taken back edge counts, by function name and then by the instruction index they jump to
+    std::map<std::string, std::map<uint32_t, uint64_t>, std::less<>> back_edges;
+
+  public:
+    /**
+     * @brief record an executed opcode
+     * @param op opcode, below 0x100
+     */
+    void record(uint16_t op) {
+        ++singles[op];
+        if (history_length >= 1) ++pairs[(history & 0xFF) << 8 | op];
+        if (history_length >= 2) ++triples[(history & 0xFFFF) << 8 | op];
+        history = (history << 8 | op) & 0xFFFF;
+        if (history_length < 2) ++history_length;
+    }
+
+    /**
+     * @brief forget the previous opcodes, so that the next one does not start a pair or triple
+     *
+     * Used where execution moves to a different function, since opcodes on either side of a call
+     * can never be fused.
+     */
+    void break_sequence() { history_length = 0; }
+
+    /**
+     * @brief record a taken back edge, i.e. a jump to an earlier instruction
+     * @param function name of the function with the loop, empty for anonymous functions
+     * @param header index of the decoded instruction that the loop starts at
+     */
+    void record_back_edge(std::string_view function, uint32_t header);
+
+    /**
+     * @brief number of times an opcode sequence was executed
+     * @param ops one to three opcodes
+     */
+    [[nodiscard]] uint64_t count(const std::vector<uint16_t> &ops) const;
+
+    /**
+     * @brief number of times a back edge was taken
+     * @param function name of the function with the loop, empty for anonymous functions
+     * @param header index of the decoded instruction that the loop starts at
+     */
+    [[nodiscard]] uint64_t back_edge_count(std::string_view function, uint32_t header) const;
+
+    /**
+     * @brief whether nothing has been recorded
+     */
+    [[nodiscard]] bool empty() const;
+
+    /**
+     * @brief add the counts of another profile to this one
+     */
+    void merge(const Profile &other);
+
+    /**
+     * @brief add the counts of a written profile to this one
+     * @param in table or JSON, as written by write_table or write_json
+     *
+     * Lines that do not hold counts, like headers, are skipped.
+     */
+    void merge(std::istream &in);
+
+    /**
+     * @brief write opcodes, pairs, triples and back edges as tables sorted by count
+     * @param out output stream
+     * @param limit maximum rows per table, or 0 for all of them
+     */
+    void write_table(std::ostream &out, size_t limit = 0) const;
+
+    /**
+     * @brief write opcodes, pairs, triples and back edges as JSON arrays sorted by count
+     * @param out output stream
+     */
+    void write_json(std::ostream &out) const;
+};
+} // namespace tachyon::runtime
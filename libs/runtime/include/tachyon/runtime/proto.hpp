@@ -1,14 +1,100 @@
 #pragma once
 
 #include "cache.hpp"
+#include "tachyon/runtime/code_cache.hpp"
 #include "tachyon/common/source_span.hpp"
+#include "tachyon/runtime/instruction.hpp"
 #include "tachyon/runtime/value.hpp"
 
-#include <sys/mman.h>
+#include <atomic>
+#include <memory>
 #include <utility>
 #include <vector>
 
 namespace tachyon::runtime {
+/**
+ * @brief constant values of a module, shared by all of its functions
+ *
+ * The pool is not resized once the module is generated, so the addresses of its values are stable.
+ */
+using ConstantPool = std::vector<Value>;
+
+/**
+ * @brief entry of a compiled function, which reads its arguments in place and stores its result
+ *
+ * The arguments are the registers of the caller that the call passes, and do not have to be in a
+ * frame of the function, so compiled code runs at any call depth and on any VM. It returns false
+ * without storing a result if an argument does not hold the kind that it was compiled for, so
+ * that the call is interpreted instead.
+ */
+using CompiledFunction = bool (*)(const Value *arguments, Value *result);
+
+class BackgroundCompiler;
+struct Proto;
+
+/// drop the background compilation job of a function that is destroyed, see Proto::compiler
+void forget_compilation(Proto &fn);
+
+/// point the background compilation job of a function to where it was moved to
+void relocate_compilation(const Proto &from, Proto &to);
+
+/**
+ * @brief machine code for a loop of a function, see LOOP
+ *
+ * The interpreter enters it at the back edge of the loop, and it runs from the header of the loop
+ * until control leaves the loop. It keeps the interpreter registers that the loop uses in a frame
+ * of slots, which hold raw doubles, or all-ones and all-zero masks for booleans. Registers whose
+ * values are not needed at the same time share a slot. The interpreter fills the frame from the
+ * registers that the loop reads on entry, and stores back the slots that the exit it left through
+ * needs.
+ */
+struct CompiledLoop {
+    /// most slots in a frame, each of which is held in an XMM register
+    static constexpr size_t max_slots = 14;
+
+    /**
+     * @brief interpreter register, the slot that holds it, and the kind of its value, either
+     *  Value::Kind::Double or Value::Kind::Bool
+     */
+    struct Binding {
+        uint16_t reg;
+        uint8_t slot;
+        Value::Kind kind;
+    };
+
+    /**
+     * @brief instruction that the interpreter continues at, and the registers that the loop wrote
+     *  and that may be read from there on
+     */
+    struct Exit {
+        uint32_t target;
+        std::vector<Binding> outputs;
+    };
+
+    /// registers that are read before they are written, which must hold their kinds on entry
+    std::vector<Binding> inputs;
+
+    std::vector<Exit> exits;
+
+    /// runs the loop on a frame, and returns the index of the exit that it left through
+    uint32_t (*entry)(uint64_t *frame) = nullptr;
+
+    /// machine code, in code_cache
+    void *code = nullptr;
+    size_t length = 0;
+
+    /// number of times that the registers did not hold the kinds of the inputs on entry
+    uint16_t misses = 0;
+
+    CompiledLoop() = default;
+    CompiledLoop(const CompiledLoop &) = delete;
+    CompiledLoop &operator=(const CompiledLoop &) = delete;
+
+    ~CompiledLoop() {
+        if (code) code_cache().free(code, length);
+    }
+};
+
 /**
  * @brief function prototype object
  */
@@ -17,22 +103,36 @@ struct Proto {
     // TODO: uint16_t* + malloc
     std::vector<uint16_t> bytecode;
 
-    // TODO: it could be an optimisation to store all constants somewhere
-    //  else (eg in the VM) and call from there. There may be duplicate
-    //  constants, and since they're currently stored in each Proto,
-    //  duplicates within functions are not difficult but impossible to
-    //  optimise since there is no way to reference them. You can also
-    //  consider passing a value to the read constants instructions that
-    //  indicate the depth of the constant, but that probably doesn't make
-    //  sense.
     /**
-     * @brief constant value lookup table
+     * @brief constant value lookup table, shared with the other functions of the module
+     *
+     * The pool holds the functions nested in the module in turn, so only the top-level function
+     * owns it, and the pointer of a nested function is non-owning. Nested functions can therefore
+     * only run while the top-level function of their module is alive.
+     */
+    std::shared_ptr<ConstantPool> constants;
+
+    /**
+     * @brief functions nested in the module, if this is its top-level function
+     *
+     * The values in the pool that refer to them do not own them, so that a function that holds
+     * values referring to itself, such as the arguments in its memoization cache, is still freed.
      */
-    std::vector<Value> constants;
+    std::vector<std::shared_ptr<Proto>> functions;
+
+    /// decoded instructions, built from bytecode the first time the function is run
+    std::vector<Instruction> code;
+
+    /// whether the verifier proved the operand kinds of the decoded instructions, so that they run
+    /// without checking them, see verify
+    bool is_verified = false;
 
     /// number of arguments
     size_t arguments;
 
+    /// number of registers in a call frame of this function, i.e. its register high-water mark
+    size_t registers;
+
     /// whether the function is pure (memoizable)
     bool is_pure;
 
@@ -50,39 +150,72 @@ struct Proto {
     /// debug info source span
     SourceSpan span;
 
+    /// machine code of the function in code_cache, see CompiledFunction, or null if it is not
+    /// compiled
     void *compiled;
     size_t compiled_length;
     uint16_t compilation_counter;
 
+    /// compiler that the function is queued on or being compiled by in the background, which
+    /// drops its job if it is destroyed first, so that nothing waits for the compiler, or null
+    BackgroundCompiler *compiler = nullptr;
+
+    /// hotness of the compiled code, the number of times that it ran since the code cache last
+    /// evicted functions, which halves it every time, see CodeCache. the cache reads it from
+    /// whichever thread installs code, so it is atomic, but it is only ever loaded and stored, and
+    /// increments that race with the halving may be lost.
+    std::atomic<uint32_t> compiled_calls = 0;
+
+    /// set by the code cache to have the thread that calls the function next free its compiled
+    /// code, since another thread may be running it while the cache evicts it
+    std::atomic<bool> is_evicted = false;
+
+    /// compiled hot loops, which the decoded LOOP instructions point to
+    std::vector<std::unique_ptr<CompiledLoop>> loops;
+
     Proto()
-        : bytecode(), constants(), arguments(), is_pure(), can_generate_irmc(), cache(), name(),
-          span(0, 0), compiled(nullptr), compiled_length(0), compilation_counter(0) {
-        constants.reserve(1000);
-    }
+        : bytecode(), constants(std::make_shared<ConstantPool>()), code(), arguments(),
+          registers(1), is_pure(), can_generate_irmc(), cache(), name(), span(0, 0),
+          compiled(nullptr), compiled_length(0), compilation_counter(0) {}
 
     Proto(std::vector<uint16_t> bytecode, std::vector<Value> constants, size_t arguments,
-          bool is_pure, bool can_generate_irmc, std::string name, SourceSpan span)
-        : bytecode(std::move(bytecode)), constants(std::move(constants)), arguments(arguments),
-          is_pure(is_pure), can_generate_irmc(can_generate_irmc), cache(), name(std::move(name)),
-          span(span), compiled(nullptr), compiled_length(0), compilation_counter(0) {
-        constants.reserve(1000);
-    }
+          bool is_pure, bool can_generate_irmc, std::string name, SourceSpan span,
+          size_t registers = 256)
+        : bytecode(std::move(bytecode)),
+          constants(std::make_shared<ConstantPool>(std::move(constants))), code(),
+          arguments(arguments), registers(registers), is_pure(is_pure),
+          can_generate_irmc(can_generate_irmc), cache(), name(std::move(name)), span(span),
+          compiled(nullptr), compiled_length(0), compilation_counter(0) {}
 
     Proto(const Proto &) = delete;
     Proto &operator=(const Proto &) = delete;
 
     Proto(Proto &&other)
         : bytecode(std::move(other.bytecode)), constants(std::move(other.constants)),
-          arguments(std::move(other.arguments)), is_pure(other.is_pure),
-          can_generate_irmc(other.can_generate_irmc), cache(std::move(other.cache)),
-          name(std::move(other.name)), span(other.span), compiled(other.compiled),
-          compiled_length(other.compiled_length), compilation_counter(other.compilation_counter) {
+          functions(std::move(other.functions)), code(std::move(other.code)), is_verified(other.is_verified),
+          arguments(std::move(other.arguments)), registers(other.registers),
+          is_pure(other.is_pure), can_generate_irmc(other.can_generate_irmc),
+          cache(std::move(other.cache)), name(std::move(other.name)), span(other.span),
+          compiled(other.compiled), compiled_length(other.compiled_length),
+          compilation_counter(other.compilation_counter), compiler(other.compiler),
+          compiled_calls(other.compiled_calls.load(std::memory_order_relaxed)),
+          is_evicted(other.is_evicted.load(std::memory_order_relaxed)),
+          loops(std::move(other.loops)) {
+        if (compiled) code_cache().relocate(other, *this);
+        if (compiler) relocate_compilation(other, *this);
         other.compiled = nullptr;
+        other.compiler = nullptr;
     }
     Proto &operator=(Proto &&other) {
+        if (compiled) code_cache().evict(*this);
+        if (compiler) forget_compilation(*this);
         bytecode = std::move(other.bytecode);
         constants = std::move(other.constants);
+        functions = std::move(other.functions);
+        code = std::move(other.code);
+        is_verified = other.is_verified;
         arguments = std::move(other.arguments);
+        registers = other.registers;
         is_pure = other.is_pure;
         can_generate_irmc = other.can_generate_irmc;
         cache = std::move(other.cache);
@@ -91,15 +224,22 @@ struct Proto {
         compiled = other.compiled;
         compiled_length = other.compiled_length;
         compilation_counter = other.compilation_counter;
+        compiler = other.compiler;
+        compiled_calls.store(other.compiled_calls.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+        is_evicted.store(other.is_evicted.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+        loops = std::move(other.loops);
+        if (compiled) code_cache().relocate(other, *this);
+        if (compiler) relocate_compilation(other, *this);
         other.compiled = nullptr;
+        other.compiler = nullptr;
         return *this;
     }
 
     ~Proto() {
-        if (compiled) {
-            munmap(compiled, compiled_length);
-            compiled = nullptr;
-        }
+        if (compiled) code_cache().evict(*this);
+        if (compiler) forget_compilation(*this);
     }
 
     // TODO: when capturing vars from outer scope, just store a lookup table,
@@ -1,9 +1,14 @@
 #pragma once
 
+#include "tachyon/common/assert.hpp"
 #include "tachyon/common/matrix.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cstdint>
 #include <memory>
 #include <print>
+#include <span>
 #include <string>
 #include <variant>
 #include <vector>
@@ -12,20 +17,170 @@ namespace tachyon::runtime {
 // fwd-decl, see proto.h
 struct Proto;
 
-// TODO: currently 32 bytes, can we get less?
-//  if we use char* copy = malloc(strlen(original) + 1), can store char* instead
-//  and get significant decrease (should be 16 bytes). and if we can store
-//  7 byte numbers, even if they need alignment, we will probably be at 8 bytes
-//  total size. or maybe use string_view?
 // TODO: Proto is kept as a shared_ptr here. Consider other references (like having a storage pool
 //  and keeping an int? or pointer?) and benchmark alternatives.
 // TODO: can I/should I unify this value with the AST value, so that it's all
 //  the same type? and put it in tachyon::common.
 // TODO: lists of non doubles
 
-/// runtime value
-using Value =
-    std::variant<std::monostate, double, std::string, bool, Matrix, std::shared_ptr<Proto>>;
+/**
+ * @brief runtime value
+ *
+ * Values are NaN-boxed into 8 bytes. Doubles are stored as themselves, with every NaN canonicalised
+ * to a single positive quiet NaN. Every other kind lives in the negative quiet NaN space that this
+ * leaves free: the top 16 bits hold a tag, and the low 48 bits hold either a boolean or a pointer
+ * to a reference counted heap box. Strings and function prototypes are immutable, so copies share
+ * their box. Matrices are mutable, so copying a value gives it a matrix of its own, which shares
+ * its storage until either one is modified.
+ *
+ * Accessors do not check the kind outside of debug builds.
+ */
+class Value {
+  public:
+    /// value kind, in the same order as the alternatives of the AST literal value
+    enum class Kind : uint8_t {
+        Nil,
+        Double,
+        String,
+        Bool,
+        Matrix,
+        Proto,
+    };
+
+    // compiled code reads and writes doubles, booleans and nil in place, so their encoding is
+    // public.
+    static constexpr uint64_t canonical_nan = 0x7FF8'0000'0000'0000;
+
+    // every tag is above the bit pattern of any canonical double, including -inf.
+    static constexpr uint64_t nil_tag = 0xFFF9'0000'0000'0000;
+    static constexpr uint64_t bool_tag = 0xFFFA'0000'0000'0000;
+
+  private:
+    /**
+     * @brief reference counted heap storage
+     */
+    template <class T> struct Box {
+        uint32_t references;
+        T value;
+    };
+
+    static constexpr uint64_t tag_mask = 0xFFFF'0000'0000'0000;
+    static constexpr uint64_t payload_mask = ~tag_mask;
+
+    // heap tags must stay last, see is_heap.
+    static constexpr uint64_t string_tag = 0xFFFB'0000'0000'0000;
+    static constexpr uint64_t matrix_tag = 0xFFFC'0000'0000'0000;
+    static constexpr uint64_t proto_tag = 0xFFFD'0000'0000'0000;
+
+    uint64_t bits;
+
+    bool is_heap() const { return bits >= string_tag; }
+
+    template <class T> Box<T> *box() const {
+        return reinterpret_cast<Box<T> *>(static_cast<uintptr_t>(bits & payload_mask));
+    }
+
+    template <class T> static uint64_t make_box(uint64_t tag, T value) {
+        auto address = reinterpret_cast<uintptr_t>(new Box<T>{1, std::move(value)});
+        TY_ASSERT("heap pointers fit in the payload" && (address & tag_mask) == 0);
+        return tag | address;
+    }
+
+    /// share or clone the heap box of other, which is already bitwise copied into bits
+    void copy_heap();
+
+    /// drop this reference to the heap box
+    void release();
+
+  public:
+    Value() : bits(nil_tag) {}
+    Value(std::monostate) : bits(nil_tag) {}
+    Value(double d) : bits(d == d ? std::bit_cast<uint64_t>(d) : canonical_nan) {}
+    Value(bool b) : bits(bool_tag | static_cast<uint64_t>(b)) {}
+    Value(std::string s) : bits(make_box(string_tag, std::move(s))) {}
+    Value(const char *s) : Value(std::string(s)) {}
+    Value(Matrix m) : bits(make_box(matrix_tag, std::move(m))) {}
+    Value(std::shared_ptr<Proto> p) : bits(make_box(proto_tag, std::move(p))) {}
+
+    Value(const Value &other) : bits(other.bits) {
+        if (is_heap()) copy_heap();
+    }
+    Value(Value &&other) noexcept : bits(other.bits) { other.bits = nil_tag; }
+
+    Value &operator=(const Value &other) {
+        if (this == &other) return *this;
+        Value copy(other);
+        std::swap(bits, copy.bits);
+        return *this;
+    }
+    Value &operator=(Value &&other) noexcept {
+        if (this == &other) return *this;
+        if (is_heap()) release();
+        bits = other.bits;
+        other.bits = nil_tag;
+        return *this;
+    }
+
+    ~Value() {
+        if (is_heap()) release();
+    }
+
+    Kind kind() const {
+        if (is_double()) return Kind::Double;
+        switch (bits & tag_mask) {
+        case bool_tag: return Kind::Bool;
+        case string_tag: return Kind::String;
+        case matrix_tag: return Kind::Matrix;
+        case proto_tag: return Kind::Proto;
+        default: return Kind::Nil;
+        }
+    }
+
+    bool is_nil() const { return bits == nil_tag; }
+    bool is_double() const { return bits < nil_tag; }
+    bool is_bool() const { return (bits & tag_mask) == bool_tag; }
+    bool is_string() const { return (bits & tag_mask) == string_tag; }
+    bool is_matrix() const { return (bits & tag_mask) == matrix_tag; }
+    bool is_proto() const { return (bits & tag_mask) == proto_tag; }
+
+    double as_double() const {
+        TY_ASSERT(is_double());
+        return std::bit_cast<double>(bits);
+    }
+
+    bool as_bool() const {
+        TY_ASSERT(is_bool());
+        return bits & 1;
+    }
+
+    const std::string &as_string() const {
+        TY_ASSERT(is_string());
+        return box<std::string>()->value;
+    }
+
+    Matrix &as_matrix() {
+        TY_ASSERT(is_matrix());
+        return box<Matrix>()->value;
+    }
+
+    const Matrix &as_matrix() const {
+        TY_ASSERT(is_matrix());
+        return box<Matrix>()->value;
+    }
+
+    const std::shared_ptr<Proto> &as_proto() const {
+        TY_ASSERT(is_proto());
+        return box<std::shared_ptr<Proto>>()->value;
+    }
+
+    /**
+     * @brief compare values, values of different kinds are never equal
+     */
+    bool operator==(const Value &other) const;
+};
+
+static_assert(sizeof(Value) == 8);
+
 using Values = std::vector<Value>;
 
 /**
@@ -54,21 +209,21 @@ inline void hash_combine(size_t &seed, size_t h) {
  */
 struct ValueHash {
     size_t operator()(const Value &v) const noexcept {
-        return std::visit(
-            []<typename T0>(const T0 &val) -> size_t {
-                using T = std::decay_t<T0>;
-                if constexpr (std::is_same_v<T, Matrix>) {
-                    size_t h = val.size();
-                    for (size_t i = 1; i <= val.size(); ++i) {
-                        ValueHash vh;
-                        hash_combine(h, vh(val(i)));
-                    }
-                    return h;
-                } else {
-                    return std::hash<std::decay_t<T0>>{}(val);
-                }
-            },
-            v);
+        switch (v.kind()) {
+        case Value::Kind::Nil: return std::hash<std::monostate>{}(std::monostate{});
+        case Value::Kind::Double: return std::hash<double>{}(v.as_double());
+        case Value::Kind::String: return std::hash<std::string>{}(v.as_string());
+        case Value::Kind::Bool: return std::hash<bool>{}(v.as_bool());
+        case Value::Kind::Matrix: {
+            const Matrix &m = v.as_matrix();
+            size_t h = m.size();
+            for (size_t i = 1; i <= m.size(); ++i)
+                hash_combine(h, std::hash<double>{}(m(i)));
+            return h;
+        }
+        case Value::Kind::Proto: return std::hash<std::shared_ptr<Proto>>{}(v.as_proto());
+        }
+        return 0;
     }
 };
 
@@ -76,7 +231,7 @@ struct ValueHash {
  * @brief hash combine values
  */
 struct ValuesHash {
-    size_t operator()(const Values &vs) const noexcept {
+    size_t operator()(std::span<const Value> vs) const noexcept {
         size_t h = vs.size();
         ValueHash vh;
         for (auto &v : vs)
@@ -85,4 +240,13 @@ struct ValuesHash {
     }
 };
 
+/**
+ * @brief compare value lists
+ */
+struct ValuesEqual {
+    bool operator()(std::span<const Value> a, std::span<const Value> b) const noexcept {
+        return std::ranges::equal(a, b);
+    }
+};
+
 } // namespace tachyon::runtime
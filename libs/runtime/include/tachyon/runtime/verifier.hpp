@@ -0,0 +1,30 @@
+#pragma once
+
+#include "tachyon/common/error.hpp"
+#include "tachyon/runtime/instruction.hpp"
+#include "tachyon/runtime/proto.hpp"
+
+#include <expected>
+#include <vector>
+
+namespace tachyon::runtime {
+/**
+ * @brief check the decoded instructions of a function once, before they first run
+ *
+ * decode already rejects unknown opcodes, truncated instructions, constants out of range and jumps
+ * into the middle of an instruction. The verifier also rejects register operands outside of the
+ * call frame of the function, calls of constants that are not functions or whose arguments do not
+ * fit in the frame, and tail calls that are not followed by a return of register 0.
+ *
+ * It then infers the kind of every register at every instruction, to prove that the operands of
+ * logic, comparison, branch and list instructions have the kinds that these take. A function for
+ * which that succeeds runs with handlers that do not check operand kinds. Arithmetic checks its
+ * operands either way, since it quickens on them, and list indices are never known in advance.
+ *
+ * @param fn function, whose arguments and registers bound the register operands
+ * @param code decoded instructions of fn
+ * @return whether the operand kinds of every reachable instruction were proven, or error if the
+ *  instructions are malformed
+ */
+std::expected<bool, Error> verify(const Proto &fn, const std::vector<Instruction> &code);
+} // namespace tachyon::runtime
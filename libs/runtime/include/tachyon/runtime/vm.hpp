@@ -7,6 +7,8 @@
 
 #include <cstdint>
 #include <expected>
+#include <functional>
+#include <memory>
 #include <vector>
 
 namespace tachyon::runtime {
@@ -15,6 +17,30 @@ enum class Mode {
     Repl,
 };
 
+/**
+ * @brief instruction dispatch strategy for VM::run
+ *
+ * Threaded dispatch jumps directly from the end of one handler to the next through a table of
+ * label addresses (GCC/Clang labels-as-values), so each handler gets its own indirect branch. It is
+ * only available when built with TACHYON_ENABLE_THREADED_DISPATCH; otherwise, the portable switch
+ * loop is always used.
+ */
+enum class Dispatch {
+    Switch,
+    Threaded,
+};
+
+/**
+ * @brief callback for a loop that got hot, see VM::set_hot_loop_hook
+ * @param fn function that holds the loop
+ * @param header index of the decoded instruction that the loop starts at, which its back edge
+ *  jumps to
+ * @param back_edge index of the backward JMPU that closes the loop
+ */
+using HotLoopHook = std::function<void(Proto &fn, uint32_t header, uint32_t back_edge)>;
+
+class BackgroundCompiler;
+
 /**
  * @brief Tachyon virtual machine
  */
@@ -22,29 +48,163 @@ class VM {
     /// call stack for all functions
     std::vector<CallFrame> call_stack;
 
-    // TODO: consider something like a current_registers function so I don't have to repeat
-    //  call_stack.back().registers[x] each time. However, will have to handle assignment. Maybe a
-    //  dedicated set_register function?
+    /// register stack, each call frame owns a window of it
+    std::vector<Value> register_stack;
+
+    /// arguments of the pure functions that are being interpreted, innermost last, kept to cache
+    /// their results under once they return
+    std::vector<Values> keys;
+
+    /// number of registers reserved up front, so that the stack rarely has to move
+    static constexpr size_t register_stack_reserve = 256 * 1000;
+
+    /**
+     * @brief registers of the current call frame
+     *
+     * This is invalidated by pushing a call frame, since the register stack may grow.
+     */
+    Value *window() { return register_stack.data() + call_stack.back().base; }
+
+    /**
+     * @brief push a call frame with a register window of size registers after the current one
+     */
+    void push_frame(size_t size);
+
+    /**
+     * @brief pop the current call frame, resetting its registers
+     */
+    void pop_frame();
+
+    /**
+     * @brief start a call, moving arguments (starting from offset) to a new call frame
+     * @param fn function
+     * @param offset argument offset
+     * @param return_ip instruction of the caller to resume once the function returns
+     * @return whether the function has to be interpreted in the new frame. if not, its result is
+     *  already in register 0, from the memoization cache or from compiled code
+     */
+    bool enter(Proto &fn, uint16_t offset, Instruction *return_ip);
+
+    /**
+     * @brief push a call frame for fn, moving arguments (starting from offset) into it, without
+     *  checking the memoization cache or for compiled code
+     * @param fn function
+     * @param offset argument offset
+     * @param return_ip instruction of the caller to resume once the function returns
+     */
+    void push_call(Proto &fn, uint16_t offset, Instruction *return_ip);
+
+    /**
+     * @brief run the compiled code of fn on the arguments (starting from offset) in place, and
+     *  load the result to register 0
+     * @param fn function, which must be compiled
+     * @param offset argument offset
+     * @return whether the compiled code ran, which it does not if the arguments do not hold the
+     *  kinds that it was compiled for
+     */
+    bool call_compiled(Proto &fn, uint16_t offset);
 
     /**
-     * @brief loads arguments (starting from offset) to new call frame and calls function pointer
-     * @param fn function pointer
+     * @brief start a tail call, moving arguments (starting from offset) to the start of the
+     *  current call frame and resetting the rest of it for the callee
+     * @param function function value
      * @param offset argument offset
+     * @return whether the function has to be interpreted in the reused frame. if not, its result
+     *  is already in register 0, from the memoization cache
+     */
+    bool reenter(const Value &function, uint16_t offset);
+
+    /**
+     * @brief finish the call of the current frame, then pop it and load the result to register 0
+     *  of the caller
+     * @param returns return value
+     * @return instruction of the caller to resume
+     */
+    Instruction *leave(Value returns);
+
+    /**
+     * @brief interpreter loop, instantiated once per dispatch strategy
+     * @param proto function prototype
      * @return void or error
      */
-    std::expected<void, Error> call(std::shared_ptr<Proto> fn, uint16_t offset);
+    template <Dispatch D> std::expected<void, Error> execute(Proto &proto);
 
     Mode mode = Mode::Run;
 
+    Dispatch dispatch = has_threaded_dispatch() ? Dispatch::Threaded : Dispatch::Switch;
+
+    HotLoopHook hot_loop_hook;
+
+    bool compiles_in_background = true;
+
+    bool compiles_loops = true;
+
+    /// compiler thread of this VM, started once the first function gets hot
+    std::unique_ptr<BackgroundCompiler> compiler;
+
   public:
-    VM() {
-        CallFrame initial_frame{};
-        call_stack.reserve(1000);
-        call_stack.push_back(std::move(initial_frame));
-    }
+    /// number of times that a loop goes around before it is hot, see set_hot_loop_hook
+    static constexpr uint32_t hot_loop_threshold = 1000;
+
+    /// number of times that a function is interpreted before it is hot and compiled
+    static constexpr uint16_t compilation_threshold = 10;
+
+    VM();
+    VM(VM &&) noexcept;
+    VM &operator=(VM &&) noexcept;
+    ~VM();
 
     void set_mode(Mode mode) { this->mode = mode; }
 
+    /**
+     * @brief select the dispatch strategy, falls back to Dispatch::Switch if threaded dispatch is
+     * not available
+     */
+    void set_dispatch(Dispatch dispatch) {
+        this->dispatch = has_threaded_dispatch() ? dispatch : Dispatch::Switch;
+    }
+
+    /**
+     * @brief set the function that is called once for every loop that gets hot
+     *
+     * Every backward JMPU counts how often it is taken, and once the count reaches
+     * hot_loop_threshold, calls the hook and then compiles the loop. Whole functions are only
+     * compiled once they have been called often enough, see leave, which a loop in a function that
+     * is called once never reaches, so the running loop continues in machine code from its back
+     * edge on instead, see LOOP. The hook must not run code on this VM.
+     */
+    void set_hot_loop_hook(HotLoopHook hook) { hot_loop_hook = std::move(hook); }
+
+    /**
+     * @brief select whether hot loops continue in machine code, which they do by default
+     *
+     * The hook is called for hot loops either way, see set_hot_loop_hook. Loops that were already
+     * compiled keep running in machine code. Turning it off keeps loops in the interpreter, such
+     * as to measure dispatch.
+     */
+    void set_loop_compilation(bool enabled) { compiles_loops = enabled; }
+
+    /**
+     * @brief select whether hot functions are compiled on a thread of their own, which they are by
+     *  default, or on the thread that runs them
+     *
+     * The interpreter keeps running a function that is compiled in the background, and switches
+     * to its machine code the next time that a function returns after the compilation finished.
+     * run does not wait for the compiler when it returns, so a function may be compiled for a
+     * later run, and a function that is destroyed first drops its job, see Proto::compiler.
+     * Destroying the VM waits for the one function that the compiler thread may be working on.
+     *
+     * Hot loops are always compiled on the thread that runs them, see set_hot_loop_hook, since the
+     * loop that got hot is usually the one that keeps running, and continues in its machine code
+     * right away.
+     */
+    void set_background_compilation(bool enabled) { compiles_in_background = enabled; }
+
+    /**
+     * @brief whether this build supports Dispatch::Threaded
+     */
+    static bool has_threaded_dispatch();
+
     /**
      * @brief run function
      * @param proto function prototype
@@ -0,0 +1,150 @@
+#include "background_compiler.hpp"
+
+#include "tachyon/common/log.hpp"
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace tachyon::runtime {
+namespace {
+/**
+ * @brief a value that shares no heap box with v, so that it can be copied and destroyed on another
+ *  thread
+ *
+ * A function is replaced by one of its own that takes as many arguments, which is all that the
+ * compiler reads of it, since the function may be destroyed before the compiler is done.
+ */
+Value unshared(const Value &v) {
+    switch (v.kind()) {
+    case Value::Kind::String: return Value(v.as_string());
+    case Value::Kind::Matrix: return Value(v.as_matrix());
+    case Value::Kind::Proto: {
+        const Proto &fn = *v.as_proto();
+        return Value(std::make_shared<Proto>(std::vector<uint16_t>{}, Values{}, fn.arguments,
+                                             fn.is_pure, false, fn.name, fn.span, fn.registers));
+    }
+    default: return v;
+    }
+}
+
+/**
+ * @brief a copy of fn that compile can run on, whose constants share nothing with those of fn
+ *
+ * Only the constants that the function uses are copied, rather than the pool of its module, and
+ * its bytecode is renumbered to index them. The function was decoded before it got hot, so its
+ * bytecode is well formed.
+ */
+Proto snapshot(const Proto &fn) {
+    std::vector<uint16_t> bytecode = fn.bytecode;
+    Values constants;
+    std::unordered_map<uint16_t, uint16_t> index_of;
+    for (size_t ptr = 0; ptr < bytecode.size();) {
+        const OpcodeInfo &info = opcode_info(bytecode[ptr]);
+        for (size_t i = 0; i < info.operand_count; ++i) {
+            if (info.operands[i] != OperandKind::Constant) continue;
+            uint16_t &word = bytecode[ptr + 1 + i];
+            const auto [index, is_new] =
+                index_of.try_emplace(word, static_cast<uint16_t>(constants.size()));
+            if (is_new) constants.push_back(unshared((*fn.constants)[word]));
+            word = index->second;
+        }
+        ptr += 1 + info.operand_count;
+    }
+    return Proto(std::move(bytecode), std::move(constants), fn.arguments, fn.is_pure, true,
+                 fn.name, fn.span, fn.registers);
+}
+} // namespace
+
+void install(Proto &fn, std::expected<std::vector<uint8_t>, Error> code) {
+    if (!code || !code_cache().install(fn, *code)) {
+        TY_TRACE("failed to generate machine code");
+        fn.can_generate_irmc = false;
+    }
+}
+
+BackgroundCompiler::~BackgroundCompiler() {
+    {
+        std::scoped_lock lock(mutex);
+        is_stopping = true;
+    }
+    wake.notify_one();
+    if (worker.joinable()) worker.join();
+
+    // the counters of the dropped functions stayed at the threshold while they were queued, see
+    // VM::leave, so they count up to it again.
+    const auto drop = [](Job &job) {
+        job.fn->compiler = nullptr;
+        job.fn->compilation_counter = 0;
+    };
+    std::ranges::for_each(queued, drop);
+    std::ranges::for_each(finished, drop);
+}
+
+void BackgroundCompiler::submit(Proto &fn) {
+    Job job{&fn, snapshot(fn), {}};
+    fn.compiler = this;
+    {
+        std::scoped_lock lock(mutex);
+        queued.push_back(std::move(job));
+        if (!worker.joinable()) worker = std::thread(&BackgroundCompiler::work, this);
+    }
+    wake.notify_one();
+}
+
+void BackgroundCompiler::work() {
+    std::unique_lock lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return is_stopping || !queued.empty(); });
+        if (is_stopping) return;
+        Job job = std::move(queued.front());
+        queued.pop_front();
+        running = job.fn;
+        is_running_forgotten = false;
+
+        lock.unlock();
+        job.code = compile_function(job.snapshot);
+        lock.lock();
+
+        const bool is_forgotten = is_running_forgotten;
+        running = nullptr;
+        if (is_forgotten) continue;
+        finished.push_back(std::move(job));
+        has_finished.store(true, std::memory_order_release);
+    }
+}
+
+void BackgroundCompiler::install_finished() {
+    if (!has_finished.load(std::memory_order_acquire)) return;
+    std::vector<Job> jobs;
+    {
+        std::scoped_lock lock(mutex);
+        jobs.swap(finished);
+        has_finished.store(false, std::memory_order_relaxed);
+    }
+    for (Job &job : jobs) {
+        job.fn->compiler = nullptr;
+        install(*job.fn, std::move(job.code));
+    }
+}
+
+void BackgroundCompiler::forget(const Proto &fn) {
+    std::scoped_lock lock(mutex);
+    std::erase_if(queued, [&](const Job &job) { return job.fn == &fn; });
+    std::erase_if(finished, [&](const Job &job) { return job.fn == &fn; });
+    if (running == &fn) is_running_forgotten = true;
+}
+
+void BackgroundCompiler::relocate(const Proto &from, Proto &to) {
+    std::scoped_lock lock(mutex);
+    for (Job &job : queued)
+        if (job.fn == &from) job.fn = &to;
+    for (Job &job : finished)
+        if (job.fn == &from) job.fn = &to;
+    if (running == &from) running = &to;
+}
+
+void forget_compilation(Proto &fn) { fn.compiler->forget(fn); }
+
+void relocate_compilation(const Proto &from, Proto &to) { from.compiler->relocate(from, to); }
+} // namespace tachyon::runtime
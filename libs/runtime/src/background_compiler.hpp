@@ -0,0 +1,112 @@
+#pragma once
+
+#include "tachyon/common/error.hpp"
+#include "tachyon/runtime/proto.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <expected>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tachyon::runtime {
+/**
+ * @brief compile a function to machine code on the current thread
+ * @return machine code, see CompiledFunction, or error if the function can not be compiled
+ */
+std::expected<std::vector<uint8_t>, Error> compile(const Proto &fn);
+
+/**
+ * @brief install compiled code in code_cache, or stop compiling the function if it failed
+ */
+void install(Proto &fn, std::expected<std::vector<uint8_t>, Error> code);
+
+/**
+ * @brief compiles functions on a thread of its own, so that the interpreter does not wait for them
+ *
+ * The interpreter submits a function once it is hot and keeps interpreting it until its code is
+ * installed. Values count their references without atomics, so the compiler thread works on a
+ * snapshot of the function whose heap constants are copies of the ones that it uses. The
+ * interpreter thread installs the code, see install_finished, since it reads the compiled code of
+ * its functions without a lock.
+ *
+ * Nothing waits for a job: it outlives the run that submitted it, and a function that is
+ * destroyed first drops its job, see forget, whose code is thrown away if it is being compiled.
+ */
+class BackgroundCompiler {
+  public:
+    /// compiles a snapshot, see runtime::compile
+    using Compile = std::function<std::expected<std::vector<uint8_t>, Error>(const Proto &)>;
+
+  private:
+    struct Job {
+        Proto *fn;
+        Proto snapshot;
+        std::expected<std::vector<uint8_t>, Error> code;
+    };
+
+    Compile compile_function;
+
+    std::mutex mutex;
+
+    /// wakes the compiler thread once a job is queued or it has to stop
+    std::condition_variable wake;
+
+    std::deque<Job> queued;
+    std::vector<Job> finished;
+
+    /// function whose job the compiler thread is working on, if any, and whether it was forgotten
+    /// since, so that its code is thrown away
+    Proto *running = nullptr;
+    bool is_running_forgotten = false;
+
+    bool is_stopping = false;
+
+    /// whether finished holds jobs, so that checking for them needs no lock
+    std::atomic<bool> has_finished = false;
+
+    /// started by the first submit
+    std::thread worker;
+
+    /// compile jobs from the queue until the compiler stops
+    void work();
+
+  public:
+    explicit BackgroundCompiler(Compile compile = runtime::compile)
+        : compile_function(std::move(compile)) {}
+    BackgroundCompiler(const BackgroundCompiler &) = delete;
+    BackgroundCompiler &operator=(const BackgroundCompiler &) = delete;
+
+    /**
+     * @brief stop the compiler thread once it finishes its current job, dropping the others, which
+     *  are submitted again once they get hot again
+     */
+    ~BackgroundCompiler();
+
+    /**
+     * @brief queue a function to be compiled
+     * @param fn function, which drops its job if it is destroyed first, see Proto::compiler
+     */
+    void submit(Proto &fn);
+
+    /**
+     * @brief install the code of the functions that finished compiling, which only loads a flag if
+     *  none did
+     */
+    void install_finished();
+
+    /**
+     * @brief drop the job of a function, without waiting for it if it is being compiled
+     */
+    void forget(const Proto &fn);
+
+    /**
+     * @brief point the job of a function to where the function was moved to
+     */
+    void relocate(const Proto &from, Proto &to);
+};
+} // namespace tachyon::runtime
@@ -16,24 +16,33 @@ void Cache::put(Values vs, Value v) {
         list.pop_back();
     }
 
+    // an existing entry for these arguments is replaced. the map entry views the list node, so
+    // it has to go first.
+    if (auto it = map.find(vs); it != map.end()) {
+        const auto node = it->second;
+        current_size_bytes -= get_entry_size(node->key, node->value);
+        map.erase(it);
+        list.erase(node);
+    }
+
     current_size_bytes += entry_size_bytes;
 
-    // 3. insert into map and list.
-    // TODO: look into move semantics here. we are copying since we need both the datas.
-    list.emplace_front(vs, v);
-    map.insert_or_assign(vs, list.begin());
+    // 3. insert into list, then into the map with a view of the arguments that now live in the
+    // list node.
+    list.emplace_front(std::move(vs), std::move(v));
+    map.emplace(list.front().key, list.begin());
 }
 
-std::optional<Value> Cache::get(const Values &vs) {
+const Value *Cache::get(std::span<const Value> vs) {
     if (auto it = map.find(vs); it != map.end()) {
         // handle cache hit. move to the front of the list to record recent usage, then return
         // the cached value.
         list.splice(list.begin(), list, it->second);
-        return list.front().value;
+        return &list.front().value;
     }
 
     // cache miss.
-    return std::nullopt;
+    return nullptr;
 };
 
 size_t Cache::get_entry_size(const Values &vs, const Value &v) {
@@ -42,19 +51,19 @@ size_t Cache::get_entry_size(const Values &vs, const Value &v) {
     size_t entry_size_bytes = 40;
 
     // add the size of each key
+    entry_size_bytes += sizeof(std::span<const Value>);
     for (const Value &value : vs) {
-        // since we are currently copying the keys, we should account for double the size
-        entry_size_bytes += 2 * sizeof(Value);
+        entry_size_bytes += sizeof(Value);
 
-        if (std::holds_alternative<std::string>(value)) {
-            entry_size_bytes += std::get<std::string>(value).capacity();
+        if (value.is_string()) {
+            entry_size_bytes += value.as_string().capacity();
         }
     }
 
     // add the size of the value
     entry_size_bytes += sizeof(Value);
-    if (std::holds_alternative<std::string>(v)) {
-        entry_size_bytes += std::get<std::string>(v).capacity();
+    if (v.is_string()) {
+        entry_size_bytes += v.as_string().capacity();
     }
 
     return entry_size_bytes;
@@ -0,0 +1,208 @@
+#include "tachyon/runtime/code_cache.hpp"
+#include "tachyon/runtime/proto.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace tachyon::runtime {
+namespace {
+size_t round_up(size_t size, size_t to) { return (size + to - 1) / to * to; }
+
+Error mapping_error() {
+    return Error::create(ErrorKind::MachineGenerationError, SourceSpan(0, 0),
+                         "could not map executable memory");
+}
+} // namespace
+
+CodeCache::~CodeCache() {
+    for (Proto *fn : functions) fn->compiled = nullptr;
+    for (const Chunk &chunk : chunks) {
+        munmap(chunk.executable, chunk.size);
+        munmap(chunk.writable, chunk.size);
+    }
+}
+
+std::expected<void *, Error> CodeCache::allocate(std::span<const uint8_t> code, size_t alignment) {
+    std::scoped_lock lock(mutex);
+    return place(code, alignment);
+}
+
+std::expected<void *, Error> CodeCache::place(std::span<const uint8_t> code, size_t alignment) {
+    const size_t length = code.size();
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        for (auto range = free_ranges.begin(); range != free_ranges.end(); ++range) {
+            uint8_t *const begin = range->first;
+            uint8_t *const end = begin + range->second;
+            auto *start = reinterpret_cast<uint8_t *>(
+                round_up(reinterpret_cast<uintptr_t>(begin), alignment));
+            if (start + length > end) continue;
+
+            // the block splits its range in two, the padding before it and the rest after it.
+            free_ranges.erase(range);
+            if (start != begin) free_ranges.emplace(begin, start - begin);
+            if (start + length != end) free_ranges.emplace(start + length, end - start - length);
+
+            for (const Chunk &chunk : chunks) {
+                if (start < chunk.executable || start >= chunk.executable + chunk.size) continue;
+                std::memcpy(chunk.writable + (start - chunk.executable), code.data(), length);
+                break;
+            }
+            used_bytes += length;
+            return start;
+        }
+        if (auto mapped = map_chunk(length + alignment); !mapped)
+            return std::unexpected(mapped.error());
+    }
+    return std::unexpected(mapping_error());
+}
+
+void CodeCache::free(void *code, size_t length) {
+    std::scoped_lock lock(mutex);
+    used_bytes -= length;
+    release(static_cast<uint8_t *>(code), length);
+}
+
+std::expected<void, Error> CodeCache::install(Proto &fn, std::span<const uint8_t> code) {
+    std::scoped_lock lock(mutex);
+    auto placed = place(code, 16);
+    if (!placed) return std::unexpected(placed.error());
+    fn.compiled = *placed;
+    fn.compiled_length = code.size();
+    fn.compiled_calls.store(0, std::memory_order_relaxed);
+    fn.is_evicted.store(false, std::memory_order_relaxed);
+    functions.push_back(&fn);
+    if (used_bytes - evicted_bytes <= budget_bytes) return {};
+
+    // evict the coldest functions first, other than the one that was just installed. their
+    // threads keep calling them meanwhile, so their hotness is read once before sorting.
+    std::vector<std::pair<uint32_t, Proto *>> hotness;
+    for (Proto *f : functions) {
+        if (f == &fn || f->is_evicted.load(std::memory_order_relaxed)) continue;
+        hotness.emplace_back(f->compiled_calls.load(std::memory_order_relaxed), f);
+    }
+    std::ranges::stable_sort(hotness, {}, &std::pair<uint32_t, Proto *>::first);
+    for (const auto &[calls, f] : hotness) {
+        if (used_bytes - evicted_bytes <= budget_bytes) break;
+        f->is_evicted.store(true, std::memory_order_relaxed);
+        evicted_bytes += f->compiled_length;
+    }
+
+    // the hotness of the others is halved, so that calls count for less the longer ago they were.
+    for (Proto *f : functions)
+        f->compiled_calls.store(f->compiled_calls.load(std::memory_order_relaxed) / 2,
+                                std::memory_order_relaxed);
+    return {};
+}
+
+void CodeCache::evict(Proto &fn) {
+    std::scoped_lock lock(mutex);
+    remove(fn);
+}
+
+void CodeCache::remove(Proto &fn) {
+    std::erase(functions, &fn);
+    used_bytes -= fn.compiled_length;
+    if (fn.is_evicted.load(std::memory_order_relaxed)) evicted_bytes -= fn.compiled_length;
+    release(static_cast<uint8_t *>(fn.compiled), fn.compiled_length);
+    fn.compiled = nullptr;
+    fn.compiled_length = 0;
+    fn.compilation_counter = 0;
+    fn.compiled_calls.store(0, std::memory_order_relaxed);
+    fn.is_evicted.store(false, std::memory_order_relaxed);
+}
+
+void CodeCache::relocate(const Proto &from, Proto &to) {
+    std::scoped_lock lock(mutex);
+    std::ranges::replace(functions, &from, &to);
+}
+
+void CodeCache::set_budget(size_t bytes) {
+    std::scoped_lock lock(mutex);
+    budget_bytes = bytes;
+}
+
+size_t CodeCache::budget() const {
+    std::scoped_lock lock(mutex);
+    return budget_bytes;
+}
+
+size_t CodeCache::used() const {
+    std::scoped_lock lock(mutex);
+    return used_bytes;
+}
+
+size_t CodeCache::reserved() const {
+    std::scoped_lock lock(mutex);
+    return reserved_bytes;
+}
+
+std::expected<void, Error> CodeCache::map_chunk(size_t size) {
+    size = round_up(std::max(size, chunk_size), static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+
+    // the two mappings share the pages of an anonymous file, which can be closed once they exist.
+    const int file = memfd_create("tachyon-code", MFD_CLOEXEC);
+    if (file < 0) return std::unexpected(mapping_error());
+    void *executable = MAP_FAILED;
+    void *writable = MAP_FAILED;
+    if (ftruncate(file, static_cast<off_t>(size)) == 0) {
+        executable = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_SHARED, file, 0);
+        writable = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    }
+    close(file);
+    if (executable == MAP_FAILED || writable == MAP_FAILED) {
+        if (executable != MAP_FAILED) munmap(executable, size);
+        if (writable != MAP_FAILED) munmap(writable, size);
+        return std::unexpected(mapping_error());
+    }
+
+    chunks.push_back(
+        {static_cast<uint8_t *>(executable), static_cast<uint8_t *>(writable), size});
+    reserved_bytes += size;
+    free_ranges.emplace(static_cast<uint8_t *>(executable), size);
+    return {};
+}
+
+void CodeCache::release(uint8_t *start, size_t size) {
+    auto chunk = std::ranges::find_if(chunks, [&](const Chunk &c) {
+        return start >= c.executable && start < c.executable + c.size;
+    });
+    const auto in_chunk = [&](uint8_t *address) {
+        return address >= chunk->executable && address < chunk->executable + chunk->size;
+    };
+
+    // chunks may be mapped next to each other, so only ranges of the same chunk are merged.
+    auto range = free_ranges.emplace(start, size).first;
+    if (auto next = std::next(range);
+        next != free_ranges.end() && next->first == start + size && in_chunk(next->first)) {
+        range->second += next->second;
+        free_ranges.erase(next);
+    }
+    if (range != free_ranges.begin()) {
+        if (auto previous = std::prev(range);
+            previous->first + previous->second == start && in_chunk(previous->first)) {
+            previous->second += range->second;
+            free_ranges.erase(range);
+            range = previous;
+        }
+    }
+
+    if (range->first == chunk->executable && range->second == chunk->size && chunks.size() > 1) {
+        free_ranges.erase(range);
+        munmap(chunk->executable, chunk->size);
+        munmap(chunk->writable, chunk->size);
+        reserved_bytes -= chunk->size;
+        chunks.erase(chunk);
+    }
+}
+
+CodeCache &code_cache() {
+    // compiled code may be freed by protos that are destroyed after statics are, so the cache is
+    // never destroyed.
+    static auto *cache = new CodeCache();
+    return *cache;
+}
+} // namespace tachyon::runtime
@@ -0,0 +1,20 @@
+#include "background_compiler.hpp"
+
+#include "tachyon/codegen/ir_generator.hpp"
+#include "tachyon/codegen/ir_optimizer.hpp"
+#include "tachyon/codegen/machine_generator.hpp"
+#include "tachyon/common/log.hpp"
+
+namespace tachyon::runtime {
+// kept apart from the background compiler, which every proto links against through
+// Proto::compiler, so that linking the code generator does not pull in itself again.
+std::expected<std::vector<uint8_t>, Error> compile(const Proto &fn) {
+    auto ir = codegen::generate_ir(fn);
+    if (!ir) {
+        TY_TRACE("failed to generate intermediate representation");
+        return std::unexpected(ir.error());
+    }
+    codegen::optimize(*ir);
+    return codegen::generate_machine(*ir, fn.arguments);
+}
+} // namespace tachyon::runtime
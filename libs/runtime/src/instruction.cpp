@@ -0,0 +1,69 @@
+#include "tachyon/runtime/instruction.hpp"
+
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <format>
+
+namespace tachyon::runtime {
+namespace {
+Error decode_error(std::string message, size_t address) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0), std::move(message))
+        .withHint(std::format("At bytecode address {}.", address));
+}
+} // namespace
+
+std::expected<std::vector<Instruction>, Error> decode(const std::vector<uint16_t> &bytecode,
+                                                      const std::vector<Value> &constants) {
+    // bytecode jumps are word addresses, the decoded stream jumps by instruction index. map every
+    // address that starts an instruction to its index, so that jump targets can be resolved once
+    // the whole stream is known.
+    constexpr uint32_t not_an_instruction = UINT32_MAX;
+    std::vector<uint32_t> index_of(bytecode.size(), not_an_instruction);
+
+    std::vector<Instruction> instructions;
+    for (size_t ptr = 0; ptr < bytecode.size();) {
+        const uint16_t op = bytecode[ptr];
+        const OpcodeInfo &info = opcode_info(op);
+        if (!info.is_known() || info.is_quickened)
+            return std::unexpected(decode_error(std::format("unknown bytecode 0x{:0x}", op), ptr));
+        if (ptr + info.operand_count >= bytecode.size())
+            return std::unexpected(decode_error("truncated instruction", ptr));
+
+        index_of[ptr] = instructions.size();
+        Instruction &instruction = instructions.emplace_back();
+        instruction.op = op;
+        for (size_t i = 0; i < info.operand_count; ++i) {
+            const uint16_t word = bytecode[ptr + 1 + i];
+            switch (info.operands[i]) {
+            case OperandKind::Constant:
+                if (word >= constants.size())
+                    return std::unexpected(decode_error("constant out of range", ptr));
+                instruction.operands[i].constant = &constants[word];
+                break;
+            case OperandKind::Target: instruction.operands[i].target = word; break;
+            case OperandKind::Register: instruction.operands[i].reg = word; break;
+            }
+        }
+        ptr += 1 + info.operand_count;
+    }
+
+    if (instructions.empty() || (instructions.back().op != RETV &&
+                                 instructions.back().op != RETC && instructions.back().op != RETR))
+        return std::unexpected(decode_error("bytecode does not end in a return", bytecode.size()));
+
+    // resolve jump targets from addresses to instruction indices.
+    for (Instruction &instruction : instructions) {
+        const OpcodeInfo &info = opcode_info(instruction.op);
+        for (size_t i = 0; i < info.operand_count; ++i) {
+            if (info.operands[i] != OperandKind::Target) continue;
+            const uint32_t address = instruction.operands[i].target;
+            if (address >= bytecode.size() || index_of[address] == not_an_instruction)
+                return std::unexpected(
+                    decode_error("jump into the middle of an instruction", address));
+            instruction.operands[i].target = index_of[address];
+        }
+    }
+
+    return instructions;
+}
+} // namespace tachyon::runtime
@@ -0,0 +1,269 @@
+#include "tachyon/runtime/profile.hpp"
+
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <format>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+namespace tachyon::runtime {
+namespace {
+/**
+ * @brief counted opcode sequence
+ */
+struct Entry {
+    uint64_t count;
+    std::vector<uint16_t> ops;
+};
+
+/**
+ * @brief sort entries by count, most executed first
+ */
+void sort_entries(std::vector<Entry> &entries) {
+    std::ranges::sort(entries, [](const Entry &a, const Entry &b) {
+        if (a.count != b.count) return a.count > b.count;
+        return a.ops < b.ops;
+    });
+}
+
+/// sequences of one, two and three opcodes
+using Sections = std::array<std::vector<Entry>, 3>;
+
+uint64_t total(const std::vector<Entry> &entries) {
+    return std::accumulate(entries.begin(), entries.end(), uint64_t{0},
+                           [](uint64_t sum, const Entry &entry) { return sum + entry.count; });
+}
+
+/**
+ * @brief list every counted sequence, sorted, in sections of one to three opcodes
+ */
+Sections collect(const std::array<uint64_t, 0x100> &singles, const std::vector<uint64_t> &pairs,
+                 const std::unordered_map<uint32_t, uint64_t> &triples) {
+    Sections sections;
+    for (uint16_t op = 0; op < singles.size(); ++op)
+        if (singles[op] != 0) sections[0].push_back({singles[op], {op}});
+    for (uint32_t key = 0; key < pairs.size(); ++key)
+        if (pairs[key] != 0)
+            sections[1].push_back(
+                {pairs[key], {static_cast<uint16_t>(key >> 8), static_cast<uint16_t>(key & 0xFF)}});
+    for (const auto &[key, count] : triples)
+        sections[2].push_back({count,
+                               {static_cast<uint16_t>(key >> 16),
+                                static_cast<uint16_t>(key >> 8 & 0xFF),
+                                static_cast<uint16_t>(key & 0xFF)}});
+    for (auto &section : sections)
+        sort_entries(section);
+    return sections;
+}
+
+/// name that the back edges of anonymous functions are recorded under
+constexpr std::string_view anonymous = "<anonymous>";
+
+/**
+ * @brief counted back edge
+ */
+struct BackEdge {
+    uint64_t count;
+    std::string_view function;
+    uint32_t header;
+};
+
+/**
+ * @brief list every counted back edge, most taken first
+ */
+std::vector<BackEdge>
+collect(const std::map<std::string, std::map<uint32_t, uint64_t>, std::less<>> &back_edges) {
+    std::vector<BackEdge> entries;
+    for (const auto &[function, headers] : back_edges)
+        for (const auto &[header, count] : headers)
+            entries.push_back({count, function, header});
+    std::ranges::stable_sort(
+        entries, [](const BackEdge &a, const BackEdge &b) { return a.count > b.count; });
+    return entries;
+}
+
+/**
+ * @brief parse the numbers in a comma or space separated list
+ */
+std::vector<uint16_t> parse_codes(const std::string &list) {
+    std::vector<uint16_t> codes;
+    std::string token;
+    std::istringstream in(list);
+    while (in >> token) {
+        if (token.back() == ',') token.pop_back();
+        codes.push_back(static_cast<uint16_t>(std::stoul(token, nullptr, 0)));
+    }
+    return codes;
+}
+} // namespace
+
+void Profile::record_back_edge(std::string_view function, uint32_t header) {
+    if (function.empty()) function = anonymous;
+    auto it = back_edges.find(function);
+    if (it == back_edges.end())
+        it = back_edges.emplace(std::string(function), std::map<uint32_t, uint64_t>{}).first;
+    ++it->second[header];
+}
+
+uint64_t Profile::count(const std::vector<uint16_t> &ops) const {
+    switch (ops.size()) {
+    case 1: return singles[ops[0]];
+    case 2: return pairs[ops[0] << 8 | ops[1]];
+    case 3: {
+        auto it = triples.find(ops[0] << 16 | ops[1] << 8 | ops[2]);
+        return it == triples.end() ? 0 : it->second;
+    }
+    default: return 0;
+    }
+}
+
+uint64_t Profile::back_edge_count(std::string_view function, uint32_t header) const {
+    if (function.empty()) function = anonymous;
+    auto it = back_edges.find(function);
+    if (it == back_edges.end()) return 0;
+    auto count = it->second.find(header);
+    return count == it->second.end() ? 0 : count->second;
+}
+
+bool Profile::empty() const {
+    return std::ranges::all_of(singles, [](uint64_t count) { return count == 0; });
+}
+
+void Profile::merge(const Profile &other) {
+    for (size_t i = 0; i < singles.size(); ++i)
+        singles[i] += other.singles[i];
+    for (size_t i = 0; i < pairs.size(); ++i)
+        pairs[i] += other.pairs[i];
+    for (const auto &[key, count] : other.triples)
+        triples[key] += count;
+    for (const auto &[function, headers] : other.back_edges)
+        for (const auto &[header, count] : headers)
+            back_edges[function][header] += count;
+}
+
+void Profile::merge(std::istream &in) {
+    for (std::string line; std::getline(in, line);) {
+        uint64_t count;
+        std::vector<uint16_t> ops;
+
+        if (auto function = line.find("\"function\": \""); function != std::string::npos) {
+            // json: {"count": 1, "function": "main", "header": 3}
+            auto start = line.find("\"count\": ");
+            auto header = line.find("\"header\": ");
+            if (start == std::string::npos || header == std::string::npos) continue;
+            function += 13;
+            back_edges[line.substr(function, line.find('"', function) - function)]
+                      [std::stoul(line.substr(header + 10))] += std::stoull(line.substr(start + 9));
+            continue;
+        }
+        if (auto at = line.rfind(" @"), first = line.find_first_not_of(' ');
+            at != std::string::npos && first != std::string::npos &&
+            std::isdigit(static_cast<unsigned char>(line[first]))) {
+            // table: <count> <share> <function> @<header>
+            std::istringstream row(line);
+            std::string share, function;
+            row >> count >> share >> function;
+            back_edges[function][std::stoul(line.substr(at + 2))] += count;
+            continue;
+        }
+
+        if (auto codes = line.find("\"codes\": ["); codes != std::string::npos) {
+            // json: {"count": 1, "codes": [16, 168], ...}
+            auto start = line.find("\"count\": ");
+            if (start == std::string::npos) continue;
+            count = std::stoull(line.substr(start + 9));
+            codes += 10;
+            ops = parse_codes(line.substr(codes, line.find(']', codes) - codes));
+        } else if (auto open = line.find('['), first = line.find_first_not_of(' ');
+                   open != std::string::npos && first != std::string::npos &&
+                   std::isdigit(static_cast<unsigned char>(line[first]))) {
+            // table: <count> <share> <mnemonics> [0x10 0xa8]
+            count = std::stoull(line.substr(first));
+            ops = parse_codes(line.substr(open + 1, line.find(']', open) - open - 1));
+        } else {
+            continue;
+        }
+
+        if (std::ranges::any_of(ops, [](uint16_t op) { return op >= 0x100; })) continue;
+        switch (ops.size()) {
+        case 1: singles[ops[0]] += count; break;
+        case 2: pairs[ops[0] << 8 | ops[1]] += count; break;
+        case 3: triples[ops[0] << 16 | ops[1] << 8 | ops[2]] += count; break;
+        default: break;
+        }
+    }
+}
+
+void Profile::write_table(std::ostream &out, size_t limit) const {
+    static constexpr const char *titles[] = {"opcodes", "pairs", "triples"};
+    const auto sections = collect(singles, pairs, triples);
+
+    for (size_t i = 0; i < sections.size(); ++i) {
+        const uint64_t sum = total(sections[i]);
+        out << std::format("{} (total {})\n", titles[i], sum);
+        out << std::format("{:>14}  {:>7}  {:<16} {}\n", "count", "share", "sequence", "codes");
+
+        const size_t rows = limit == 0 ? sections[i].size() : std::min(limit, sections[i].size());
+        for (size_t row = 0; row < rows; ++row) {
+            const Entry &entry = sections[i][row];
+            std::string names, codes;
+            for (uint16_t op : entry.ops) {
+                names += std::format("{}{}", names.empty() ? "" : " ", bytecode_to_str(op));
+                codes += std::format("{}{:#04x}", codes.empty() ? "" : " ", op);
+            }
+            out << std::format("{:>14}  {:>6.2f}%  {:<16} [{}]\n", entry.count,
+                               100.0 * static_cast<double>(entry.count) / static_cast<double>(sum),
+                               names, codes);
+        }
+        out << "\n";
+    }
+
+    const auto edges = collect(back_edges);
+    const uint64_t sum =
+        std::accumulate(edges.begin(), edges.end(), uint64_t{0},
+                        [](uint64_t sum, const BackEdge &edge) { return sum + edge.count; });
+    out << std::format("back edges (total {})\n", sum);
+    out << std::format("{:>14}  {:>7}  {:<16} {}\n", "count", "share", "function", "header");
+    const size_t rows = limit == 0 ? edges.size() : std::min(limit, edges.size());
+    for (size_t row = 0; row < rows; ++row)
+        out << std::format("{:>14}  {:>6.2f}%  {:<16} @{}\n", edges[row].count,
+                           100.0 * static_cast<double>(edges[row].count) /
+                               static_cast<double>(sum),
+                           edges[row].function, edges[row].header);
+    out << "\n";
+}
+
+void Profile::write_json(std::ostream &out) const {
+    static constexpr const char *keys[] = {"opcodes", "pairs", "triples"};
+    const auto sections = collect(singles, pairs, triples);
+
+    out << "{\n";
+    for (size_t i = 0; i < sections.size(); ++i) {
+        out << std::format("  \"{}\": [\n", keys[i]);
+        for (size_t row = 0; row < sections[i].size(); ++row) {
+            const Entry &entry = sections[i][row];
+            std::string names, codes;
+            for (uint16_t op : entry.ops) {
+                names += std::format("{}\"{}\"", names.empty() ? "" : ", ", bytecode_to_str(op));
+                codes += std::format("{}{}", codes.empty() ? "" : ", ", op);
+            }
+            out << std::format("    {{\"count\": {}, \"codes\": [{}], \"sequence\": [{}]}}{}\n",
+                               entry.count, codes, names,
+                               row + 1 == sections[i].size() ? "" : ",");
+        }
+        out << "  ],\n";
+    }
+
+    const auto edges = collect(back_edges);
+    out << "  \"back_edges\": [\n";
+    for (size_t row = 0; row < edges.size(); ++row)
+        out << std::format("    {{\"count\": {}, \"function\": \"{}\", \"header\": {}}}{}\n",
+                           edges[row].count, edges[row].function, edges[row].header,
+                           row + 1 == edges.size() ? "" : ",");
+    out << "  ]\n";
+    out << "}\n";
+}
+} // namespace tachyon::runtime
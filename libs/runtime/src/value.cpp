@@ -2,30 +2,67 @@
 #include "tachyon/runtime/proto.hpp"
 
 namespace tachyon::runtime {
+void Value::copy_heap() {
+    switch (bits & tag_mask) {
+    case string_tag: ++box<std::string>()->references; break;
+    case proto_tag: ++box<std::shared_ptr<Proto>>()->references; break;
+    case matrix_tag: bits = make_box(matrix_tag, box<Matrix>()->value); break;
+    default: TY_ASSERT(false && "not a heap value");
+    }
+}
+
+void Value::release() {
+    switch (bits & tag_mask) {
+    case string_tag:
+        if (--box<std::string>()->references == 0) delete box<std::string>();
+        break;
+    case proto_tag:
+        if (--box<std::shared_ptr<Proto>>()->references == 0) delete box<std::shared_ptr<Proto>>();
+        break;
+    case matrix_tag:
+        if (--box<Matrix>()->references == 0) delete box<Matrix>();
+        break;
+    default: TY_ASSERT(false && "not a heap value");
+    }
+    bits = nil_tag;
+}
+
+bool Value::operator==(const Value &other) const {
+    // doubles compare by value, so that NaN != NaN and 0 == -0.
+    if (is_double() || other.is_double())
+        return is_double() && other.is_double() && as_double() == other.as_double();
+    if (bits == other.bits) return true;
+    if (kind() != other.kind()) return false;
+
+    switch (kind()) {
+    case Kind::String: return as_string() == other.as_string();
+    case Kind::Matrix: return as_matrix() == other.as_matrix();
+    case Kind::Proto: return as_proto() == other.as_proto();
+    default: return false;
+    }
+}
+
 /**
  * @brief small visitor for printing values
  */
 void print_value(const Value &reg) {
-    std::visit(
-        []<typename T0>(const T0 &val) {
-            using T = std::decay_t<T0>;
-            if constexpr (std::is_same_v<T, std::monostate>) {
-                std::print("()");
-            } else if constexpr (std::is_same_v<T, std::shared_ptr<Proto>>) {
-                std::print("function prototype '{}'",
-                           static_cast<std::shared_ptr<Proto>>(val)->name);
-            } else if constexpr (std::is_same_v<T, Matrix>) {
-                std::print("[");
-                for (size_t i = 1; i <= val.get_current(); ++i) {
-                    if (i > 1) std::print(", ");
-                    std::print("{}", val(i));
-                    if (i == val.get_width()) std::print(";");
-                }
-                std::print("]");
-            } else {
-                std::print("{}", val);
-            }
-        },
-        reg);
+    switch (reg.kind()) {
+    case Value::Kind::Nil: std::print("()"); break;
+    case Value::Kind::Double: std::print("{}", reg.as_double()); break;
+    case Value::Kind::String: std::print("{}", reg.as_string()); break;
+    case Value::Kind::Bool: std::print("{}", reg.as_bool()); break;
+    case Value::Kind::Matrix: {
+        const Matrix &val = reg.as_matrix();
+        std::print("[");
+        for (size_t i = 1; i <= val.get_current(); ++i) {
+            if (i > 1) std::print(", ");
+            std::print("{}", val(i));
+            if (i == val.get_width()) std::print(";");
+        }
+        std::print("]");
+        break;
+    }
+    case Value::Kind::Proto: std::print("function prototype '{}'", reg.as_proto()->name); break;
+    }
 }
-} // namespace tachyon::runtime
\ No newline at end of file
+} // namespace tachyon::runtime
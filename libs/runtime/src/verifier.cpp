@@ -0,0 +1,215 @@
+#include "tachyon/runtime/verifier.hpp"
+
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <algorithm>
+#include <format>
+#include <optional>
+
+namespace tachyon::runtime {
+namespace {
+/// kind of the value in every register, or nullopt where a register may hold different kinds
+using Kinds = std::vector<std::optional<Value::Kind>>;
+
+Error verify_error(std::string message, size_t index) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0), std::move(message))
+        .withHint(std::format("At instruction {}.", index));
+}
+
+bool is_call(uint16_t op) { return op == CALC || op == CALR || op == TALC || op == TALR; }
+
+bool is_return(uint16_t op) { return op == RETV || op == RETC || op == RETR; }
+
+/**
+ * @brief jump target of an instruction, if it has one
+ */
+std::optional<uint32_t> jump_target(const Instruction &instruction) {
+    const OpcodeInfo &info = opcode_info(instruction.op);
+    for (size_t i = 0; i < info.operand_count; ++i)
+        if (info.operands[i] == OperandKind::Target) return instruction.operands[i].target;
+    return std::nullopt;
+}
+
+/**
+ * @brief kind of operand i of an instruction, if it is known
+ */
+std::optional<Value::Kind> operand_kind(const Instruction &instruction, size_t i,
+                                        const Kinds &kinds) {
+    switch (opcode_info(instruction.op).operands[i]) {
+    case OperandKind::Constant: return instruction.operands[i].constant->kind();
+    case OperandKind::Register: return kinds[instruction.operands[i].reg];
+    case OperandKind::Target: break;
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief whether the operands of an instruction are known to have the kinds that it takes, so
+ *  that it can run without checking them
+ */
+bool is_proven(const Instruction &instruction, const Kinds &kinds) {
+    using enum Value::Kind;
+    const OpcodeInfo &info = opcode_info(instruction.op);
+    const auto is = [&](size_t i, Value::Kind kind) {
+        return operand_kind(instruction, i, kinds) == kind;
+    };
+    switch (info.family) {
+    case OpcodeFamily::Logic:
+        return is(0, Bool) && (info.operation == parser::Op::Not || is(1, Bool));
+    case OpcodeFamily::Comparison:
+    case OpcodeFamily::Branch: return is(0, Double) && is(1, Double);
+    case OpcodeFamily::Arithmetic:
+    case OpcodeFamily::Quickened:
+    case OpcodeFamily::None: break;
+    }
+    switch (instruction.op) {
+    case JMCI:
+    case JMCN:
+    case JMRI:
+    case JMRN: return is(0, Bool);
+    case LIUC:
+    case LIUR: return is(0, Double) && is(1, Matrix);
+    case LIOR: return is(0, Matrix);
+    case GRRC:
+    case GRRR:
+    case SRRC:
+    case SRRR: return false;
+    default: return true;
+    }
+}
+
+/**
+ * @brief update the kinds of the registers with the effect of an instruction
+ */
+void step(const Instruction &instruction, Kinds &kinds) {
+    using enum Value::Kind;
+    const OpcodeInfo &info = opcode_info(instruction.op);
+    const Operand *operands = instruction.operands;
+    switch (info.family) {
+    case OpcodeFamily::Logic:
+    case OpcodeFamily::Comparison: kinds[operands[info.operand_count - 1].reg] = Bool; return;
+    case OpcodeFamily::Arithmetic:
+    case OpcodeFamily::Quickened: kinds[operands[info.operand_count - 1].reg] = Double; return;
+    case OpcodeFamily::Branch:
+    case OpcodeFamily::None: break;
+    }
+    switch (instruction.op) {
+    case LOCR: kinds[operands[1].reg] = operands[0].constant->kind(); break;
+    case LORR: kinds[operands[1].reg] = kinds[operands[0].reg]; break;
+    case LIOR: kinds[operands[1].reg] = Double; break;
+    case GRRC:
+    case GRRR: kinds[operands[3].reg] = Double; break;
+    case CALC:
+    case CALR:
+    case TALC:
+    case TALR:
+        // the result goes to register 0, and the arguments are moved out of the registers from
+        // the offset on.
+        kinds[0] = std::nullopt;
+        std::fill(kinds.begin() + operands[1].reg, kinds.end(), std::nullopt);
+        break;
+    default: break;
+    }
+}
+
+/**
+ * @brief merge the kinds that flow into an instruction into the kinds it already has
+ * @return whether the kinds changed
+ */
+bool merge(Kinds &into, const Kinds &from) {
+    bool changed = false;
+    for (size_t i = 0; i < into.size(); ++i) {
+        if (into[i] && into[i] != from[i]) {
+            into[i] = std::nullopt;
+            changed = true;
+        }
+    }
+    return changed;
+}
+} // namespace
+
+std::expected<bool, Error> verify(const Proto &fn, const std::vector<Instruction> &code) {
+    if (fn.arguments >= fn.registers)
+        return std::unexpected(verify_error("arguments do not fit in the call frame", 0));
+
+    // basic blocks start at the entry, at jump targets and after instructions that do not fall
+    // through.
+    std::vector<bool> starts_block(code.size());
+    starts_block[0] = true;
+    for (size_t i = 0; i < code.size(); ++i) {
+        const Instruction &instruction = code[i];
+        const OpcodeInfo &info = opcode_info(instruction.op);
+        for (size_t n = 0; n < info.operand_count; ++n) {
+            // the offset of a call is where its arguments start, which is checked below.
+            if (info.operands[n] != OperandKind::Register || (is_call(instruction.op) && n == 1))
+                continue;
+            if (instruction.operands[n].reg >= fn.registers)
+                return std::unexpected(verify_error("register out of range", i));
+        }
+
+        if (is_call(instruction.op)) {
+            // the callee of a register call is only known at run time, so the vm checks its
+            // arguments then.
+            size_t arguments = 0;
+            if (info.operands[0] == OperandKind::Constant) {
+                const Value &callee = *instruction.operands[0].constant;
+                if (!callee.is_proto())
+                    return std::unexpected(
+                        verify_error("call of a constant that is not a function", i));
+                arguments = callee.as_proto()->arguments;
+            }
+            if (instruction.operands[1].reg + arguments > fn.registers)
+                return std::unexpected(
+                    verify_error("arguments of a call do not fit in the call frame", i));
+        }
+        if ((instruction.op == TALC || instruction.op == TALR) &&
+            (i + 1 == code.size() || code[i + 1].op != RETR || code[i + 1].operands[0].reg != 0))
+            return std::unexpected(
+                verify_error("tail call is not followed by a return of its result", i));
+
+        if (std::optional<uint32_t> target = jump_target(instruction)) starts_block[*target] = true;
+        if ((instruction.op == JMPU || is_return(instruction.op)) && i + 1 < code.size())
+            starts_block[i + 1] = true;
+    }
+
+    // find the kinds at the start of every reachable block, merging them where control flow
+    // joins. the frame that run starts in may hold values from before, so nothing is known on
+    // entry.
+    std::vector<std::optional<Kinds>> entry_kinds(code.size());
+    entry_kinds[0] = Kinds(fn.registers);
+    std::vector<size_t> worklist{0};
+    const auto flow = [&](size_t block, const Kinds &kinds) {
+        if (!entry_kinds[block]) entry_kinds[block] = kinds;
+        else if (!merge(*entry_kinds[block], kinds)) return;
+        worklist.push_back(block);
+    };
+    // runs the block that starts at an instruction, passing on its kinds to its successors.
+    // returns whether every instruction in it was proven.
+    const auto run_block = [&](size_t i) {
+        Kinds kinds = *entry_kinds[i];
+        bool proven = true;
+        for (;; ++i) {
+            const Instruction &instruction = code[i];
+            proven = proven && is_proven(instruction, kinds);
+            step(instruction, kinds);
+            if (std::optional<uint32_t> target = jump_target(instruction)) flow(*target, kinds);
+            if (instruction.op == JMPU || is_return(instruction.op)) break;
+            if (starts_block[i + 1]) {
+                flow(i + 1, kinds);
+                break;
+            }
+        }
+        return proven;
+    };
+    while (!worklist.empty()) {
+        const size_t block = worklist.back();
+        worklist.pop_back();
+        run_block(block);
+    }
+
+    // the kinds are final, so check every reachable block against them.
+    for (size_t i = 0; i < code.size(); ++i)
+        if (entry_kinds[i] && !run_block(i)) return false;
+    return true;
+}
+} // namespace tachyon::runtime
@@ -1,767 +1,1079 @@
 #include "tachyon/runtime/vm.hpp"
 
+#include "background_compiler.hpp"
 #include "tachyon/codegen/machine_generator.hpp"
 #include "tachyon/common/assert.hpp"
 #include "tachyon/common/log.hpp"
 #include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/instruction.hpp"
+#include "tachyon/runtime/profile.hpp"
+#include "tachyon/runtime/verifier.hpp"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
 #include <expected>
+#include <format>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <optional>
+#include <span>
 
 // TODO: consider moving from uint16_t to size_t
 
 namespace tachyon::runtime {
+namespace {
+/**
+ * @brief error for an arithmetic instruction with an operand that is not a number
+ */
+Error arithmetic_error(uint16_t op) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0),
+                         "arithmetic on a value that is not a number")
+        .withHint(std::format("In a {} instruction.", bytecode_to_str(op)));
+}
+
+/**
+ * @brief error for an instruction of a function that the verifier could not prove, with an
+ *  operand of a kind that the instruction does not take
+ */
+Error operand_error(uint16_t op) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0), "operand of the wrong kind")
+        .withHint(std::format("In a {} instruction.", bytecode_to_str(op)));
+}
+
+/**
+ * @brief error for a list instruction with an index outside of the list, or into a value that is
+ *  not a list
+ */
+Error index_error(uint16_t op) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0), "list index out of range")
+        .withHint(std::format("In a {} instruction.", bytecode_to_str(op)));
+}
+
+/**
+ * @brief error for a register call whose callee takes more arguments than the caller's frame holds
+ *  from the offset of the call on
+ */
+Error argument_error(uint16_t op) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0),
+                         "arguments of a call do not fit in the call frame")
+        .withHint(std::format("In a {} instruction.", bytecode_to_str(op)));
+}
+
+/**
+ * @brief error for a call instruction with a callee that is not a function
+ */
+Error call_error(uint16_t op) {
+    return Error::create(ErrorKind::InternalError, SourceSpan(0, 0),
+                         "call of a value that is not a function")
+        .withHint(std::format("In a {} instruction.", bytecode_to_str(op)));
+}
+
+/**
+ * @brief source operand I of an instruction of a family, from a register or from the constant
+ *  pool as its opcode says
+ */
+template <uint16_t Op, size_t I>
+const Value &source(const Value *registers, const Instruction *ip) {
+    if constexpr (opcode_info(Op).operands[I] == OperandKind::Constant)
+        return *ip->operands[I].constant;
+    else return registers[ip->operands[I].reg];
+}
+
+/**
+ * @brief whether the source operands of an instruction of a family hold the kind that its
+ *  operation takes, booleans for logic and doubles otherwise. quickened instructions only check
+ *  their registers, since constants do not change
+ */
+template <uint16_t Op> bool has_operand_kinds(const Value *registers, const Instruction *ip) {
+    constexpr OpcodeInfo info = opcode_info(Op);
+    constexpr bool is_logic = info.family == OpcodeFamily::Logic;
+    constexpr bool check_lhs = !info.is_quickened || info.operands[0] == OperandKind::Register;
+    constexpr bool check_rhs = info.operation != parser::Op::Not &&
+                               (!info.is_quickened || info.operands[1] == OperandKind::Register);
+    const auto has_kind = [](const Value &value) {
+        if constexpr (is_logic) return value.is_bool();
+        else return value.is_double();
+    };
+    return (!check_lhs || has_kind(source<Op, 0>(registers, ip))) &&
+           (!check_rhs || has_kind(source<Op, 1>(registers, ip)));
+}
+
+/**
+ * @brief whether the operands of an instruction of a family have the kinds that its handler for
+ *  verified functions assumes. arithmetic checks its operands itself, since it quickens on them
+ */
+template <uint16_t Op> bool has_assumed_kinds(const Value *registers, const Instruction *ip) {
+    constexpr OpcodeFamily family = opcode_info(Op).family;
+    if constexpr (family == OpcodeFamily::Arithmetic || family == OpcodeFamily::Quickened)
+        return true;
+    else return has_operand_kinds<Op>(registers, ip);
+}
+
+/**
+ * @brief whether a value is a matrix with an element at a row and a column, which are rounded the
+ *  same as by the list instructions
+ */
+bool has_element(const Value &matrix, const Value &row, const Value &column) {
+    if (!matrix.is_matrix() || !row.is_double() || !column.is_double()) return false;
+    const double r = std::round(row.as_double());
+    const double c = std::round(column.as_double());
+    return r >= 1 && c >= 1 && r <= static_cast<double>(matrix.as_matrix().get_height()) &&
+           c <= static_cast<double>(matrix.as_matrix().get_width());
+}
+
+/**
+ * @brief result of the operation of an instruction of a family on its source operands
+ *
+ * Comparisons are negated by the branch family, so that NaN operands still jump, the same as a
+ * comparison followed by JMRN.
+ */
+template <uint16_t Op> auto evaluate(const Value *registers, const Instruction *ip) {
+    using enum parser::Op;
+    constexpr OpcodeInfo info = opcode_info(Op);
+    if constexpr (info.operation == Not) return !source<Op, 0>(registers, ip).as_bool();
+    else if constexpr (info.operation == And)
+        return source<Op, 0>(registers, ip).as_bool() && source<Op, 1>(registers, ip).as_bool();
+    else if constexpr (info.operation == Or)
+        return source<Op, 0>(registers, ip).as_bool() || source<Op, 1>(registers, ip).as_bool();
+    else {
+        const double lhs = source<Op, 0>(registers, ip).as_double();
+        const double rhs = source<Op, 1>(registers, ip).as_double();
+        if constexpr (info.operation == Add) return lhs + rhs;
+        else if constexpr (info.operation == Sub) return lhs - rhs;
+        else if constexpr (info.operation == Mul) return lhs * rhs;
+        else if constexpr (info.operation == Div) return lhs / rhs;
+        else if constexpr (info.operation == Pow) return pow(lhs, rhs);
+        else if constexpr (info.operation == Eq) return lhs == rhs;
+        else if constexpr (info.operation == Neq) return lhs != rhs;
+        else if constexpr (info.operation == Lst) return lhs < rhs;
+        else if constexpr (info.operation == Grt) return lhs > rhs;
+        else if constexpr (info.operation == Lset) return lhs <= rhs;
+        else return lhs >= rhs;
+    }
+}
+
+/// number of times that a call site may see a different callee before it stops remembering them,
+/// see CAIR and CAMR
+constexpr uint16_t max_call_misses = 8;
+
+/// number of times that a compiled loop may find registers of other kinds than it was compiled for
+/// before its back edge stops entering it, see LOOP
+constexpr uint16_t max_loop_misses = 8;
+
+/**
+ * @brief run a compiled loop on the registers of the frame that it was compiled for
+ *
+ * The inputs of the loop are copied into a frame of raw doubles and boolean masks, and the outputs
+ * of the exit that it leaves through are copied back.
+ *
+ * @return index of the instruction that the loop left to, or nullopt if an input does not hold the
+ *  kind that the loop was compiled for
+ */
+std::optional<uint32_t> run_loop(const CompiledLoop &loop, Value *registers) {
+    std::array<uint64_t, CompiledLoop::max_slots> frame;
+    for (const CompiledLoop::Binding &input : loop.inputs) {
+        const Value &value = registers[input.reg];
+        if (value.kind() != input.kind) return std::nullopt;
+        if (value.is_double()) frame[input.slot] = std::bit_cast<uint64_t>(value.as_double());
+        else frame[input.slot] = value.as_bool() ? ~uint64_t{0} : 0;
+    }
+    const CompiledLoop::Exit &exit = loop.exits[loop.entry(frame.data())];
+    for (const CompiledLoop::Binding &output : exit.outputs) {
+        if (output.kind == Value::Kind::Double)
+            registers[output.reg] = Value(std::bit_cast<double>(frame[output.slot]));
+        else registers[output.reg] = Value(frame[output.slot] != 0);
+    }
+    return exit.target;
+}
+
+/// added to the opcodes of functions that the verifier could not prove when they are dispatched,
+/// to run handlers that check the kinds of their operands first
+constexpr uint16_t checked_opcode = 0x100;
+
+#if defined(TY_THREADED_DISPATCH)
+/**
+ * @brief handler addresses of execute<Dispatch::Threaded>, indexed by opcode, and then by opcode
+ *  with checked_opcode added
+ *
+ * Instructions keep the handlers that threaded dispatch resolved for them whichever dispatch runs
+ * them next, so there is only this table, which the threaded loop fills when it first runs. A
+ * rewrite in the switch loop looks up the new handler here too, since the instruction only has a
+ * handler if the table is filled.
+ */
+std::array<const void *, 2 * checked_opcode> threaded_handlers{};
+#endif
+} // namespace
+
+#if defined(TY_PROFILE)
+namespace {
+/**
+ * @brief opcode profile of every VM in this process, reported when the process exits
+ *
+ * The report goes to the file named by the TACHYON_PROFILE environment variable, merged with the
+ * profile that is already there, as JSON if the name ends in ".json" and as a table otherwise.
+ * Without the variable, the most executed sequences are printed to stderr.
+ */
+struct ProfileReport {
+    Profile profile;
+
+    ~ProfileReport() {
+        const char *path = std::getenv("TACHYON_PROFILE");
+        if (path == nullptr) {
+            std::cerr << "\n";
+            profile.write_table(std::cerr, 20);
+            return;
+        }
+
+        if (std::ifstream in(path); in) profile.merge(in);
+        std::ofstream out(path, std::ios::trunc);
+        if (std::string_view(path).ends_with(".json")) profile.write_json(out);
+        else profile.write_table(out);
+    }
+};
+
+Profile &profile() {
+    static ProfileReport report;
+    return report.profile;
+}
+} // namespace
+
+#define TY_PROFILE_RECORD(op) profile().record(op)
+#define TY_PROFILE_BREAK() profile().break_sequence()
+#define TY_PROFILE_BACK_EDGE(function, header) profile().record_back_edge(function, header)
+#else
+#define TY_PROFILE_RECORD(op)
+#define TY_PROFILE_BREAK()
+#define TY_PROFILE_BACK_EDGE(function, header)
+#endif
+
 std::expected<void, Error> VM::run(Proto &proto) {
-    size_t ptr = 0;
-    while (ptr < proto.bytecode.size()) {
-        TY_TRACE_HEX(proto.bytecode[ptr], "[" << ptr << "]");
+    // the top-level frame exists before the program is known, so grow it to fit. frames pushed by
+    // call are already sized for their function.
+    if (CallFrame &frame = call_stack.back(); frame.size < proto.registers) {
+        frame.size = proto.registers;
+        if (register_stack.size() < frame.base + frame.size)
+            register_stack.resize(frame.base + frame.size);
+    }
+
+    const size_t depth = call_stack.size();
+    auto result = dispatch == Dispatch::Threaded ? execute<Dispatch::Threaded>(proto)
+                                                 : execute<Dispatch::Switch>(proto);
+
+    // an error leaves behind the frames of the calls that it happened in.
+    while (call_stack.size() > depth) {
+        if (call_stack.back().proto->is_pure) keys.pop_back();
+        pop_frame();
+    }
+    if (compiler) compiler->install_finished();
+    return result;
+}
+
+VM::VM() {
+    CallFrame initial_frame{};
+    call_stack.reserve(1000);
+    call_stack.push_back(std::move(initial_frame));
+    register_stack.reserve(register_stack_reserve);
+}
+
+VM::VM(VM &&) noexcept = default;
+VM &VM::operator=(VM &&) noexcept = default;
+VM::~VM() = default;
+
+void VM::push_frame(size_t size) {
+    const size_t base = call_stack.back().base + call_stack.back().size;
+    if (register_stack.size() < base + size) register_stack.resize(base + size);
+    call_stack.push_back(CallFrame{base, size, nullptr, nullptr, Value(), Value()});
+}
+
+void VM::pop_frame() {
+    // reset the window, so that the next frame to use it starts empty and so that heap values are
+    // released now rather than when the window is reused.
+    const CallFrame &frame = call_stack.back();
+    std::fill_n(register_stack.begin() + frame.base, frame.size, Value());
+    call_stack.pop_back();
+}
+
+bool VM::has_threaded_dispatch() {
+#if defined(TY_THREADED_DISPATCH)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// TY_OP opens the handler for an opcode, TY_NEXT dispatches the following instruction, and TY_JUMP
+// dispatches the instruction at an index of the decoded stream. Every stream is terminated by a
+// return instruction (see BytecodeGenerator and decode), so there is no bounds check outside of
+// debug builds. with TY_PROFILE, every dispatched opcode is counted.
+//
+// handlers that rely on the kinds of their operands are opened with TY_CHECKED_OP instead, which
+// only runs for functions that the verifier could not prove and holds the TY_CHECKs of the
+// handler, followed by TY_UNCHECKED_OP, which opens the handler itself.
+#define TY_CHECK(condition, error)                                                                 \
+    do {                                                                                           \
+        if (!(condition)) [[unlikely]]                                                             \
+            return std::unexpected(error);                                                         \
+    } while (false)
+#if defined(TY_THREADED_DISPATCH)
+#define TY_OP(op)                                                                                  \
+    case op:                                                                                       \
+    case op | checked_opcode:                                                                      \
+    op_##op:
+#define TY_CHECKED_OP(op)                                                                          \
+    case op | checked_opcode:                                                                      \
+    checked_##op:
+#define TY_UNCHECKED_OP(op)                                                                        \
+    [[fallthrough]];                                                                               \
+    case op:                                                                                       \
+    op_##op:
+#define TY_DISPATCH()                                                                              \
+    do {                                                                                           \
+        TY_ASSERT(ip >= code && ip < code + fn->code.size());                                      \
+        TY_TRACE_HEX(ip->op, "[" << ip - code << "]");                                             \
+        TY_PROFILE_RECORD(ip->op);                                                                 \
+        if constexpr (D == Dispatch::Threaded) goto *ip->handler;                                  \
+        goto dispatch;                                                                             \
+    } while (false)
+#else
+#define TY_OP(op)                                                                                  \
+    case op:                                                                                       \
+    case op | checked_opcode:
+#define TY_CHECKED_OP(op) case op | checked_opcode:
+#define TY_UNCHECKED_OP(op)                                                                        \
+    [[fallthrough]];                                                                               \
+    case op:
+#define TY_DISPATCH()                                                                              \
+    do {                                                                                           \
+        TY_ASSERT(ip >= code && ip < code + fn->code.size());                                      \
+        TY_TRACE_HEX(ip->op, "[" << ip - code << "]");                                             \
+        TY_PROFILE_RECORD(ip->op);                                                                 \
+        goto dispatch;                                                                             \
+    } while (false)
+#endif
+#define TY_NEXT()                                                                                  \
+    do {                                                                                           \
+        ++ip;                                                                                      \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+#define TY_JUMP(target)                                                                            \
+    do {                                                                                           \
+        ip = code + (target);                                                                      \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+
+// TY_REWRITE replaces the opcode of the current instruction in place, so that later executions of
+// it run another handler. TY_DEOPTIMIZE also runs it again right away, with the new handler. the
+// opcodes that instructions are rewritten to do not check the kinds of their operands, so their
+// handlers are the same for every function.
+#if defined(TY_THREADED_DISPATCH)
+#define TY_REWRITE(to)                                                                             \
+    do {                                                                                           \
+        ip->op = (to);                                                                             \
+        if (ip->handler != nullptr) ip->handler = threaded_handlers[to];                           \
+    } while (false)
+#else
+#define TY_REWRITE(to)                                                                             \
+    do {                                                                                           \
+        ip->op = (to);                                                                             \
+    } while (false)
+#endif
+#define TY_DEOPTIMIZE(to)                                                                          \
+    do {                                                                                           \
+        TY_REWRITE(to);                                                                            \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+
+// TY_CALL continues in a new frame for the callee, or with the next instruction if the result of
+// the call is already known. TY_ENTER continues in a frame that was already pushed for the callee.
+// TY_TAIL_CALL does the same in the current frame, except for the frame that the loop was started
+// in, which belongs to the caller of run, and for compiled functions, whose result goes to the
+// current frame. TY_RETURN leaves the current frame and continues in the caller, unless the
+// current frame is the one that the loop was started in. all of them keep fn, code, ip and
+// registers pointing into the function that runs next.
+#define TY_CALL(callee, offset)                                                                    \
+    do {                                                                                           \
+        Proto &target = (callee);                                                                  \
+        TY_PROFILE_BREAK();                                                                        \
+        if (!enter(target, (offset), ip + 1)) {                                                    \
+            registers = window();                                                                  \
+            TY_NEXT();                                                                             \
+        }                                                                                          \
+        TY_ENTER(target);                                                                          \
+    } while (false)
+#define TY_ENTER(callee)                                                                           \
+    do {                                                                                           \
+        Proto &entered = (callee);                                                                 \
+        if (auto prepared = prepare(entered); !prepared) return prepared;                          \
+        fn = &entered;                                                                             \
+        checks = fn->is_verified ? 0 : checked_opcode;                                             \
+        code = fn->code.data();                                                                    \
+        ip = code;                                                                                 \
+        registers = window();                                                                      \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+#define TY_TAIL_CALL(function, offset)                                                             \
+    do {                                                                                           \
+        const Value &callee = (function);                                                          \
+        if (call_stack.size() == entry_depth || callee.as_proto()->compiled)                       \
+            TY_CALL(*callee.as_proto(), offset);                                                   \
+        TY_PROFILE_BREAK();                                                                        \
+        if (!reenter(callee, (offset))) TY_NEXT();                                                 \
+        fn = call_stack.back().proto;                                                              \
+        if (auto prepared = prepare(*fn); !prepared) return prepared;                              \
+        checks = fn->is_verified ? 0 : checked_opcode;                                             \
+        code = fn->code.data();                                                                    \
+        ip = code;                                                                                 \
+        registers = window();                                                                      \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+#define TY_RETURN(value)                                                                           \
+    do {                                                                                           \
+        if (call_stack.size() == entry_depth) {                                                    \
+            call_stack.back().returns = (value);                                                   \
+            return {};                                                                             \
+        }                                                                                          \
+        TY_PROFILE_BREAK();                                                                        \
+        ip = leave(std::move(value));                                                              \
+        fn = call_stack.back().proto;                                                              \
+        checks = fn->is_verified ? 0 : checked_opcode;                                             \
+        code = fn->code.data();                                                                    \
+        registers = window();                                                                      \
+        TY_DISPATCH();                                                                             \
+    } while (false)
+
+// TY_FAMILY_OPCODES applies X to every opcode of a family, see opcode_table. the binary forms are
+// named after the prefix of their family, the letter of their operation and the kinds of their
+// source operands. TY_FAMILY_OP generates the handler of one of them from its metadata: generic
+// arithmetic checks its operands and rewrites itself to its quickened counterpart, which only
+// rechecks register operands and rewrites back if that fails. logic and comparisons only check
+// their operands in functions that the verifier could not prove.
+#define TY_FORMS(X, prefix, letter)                                                                \
+    X(prefix##letter##CC) X(prefix##letter##RC) X(prefix##letter##CR) X(prefix##letter##RR)
+#define TY_NUMBER_FORMS(X, prefix)                                                                 \
+    TY_FORMS(X, prefix, A) TY_FORMS(X, prefix, S) TY_FORMS(X, prefix, M) TY_FORMS(X, prefix, D)    \
+    TY_FORMS(X, prefix, P)
+#define TY_COMPARISON_FORMS(X, prefix)                                                             \
+    TY_FORMS(X, prefix, E) TY_FORMS(X, prefix, N) TY_FORMS(X, prefix, L) TY_FORMS(X, prefix, G)    \
+    TY_FORMS(X, prefix, H) TY_FORMS(X, prefix, F)
+#define TY_FAMILY_OPCODES(X)                                                                       \
+    X(BNOC) X(BNOR) TY_FORMS(X, B, A) TY_FORMS(X, B, O) TY_NUMBER_FORMS(X, M)                      \
+    TY_NUMBER_FORMS(X, D) TY_COMPARISON_FORMS(X, C) TY_COMPARISON_FORMS(X, J)
+#define TY_FAMILY_OP(op)                                                                           \
+    TY_CHECKED_OP(op) {                                                                            \
+        TY_CHECK(has_assumed_kinds<op>(registers, ip), operand_error(op));                         \
+    }                                                                                              \
+    TY_UNCHECKED_OP(op) {                                                                          \
+        constexpr OpcodeInfo info = opcode_info(op);                                               \
+        if constexpr (info.family == OpcodeFamily::Arithmetic) {                                   \
+            if (!has_operand_kinds<op>(registers, ip)) [[unlikely]]                                \
+                return std::unexpected(arithmetic_error(op));                                      \
+            TY_REWRITE(info.counterpart);                                                          \
+        } else if constexpr (info.family == OpcodeFamily::Quickened) {                             \
+            if (!has_operand_kinds<op>(registers, ip)) [[unlikely]]                                \
+                TY_DEOPTIMIZE(info.counterpart);                                                   \
+        }                                                                                          \
+        if constexpr (info.family == OpcodeFamily::Branch) {                                       \
+            if (!evaluate<op>(registers, ip)) TY_JUMP(ip->operands[2].target);                     \
+        } else {                                                                                   \
+            registers[ip->operands[info.operand_count - 1].reg] = evaluate<op>(registers, ip);     \
+        }                                                                                          \
+        TY_NEXT();                                                                                 \
+    }
+#define TY_HANDLER_ADDRESS(op) dispatch_table[op] = &&op_##op;
+#define TY_CHECKED_HANDLER_ADDRESS(op) dispatch_table[op | checked_opcode] = &&checked_##op;
 
-        switch (proto.bytecode[ptr]) {
+// the lists have to name exactly the opcodes that the table puts in a family.
+#define TY_IS_FAMILY_OPCODE(op) && opcode_info(op).family != OpcodeFamily::None
+#define TY_COUNT_OPCODE(op) +1
+static_assert(true TY_FAMILY_OPCODES(TY_IS_FAMILY_OPCODE));
+static_assert(0 TY_FAMILY_OPCODES(TY_COUNT_OPCODE) ==
+              std::ranges::count_if(opcode_table, [](const OpcodeInfo &info) {
+                  return info.family != OpcodeFamily::None;
+              }));
+#undef TY_IS_FAMILY_OPCODE
+#undef TY_COUNT_OPCODE
+
+#if defined(TY_THREADED_DISPATCH)
+// labels as values are a GNU extension.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+template <Dispatch D> std::expected<void, Error> VM::execute(Proto &proto) {
+#if defined(TY_THREADED_DISPATCH)
+    // decode rejects unknown opcodes, but any gaps run RETV, the same as the default case of the
+    // switch. the switch loop takes the addresses of its own labels too, but never stores them.
+    auto &dispatch_table = threaded_handlers;
+    if (D == Dispatch::Threaded && dispatch_table[RETV] == nullptr) [[unlikely]] {
+        dispatch_table.fill(&&op_RETV);
+        dispatch_table[RETC] = &&op_RETC;
+        dispatch_table[RETR] = &&op_RETR;
+        dispatch_table[NOOP] = &&op_NOOP;
+        dispatch_table[LOCR] = &&op_LOCR;
+        dispatch_table[LORR] = &&op_LORR;
+        dispatch_table[JMPU] = &&op_JMPU;
+        dispatch_table[LOOP] = &&op_LOOP;
+        dispatch_table[JMCI] = &&op_JMCI;
+        dispatch_table[JMCN] = &&op_JMCN;
+        dispatch_table[JMRI] = &&op_JMRI;
+        dispatch_table[JMRN] = &&op_JMRN;
+        dispatch_table[CAIR] = &&op_CAIR;
+        dispatch_table[CAMR] = &&op_CAMR;
+        dispatch_table[LIUC] = &&op_LIUC;
+        dispatch_table[LIUR] = &&op_LIUR;
+        dispatch_table[LIOR] = &&op_LIOR;
+        dispatch_table[GRRC] = &&op_GRRC;
+        dispatch_table[GRRR] = &&op_GRRR;
+        dispatch_table[SRRC] = &&op_SRRC;
+        dispatch_table[SRRR] = &&op_SRRR;
+        dispatch_table[CALC] = &&op_CALC;
+        dispatch_table[CALR] = &&op_CALR;
+        dispatch_table[TALC] = &&op_TALC;
+        dispatch_table[TALR] = &&op_TALR;
+        dispatch_table[PRNC] = &&op_PRNC;
+        dispatch_table[PRNR] = &&op_PRNR;
+        TY_FAMILY_OPCODES(TY_HANDLER_ADDRESS)
+
+        // functions that the verifier could not prove run the same handlers, except where these
+        // check the kinds of their operands first.
+        std::copy_n(dispatch_table.begin(), checked_opcode, dispatch_table.begin() + checked_opcode);
+        dispatch_table[JMCI | checked_opcode] = &&checked_JMCI;
+        dispatch_table[JMCN | checked_opcode] = &&checked_JMCN;
+        dispatch_table[JMRI | checked_opcode] = &&checked_JMRI;
+        dispatch_table[JMRN | checked_opcode] = &&checked_JMRN;
+        dispatch_table[LIUC | checked_opcode] = &&checked_LIUC;
+        dispatch_table[LIUR | checked_opcode] = &&checked_LIUR;
+        dispatch_table[LIOR | checked_opcode] = &&checked_LIOR;
+        dispatch_table[GRRC | checked_opcode] = &&checked_GRRC;
+        dispatch_table[GRRR | checked_opcode] = &&checked_GRRR;
+        dispatch_table[SRRC | checked_opcode] = &&checked_SRRC;
+        dispatch_table[SRRR | checked_opcode] = &&checked_SRRR;
+        TY_FAMILY_OPCODES(TY_CHECKED_HANDLER_ADDRESS)
+    }
+#endif
+
+    // decode and verify a function the first time that it runs, and resolve its handlers for
+    // threaded dispatch the first time that it runs with it.
+    const auto prepare = [](Proto &fn) -> std::expected<void, Error> {
+        if (fn.code.empty()) [[unlikely]] {
+            auto decoded = decode(fn.bytecode, *fn.constants);
+            if (!decoded) return std::unexpected(decoded.error());
+            auto verified = verify(fn, *decoded);
+            if (!verified) return std::unexpected(verified.error());
+            fn.code = std::move(*decoded);
+            fn.is_verified = *verified;
+        }
+#if defined(TY_THREADED_DISPATCH)
+        if constexpr (D == Dispatch::Threaded) {
+            if (fn.code.front().handler == nullptr) [[unlikely]] {
+                const uint16_t checks = fn.is_verified ? 0 : checked_opcode;
+                for (Instruction &instruction : fn.code)
+                    instruction.handler = dispatch_table[instruction.op | checks];
+            }
+        }
+#endif
+        return {};
+    };
+
+    if (auto prepared = prepare(proto); !prepared) return prepared;
+
+    // calls and returns switch the function that is running without leaving this loop, until the
+    // frame that it was started in returns.
+    const size_t entry_depth = call_stack.size();
+    call_stack.back().proto = &proto;
+    Proto *fn = &proto;
+    uint16_t checks = fn->is_verified ? 0 : checked_opcode;
+    Instruction *code = fn->code.data();
+    Instruction *ip = code;
+    Value *registers = window();
+    TY_PROFILE_BREAK();
+    TY_DISPATCH();
+
+dispatch:
+    switch (ip->op | checks) {
         /* machine */
         default:
-        case RETV: {
-            return {};
+        TY_OP(RETV) {
+            // the repl echoes the last operand of the source it was given, which sits right before
+            // the terminating RETV of the top-level function. calls leave their arguments empty
+            // and their result in register 0, so a trailing call echoes that instead.
+            if (mode == Mode::Repl && call_stack.size() == 1 &&
+                ip + 1 == code + fn->code.size() && fn->bytecode.size() >= 2) {
+                const bool after_call =
+                    ip != code && ((ip - 1)->op == CALC || (ip - 1)->op == CALR ||
+                                   (ip - 1)->op == CAIR || (ip - 1)->op == CAMR);
+                print_value(registers[after_call ? 0 : *(fn->bytecode.end() - 2)]);
+                std::cout << std::endl;
+            }
+            TY_RETURN(Value());
         }
-        case RETC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            TY_ASSERT(src0 < proto.constants.size());
-            call_stack.back().returns = proto.constants[src0];
-            return {};
+        TY_OP(RETC) {
+            const Value &src0 = *ip->operands[0].constant;
+            TY_RETURN(src0);
         }
-        case RETR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            call_stack.back().returns = call_stack.back().registers[src0];
-            return {};
+        TY_OP(RETR) {
+            uint16_t src0 = ip->operands[0].reg;
+            TY_RETURN(registers[src0]);
         }
-        case NOOP: {
-            break;
+        TY_OP(NOOP) {
+            TY_NEXT();
         }
 
         /* register */
-        case LOCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            TY_ASSERT(src0 < proto.constants.size());
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = proto.constants[src0];
-            break;
-        }
-        case LORR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = call_stack.back().registers[src0];
-            break;
-        }
-
-        /* boolean logic */
-        case BNOC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = !std::get<bool>(proto.constants[src0]);
-            break;
-        }
-        case BNOR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = !std::get<bool>(call_stack.back().registers[src0]);
-            break;
-        }
-        case BACC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<bool>(proto.constants[src0]) && std::get<bool>(proto.constants[src1]);
-            break;
-        }
-        case BOCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<bool>(proto.constants[src0]) || std::get<bool>(proto.constants[src1]);
-            break;
-        }
-        case BARC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(call_stack.back().registers[src0]) &&
-                                                std::get<bool>(proto.constants[src1]);
-            break;
-        }
-        case BORC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(call_stack.back().registers[src0]) ||
-                                                std::get<bool>(proto.constants[src1]);
-            break;
-        }
-        case BACR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(proto.constants[src0]) &&
-                                                std::get<bool>(call_stack.back().registers[src1]);
-            break;
-        }
-        case BOCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(proto.constants[src0]) ||
-                                                std::get<bool>(call_stack.back().registers[src1]);
-            break;
-        }
-        case BARR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(call_stack.back().registers[src0]) &&
-                                                std::get<bool>(call_stack.back().registers[src1]);
-            break;
-        }
-        case BORR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<bool>(call_stack.back().registers[src0]) ||
-                                                std::get<bool>(call_stack.back().registers[src1]);
-            break;
+        TY_OP(LOCR) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint16_t dst0 = ip->operands[1].reg;
+            registers[dst0] = src0;
+            TY_NEXT();
+        }
+        TY_OP(LORR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t dst0 = ip->operands[1].reg;
+            registers[dst0] = registers[src0];
+            TY_NEXT();
         }
 
         /* positional */
-        case JMPU: {
-            ptr = proto.bytecode[++ptr];
-            continue; // do not increment
-        }
-        case JMCI: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            if (std::get<bool>(proto.constants[src0])) {
-                ptr = dst0;
-                continue;
-            }
-            break;
-        }
-        case JMCN: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            if (!std::get<bool>(proto.constants[src0])) {
-                ptr = dst0;
-                continue;
-            }
-            break;
-        }
-        case JMRI: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            if (std::get<bool>(call_stack.back().registers[src0])) {
-                ptr = dst0;
-                continue;
+        TY_OP(JMPU) {
+            const uint32_t target = ip->operands[0].target;
+            // a backward jump closes a loop. count how often it goes around, to find hot loops.
+            if (code + target <= ip) {
+                TY_PROFILE_BACK_EDGE(fn->name, target);
+                if (++ip->operands[1].count == hot_loop_threshold) [[unlikely]] {
+                    const auto back_edge = static_cast<uint32_t>(ip - code);
+                    // the repl reads the registers of the top-level frame after it returns.
+                    const bool keeps_frame = mode == Mode::Repl && call_stack.size() == 1;
+                    if (hot_loop_hook) hot_loop_hook(*fn, target, back_edge);
+                    // from now on the back edge enters the compiled loop, see LOOP.
+                    if (compiles_loops) {
+                        auto loop = codegen::generate_loop(*fn, target, back_edge, keeps_frame);
+                        if (loop) {
+                            ip->operands[2].loop = loop->get();
+                            fn->loops.push_back(std::move(*loop));
+                            TY_REWRITE(LOOP);
+                            TY_DISPATCH();
+                        }
+                    }
+                }
             }
-            break;
-        }
-        case JMRN: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            if (!std::get<bool>(call_stack.back().registers[src0])) {
-                ptr = dst0;
-                continue;
-            }
-            break;
-        }
-
-        /* arithmetic */
-        // TODO: for now, just assume that math operations are only working on
-        //  doubles. we can handle other issues either in the typechecker or by
-        //  allowing weak types. or, we can make it a runtime error. Or consider
-        //  using TY_ASSERT for all of these.
-        case MACC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) + std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MSCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) - std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MMCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) * std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MDCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) / std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MPCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = pow(std::get<double>(proto.constants[src0]),
-                                                    std::get<double>(proto.constants[src1]));
-            break;
-        }
-        case MARC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) +
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MSRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) -
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MMRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) *
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MDRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) /
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case MPRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                pow(std::get<double>(call_stack.back().registers[src0]),
-                    std::get<double>(proto.constants[src1]));
-            break;
-        }
-        case MACR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) +
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MSCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) -
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MMCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) *
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MDCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) /
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MPCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                pow(std::get<double>(proto.constants[src0]),
-                    std::get<double>(call_stack.back().registers[src1]));
-            break;
-        }
-        case MARR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) +
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MSRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) -
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MMRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) *
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MDRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) /
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case MPRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                pow(std::get<double>(proto.constants[src0]),
-                    std::get<double>(call_stack.back().registers[src1]));
-            break;
-        }
-
-        /* comparison */
-        // TODO: support things other than double
-        // TODO: don't allow function comparison in type checker
-        case CECC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) == std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CNCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) != std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CLCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) < std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CGCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) > std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CHCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) <= std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CFCC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(proto.constants[src0]) >= std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CERC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) ==
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CNRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) !=
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CLRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) <
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CGRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) >
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CHRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) <=
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CFRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) >=
-                std::get<double>(proto.constants[src1]);
-            break;
-        }
-        case CECR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) ==
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CNCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) !=
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CLCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) <
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CGCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) >
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CHCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) <=
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CFCR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<double>(proto.constants[src0]) >=
-                                                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CERR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) ==
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CNRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) !=
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CLRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) <
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CGRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) >
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CHRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) <=
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
-        }
-        case CFRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<double>(call_stack.back().registers[src0]) >=
-                std::get<double>(call_stack.back().registers[src1]);
-            break;
+            TY_JUMP(target);
+        }
+        TY_OP(LOOP) {
+            // continue the loop in machine code, and in the interpreter where it leaves. if the
+            // registers do not hold the kinds that the loop was compiled for, go around once more
+            // in the interpreter instead.
+            CompiledLoop &loop = *ip->operands[2].loop;
+            const std::optional<uint32_t> exit = run_loop(loop, registers);
+            if (exit) TY_JUMP(*exit);
+            if (++loop.misses == max_loop_misses) TY_REWRITE(JMPU);
+            TY_JUMP(ip->operands[0].target);
+        }
+        TY_CHECKED_OP(JMCI) {
+            TY_CHECK(ip->operands[0].constant->is_bool(), operand_error(JMCI));
+        }
+        TY_UNCHECKED_OP(JMCI) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint32_t dst0 = ip->operands[1].target;
+            if (src0.as_bool()) TY_JUMP(dst0);
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(JMCN) {
+            TY_CHECK(ip->operands[0].constant->is_bool(), operand_error(JMCN));
+        }
+        TY_UNCHECKED_OP(JMCN) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint32_t dst0 = ip->operands[1].target;
+            if (!src0.as_bool()) TY_JUMP(dst0);
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(JMRI) {
+            TY_CHECK(registers[ip->operands[0].reg].is_bool(), operand_error(JMRI));
+        }
+        TY_UNCHECKED_OP(JMRI) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint32_t dst0 = ip->operands[1].target;
+            if (registers[src0].as_bool()) TY_JUMP(dst0);
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(JMRN) {
+            TY_CHECK(registers[ip->operands[0].reg].is_bool(), operand_error(JMRN));
+        }
+        TY_UNCHECKED_OP(JMRN) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint32_t dst0 = ip->operands[1].target;
+            if (!registers[src0].as_bool()) TY_JUMP(dst0);
+            TY_NEXT();
         }
 
+        /* families */
+        // TODO: for now, arithmetic and comparison are only defined on doubles. arithmetic on
+        //  anything else is a runtime error. we can handle other issues either in the typechecker
+        //  or by allowing weak types.
+        // TODO: don't allow function comparison in type checker
+        TY_FAMILY_OPCODES(TY_FAMILY_OP)
+
         /* lists */
-        case LIUC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            std::get<Matrix>(call_stack.back().registers[dst0])
-                .push_back(std::get<double>(proto.constants[src0]));
-            break;
-        }
-        case LIUR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            std::get<Matrix>(call_stack.back().registers[dst0])
-                .push_back(std::get<double>(call_stack.back().registers[src0]));
-            break;
-        }
-        case LIOR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] =
-                std::get<Matrix>(call_stack.back().registers[src0]).pop_back();
-            break;
+        TY_CHECKED_OP(LIUC) {
+            TY_CHECK(ip->operands[0].constant->is_double(), operand_error(LIUC));
+            TY_CHECK(registers[ip->operands[1].reg].is_matrix(), operand_error(LIUC));
+        }
+        TY_UNCHECKED_OP(LIUC) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint16_t dst0 = ip->operands[1].reg;
+            registers[dst0].as_matrix().push_back(src0.as_double());
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(LIUR) {
+            TY_CHECK(registers[ip->operands[0].reg].is_double(), operand_error(LIUR));
+            TY_CHECK(registers[ip->operands[1].reg].is_matrix(), operand_error(LIUR));
+        }
+        TY_UNCHECKED_OP(LIUR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t dst0 = ip->operands[1].reg;
+            registers[dst0].as_matrix().push_back(registers[src0].as_double());
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(LIOR) {
+            TY_CHECK(registers[ip->operands[0].reg].is_matrix(), operand_error(LIOR));
+        }
+        TY_UNCHECKED_OP(LIOR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t dst0 = ip->operands[1].reg;
+            registers[dst0] = registers[src0].as_matrix().pop_back();
+            TY_NEXT();
         }
         // TODO: these use narrowing conversions. have a dedicated size type or come up with another
         //  solution.
-        case GRRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t src2 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<Matrix>(proto.constants[src2])(
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src0]))),
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src1]))));
-            break;
-        }
-        case GRRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t src2 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            call_stack.back().registers[dst0] = std::get<Matrix>(call_stack.back().registers[src2])(
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src0]))),
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src1]))));
-            break;
-        }
-        case SRRC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t src2 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            std::get<Matrix>(call_stack.back().registers[dst0])(
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src0]))),
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src1])))) =
-                std::get<double>(proto.constants[src2]);
-            break;
-        }
-        case SRRR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t src1 = proto.bytecode[++ptr];
-            uint16_t src2 = proto.bytecode[++ptr];
-            uint16_t dst0 = proto.bytecode[++ptr];
-            std::get<Matrix>(call_stack.back().registers[dst0])(
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src0]))),
-                static_cast<size_t>(
-                    std::round(std::get<double>(call_stack.back().registers[src1])))) =
-                std::get<double>(call_stack.back().registers[src2]);
-            break;
+        TY_CHECKED_OP(GRRC) {
+            TY_CHECK(has_element(*ip->operands[2].constant, registers[ip->operands[0].reg],
+                                 registers[ip->operands[1].reg]),
+                     index_error(GRRC));
+        }
+        TY_UNCHECKED_OP(GRRC) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t src1 = ip->operands[1].reg;
+            const Value &src2 = *ip->operands[2].constant;
+            uint16_t dst0 = ip->operands[3].reg;
+            registers[dst0] =
+                src2.as_matrix()(static_cast<size_t>(std::round(registers[src0].as_double())),
+                                 static_cast<size_t>(std::round(registers[src1].as_double())));
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(GRRR) {
+            TY_CHECK(has_element(registers[ip->operands[2].reg], registers[ip->operands[0].reg],
+                                 registers[ip->operands[1].reg]),
+                     index_error(GRRR));
+        }
+        TY_UNCHECKED_OP(GRRR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t src1 = ip->operands[1].reg;
+            uint16_t src2 = ip->operands[2].reg;
+            uint16_t dst0 = ip->operands[3].reg;
+            // read through a const reference, so that shared storage is not detached.
+            const Matrix &matrix = registers[src2].as_matrix();
+            registers[dst0] = matrix(static_cast<size_t>(std::round(registers[src0].as_double())),
+                                     static_cast<size_t>(std::round(registers[src1].as_double())));
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(SRRC) {
+            TY_CHECK(has_element(registers[ip->operands[3].reg], registers[ip->operands[0].reg],
+                                 registers[ip->operands[1].reg]),
+                     index_error(SRRC));
+            TY_CHECK(ip->operands[2].constant->is_double(), operand_error(SRRC));
+        }
+        TY_UNCHECKED_OP(SRRC) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t src1 = ip->operands[1].reg;
+            const Value &src2 = *ip->operands[2].constant;
+            uint16_t dst0 = ip->operands[3].reg;
+            registers[dst0].as_matrix()(
+                static_cast<size_t>(std::round(registers[src0].as_double())),
+                static_cast<size_t>(std::round(registers[src1].as_double()))) =
+                src2.as_double();
+            TY_NEXT();
+        }
+        TY_CHECKED_OP(SRRR) {
+            TY_CHECK(has_element(registers[ip->operands[3].reg], registers[ip->operands[0].reg],
+                                 registers[ip->operands[1].reg]),
+                     index_error(SRRR));
+            TY_CHECK(registers[ip->operands[2].reg].is_double(), operand_error(SRRR));
+        }
+        TY_UNCHECKED_OP(SRRR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t src1 = ip->operands[1].reg;
+            uint16_t src2 = ip->operands[2].reg;
+            uint16_t dst0 = ip->operands[3].reg;
+            registers[dst0].as_matrix()(
+                static_cast<size_t>(std::round(registers[src0].as_double())),
+                static_cast<size_t>(std::round(registers[src1].as_double()))) =
+                registers[src2].as_double();
+            TY_NEXT();
         }
 
         /* function */
-        case CALC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            TY_ASSERT(src0 < proto.constants.size());
-            uint16_t offset = proto.bytecode[++ptr];
-            auto fn = std::get<std::shared_ptr<Proto>>(proto.constants[src0]);
+        TY_OP(CALC) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint16_t offset = ip->operands[1].reg;
+            TY_CALL(*src0.as_proto(), offset);
+        }
+        TY_OP(CALR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t offset = ip->operands[1].reg;
+            if (!registers[src0].is_proto()) [[unlikely]]
+                return std::unexpected(call_error(CALR));
+            Proto &callee = *registers[src0].as_proto();
+            // a call site only caches callees whose arguments fit, so CAIR and CAMR do not check.
+            if (offset + callee.arguments > fn->registers) [[unlikely]]
+                return std::unexpected(argument_error(CALR));
+            if (ip->operands[3].reg < max_call_misses) {
+                ip->operands[2].callee = &callee;
+                TY_REWRITE(callee.compiled ? CAMR : CAIR);
+            }
+            TY_CALL(callee, offset);
+        }
+        TY_OP(CAIR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t offset = ip->operands[1].reg;
+            Proto *callee = ip->operands[2].callee;
+            if (!registers[src0].is_proto() || registers[src0].as_proto().get() != callee)
+                [[unlikely]] {
+                ++ip->operands[3].reg;
+                TY_DEOPTIMIZE(CALR);
+            }
+            if (callee->compiled) [[unlikely]]
+                TY_DEOPTIMIZE(CALR);
 
-            if (auto called_fn = call(fn, offset); !called_fn)
-                return std::unexpected(called_fn.error());
-            break;
-        }
-        case CALR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            uint16_t offset = proto.bytecode[++ptr];
-            auto fn = std::get<std::shared_ptr<Proto>>(call_stack.back().registers[src0]);
+            // a pure callee still has to look up its memoization cache first.
+            if (callee->is_pure) TY_CALL(*callee, offset);
+            TY_PROFILE_BREAK();
+            push_call(*callee, offset, ip + 1);
+            TY_ENTER(*callee);
+        }
+        TY_OP(CAMR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t offset = ip->operands[1].reg;
+            Proto *callee = ip->operands[2].callee;
+            if (!registers[src0].is_proto() || registers[src0].as_proto().get() != callee)
+                [[unlikely]] {
+                ++ip->operands[3].reg;
+                TY_DEOPTIMIZE(CALR);
+            }
+            // the code cache may have evicted the compiled code since, see call_compiled.
+            if (!callee->compiled) [[unlikely]]
+                TY_DEOPTIMIZE(CALR);
 
-            if (auto called_fn = call(fn, offset); !called_fn)
-                return std::unexpected(called_fn.error());
-            break;
+            if (callee->is_pure) TY_CALL(*callee, offset);
+            if (call_compiled(*callee, offset)) TY_NEXT();
+            TY_PROFILE_BREAK();
+            push_call(*callee, offset, ip + 1);
+            TY_ENTER(*callee);
+        }
+        TY_OP(TALC) {
+            const Value &src0 = *ip->operands[0].constant;
+            uint16_t offset = ip->operands[1].reg;
+            TY_TAIL_CALL(src0, offset);
+        }
+        TY_OP(TALR) {
+            uint16_t src0 = ip->operands[0].reg;
+            uint16_t offset = ip->operands[1].reg;
+            if (!registers[src0].is_proto()) [[unlikely]]
+                return std::unexpected(call_error(TALR));
+            if (offset + registers[src0].as_proto()->arguments > fn->registers) [[unlikely]]
+                return std::unexpected(argument_error(TALR));
+            TY_TAIL_CALL(registers[src0], offset);
         }
 
         /* intrinsic */
-        case PRNC: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            print_value(proto.constants[src0]);
-            break;
+        TY_OP(PRNC) {
+            const Value &src0 = *ip->operands[0].constant;
+            print_value(src0);
+            TY_NEXT();
         }
-        case PRNR: {
-            uint16_t src0 = proto.bytecode[++ptr];
-            print_value(call_stack.back().registers[src0]);
-            break;
+        TY_OP(PRNR) {
+            uint16_t src0 = ip->operands[0].reg;
+            print_value(registers[src0]);
+            TY_NEXT();
         }
         }
-        ++ptr;
-    }
 
-    switch (mode) {
-    default:
-    case Mode::Run:
-        return std::unexpected(Error::create(ErrorKind::InternalError, SourceSpan(0, 0),
-                                             "should not reach end of vm::run without exit"));
-    case Mode::Repl:
-        if (ptr >= 1) {
-            print_value(call_stack.back().registers[proto.bytecode[ptr - 1]]);
-            std::cout << std::endl;
-        }
-        return {};
-    }
+    std::unreachable();
 }
 
-std::expected<void, Error> VM::call(std::shared_ptr<Proto> fn, uint16_t offset) {
-    // first, load the arguments into a list:
-    Values vs;
-    for (size_t i = 0; i < fn->arguments; ++i) {
-        // start at offset + i.
-        vs.push_back(call_stack.back().registers[i + offset]);
-    }
+#if defined(TY_THREADED_DISPATCH)
+#pragma GCC diagnostic pop
+#endif
+
+#undef TY_CHECK
+#undef TY_OP
+#undef TY_CHECKED_OP
+#undef TY_UNCHECKED_OP
+#undef TY_DISPATCH
+#undef TY_NEXT
+#undef TY_JUMP
+#undef TY_REWRITE
+#undef TY_DEOPTIMIZE
+#undef TY_CALL
+#undef TY_ENTER
+#undef TY_TAIL_CALL
+#undef TY_RETURN
+#undef TY_FORMS
+#undef TY_NUMBER_FORMS
+#undef TY_COMPARISON_FORMS
+#undef TY_FAMILY_OPCODES
+#undef TY_FAMILY_OP
+#undef TY_HANDLER_ADDRESS
+#undef TY_CHECKED_HANDLER_ADDRESS
+#undef TY_PROFILE_RECORD
+#undef TY_PROFILE_BREAK
+#undef TY_PROFILE_BACK_EDGE
 
-    // then, if the function is pure, check the cache:
-    if (fn->is_pure) {
-        if (auto hit = fn->cache.get(vs)) {
+bool VM::enter(Proto &fn, uint16_t offset, Instruction *return_ip) {
+    // the arguments are read in place from the caller's registers, starting at offset.
+    std::span<Value> args(window() + offset, fn.arguments);
+
+    // if the function is pure, check the cache. the arguments are only copied once we know that
+    // the result will have to be cached, since the callee may reassign its argument registers.
+    Values key;
+    if (fn.is_pure) {
+        if (const Value *hit = fn.cache.get(args)) {
             // handle the cache hit. load the return value to register 0 of this call frame and
             // return.
-            call_stack[call_stack.size() - 1].registers[0] = *hit;
-            return {};
+            window()[0] = *hit;
+            return false;
         }
+        key.assign(args.begin(), args.end());
     }
 
-    // if we are here, we will have to run the function. begin by creating the next call
-    // frame and preparing it with the arguments:
-    std::array<Value, 256> registers;
-    for (size_t i = 0; i < fn->arguments; ++i) {
+    // first check whether we have a compiled version and if we do, run that:
+    if (fn.compiled && call_compiled(fn, offset)) [[unlikely]]
+        return false;
+
+    // if we are here, then we will have to interpret the function.
+    push_call(fn, offset, return_ip);
+    if (fn.is_pure) keys.push_back(std::move(key));
+    return true;
+}
+
+void VM::push_call(Proto &fn, uint16_t offset, Instruction *return_ip) {
+    // begin by creating the next call frame and moving the arguments into it. the argument
+    // registers are temporaries that are dead after the call, so they are left empty. creating the
+    // frame may grow the register stack, so the caller's window has to be looked up again.
+    push_frame(fn.registers);
+    Value *caller = register_stack.data() + call_stack[call_stack.size() - 2].base;
+    Value *callee = window();
+    for (size_t i = 0; i < fn.arguments; ++i) {
         // start at +1 + i index.
-        registers[i + 1] = vs[i];
+        callee[i + 1] = std::move(caller[i + offset]);
     }
-    CallFrame frame{std::move(registers), 0.0};
-    call_stack.push_back(frame);
 
-    // first check whether we have a compiled version and if we do, run that:
-    if (fn->compiled) [[unlikely]] {
-        TY_TRACE("running compiled machine code");
-        call_stack[call_stack.size() - 2].registers[0] =
-            reinterpret_cast<double (*)()>(fn->compiled)();
-        TY_TRACE(reinterpret_cast<double (*)()>(fn->compiled)());
-        call_stack.pop_back();
-        return {};
+    // the frame remembers where to continue in the caller.
+    CallFrame &frame = call_stack.back();
+    frame.proto = &fn;
+    frame.return_ip = return_ip;
+}
+
+bool VM::call_compiled(Proto &fn, uint16_t offset) {
+    // the code cache leaves freeing the code of an evicted function to the thread that runs it.
+    if (fn.is_evicted.load(std::memory_order_relaxed)) [[unlikely]] {
+        code_cache().evict(fn);
+        return false;
     }
 
-    // if we are here, then we will have to interpret the function.
-    if (auto post_fn = run(*fn); !post_fn) return std::unexpected(post_fn.error());
+    TY_TRACE("running compiled machine code");
+    Value *registers = window();
+    Value returns;
+    if (!reinterpret_cast<CompiledFunction>(fn.compiled)(registers + offset, &returns))
+        return false;
+    registers[0] = std::move(returns);
+    fn.compiled_calls.store(fn.compiled_calls.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+    return true;
+}
 
-    // load the return value of the function to register 0 of this
-    // call frame.
-    // TODO: consider just throwing this in the returns slot instead
-    //  of registers[0], so that the 0th slot can be used for other
-    //  things. blocked by bytecode generation.
-    call_stack[call_stack.size() - 2].registers[0] = call_stack.back().returns;
+bool VM::reenter(const Value &function, uint16_t offset) {
+    Proto &fn = *function.as_proto();
+    CallFrame &frame = call_stack.back();
+    Value *registers = window();
+    std::span<Value> args(registers + offset, fn.arguments);
+
+    // a cache hit is returned by the caller, the same as after a regular call.
+    Values key;
+    if (fn.is_pure) {
+        if (const Value *hit = fn.cache.get(args)) {
+            registers[0] = *hit;
+            return false;
+        }
+        key.assign(args.begin(), args.end());
+    }
+
+    // the caller gives up its frame before its result is known, so the result of a pure caller is
+    // not cached.
+    if (frame.proto->is_pure) keys.pop_back();
+    if (fn.is_pure) keys.push_back(std::move(key));
+
+    // the function value may sit in one of the registers that are about to be overwritten.
+    Value callee = function;
+
+    // move the arguments down to start at register 1. they are temporaries after the variables of
+    // the caller, so moving upwards never overwrites an argument that is still to be moved. then
+    // reset the rest of the frame, so that the callee starts out the same as in a new frame.
+    for (size_t i = 0; i < fn.arguments; ++i)
+        registers[i + 1] = std::move(registers[i + offset]);
+    registers[0] = Value();
+    std::fill(registers + fn.arguments + 1, registers + frame.size, Value());
+
+    // this is the last frame, so it can be resized in place.
+    if (register_stack.size() < frame.base + fn.registers)
+        register_stack.resize(frame.base + fn.registers);
+    frame.size = fn.registers;
+    frame.proto = &fn;
+    frame.function = std::move(callee);
+    return true;
+}
+
+Instruction *VM::leave(Value returns) {
+    CallFrame &frame = call_stack.back();
+    Proto &fn = *frame.proto;
+    Instruction *return_ip = frame.return_ip;
 
     // if the function is pure, put result in cache.
-    if (fn->is_pure) {
-        fn->cache.put(vs, call_stack.back().returns);
+    if (fn.is_pure) {
+        fn.cache.put(std::move(keys.back()), returns);
+        keys.pop_back();
     }
 
-    // if we hit the counter, generate machine code
-    if (fn->can_generate_irmc && ++fn->compilation_counter >= 10) {
-        auto arena = codegen::generate_ir(fn);
-        if (!arena) {
-            TY_TRACE("failed to generate intermediate representation");
-            fn->can_generate_irmc = false;
-            call_stack.pop_back();
-            return {};
-        }
-        if (!codegen::generate_machine(*arena, fn, call_stack.back().registers.data())) {
-            fn->can_generate_irmc = false;
-            TY_TRACE("failed to generate machine code");
+    // once the function is hot, compile it. the counter stays at the threshold until the code is
+    // installed, so that the function is not compiled twice.
+    if (fn.can_generate_irmc && !fn.compiled && fn.compilation_counter < compilation_threshold &&
+        ++fn.compilation_counter == compilation_threshold) {
+        if (!compiles_in_background) {
+            install(fn, compile(fn));
+        } else {
+            if (!compiler) compiler = std::make_unique<BackgroundCompiler>();
+            compiler->submit(fn);
         }
     }
+    if (compiler) compiler->install_finished();
 
-    // remove call frame.
-    call_stack.pop_back();
+    // remove call frame, then load the return value of the function to register 0 of this call
+    // frame.
+    // TODO: consider just throwing this in the returns slot instead
+    //  of registers[0], so that the 0th slot can be used for other
+    //  things. blocked by bytecode generation.
+    pop_frame();
+    window()[0] = std::move(returns);
 
-    return {};
+    return return_ip;
 }
 
 void VM::doctor() const {
     std::println("vm state:");
     for (const CallFrame &call : call_stack) {
-        for (const Value &reg : call.registers) {
-            print_value(reg);
+        for (size_t i = 0; i < call.size; ++i) {
+            print_value(register_stack[call.base + i]);
             std::print(" ");
         }
         std::print("\nreturned: ");
@@ -0,0 +1,100 @@
+#include "background_compiler.hpp"
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <semaphore>
+#include <thread>
+
+using namespace tachyon::runtime;
+
+static std::unique_ptr<Proto> hot_proto(const char *name)
+{
+    auto proto = std::make_unique<Proto>(std::vector<uint16_t>{RETV}, std::vector<Value>{}, 0,
+                                         false, true, name, tachyon::SourceSpan(0, 0), 1);
+    proto->compilation_counter = VM::compilation_threshold;
+    return proto;
+}
+
+static std::vector<uint8_t> ret = {0xC3};
+
+TEST(BackgroundCompilerTest, InstallsFinishedCode)
+{
+    auto fn = hot_proto("fn");
+    BackgroundCompiler compiler([](const Proto &) { return ret; });
+    compiler.submit(*fn);
+    ASSERT_EQ(fn->compiler, &compiler);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!fn->compiled && std::chrono::steady_clock::now() < deadline)
+    {
+        compiler.install_finished();
+        std::this_thread::yield();
+    }
+    ASSERT_NE(fn->compiled, nullptr);
+    ASSERT_EQ(fn->compiler, nullptr);
+}
+
+// the first job blocks until it is released, so destroying its function has to return while it
+// runs.
+TEST(BackgroundCompilerTest, ForgetsDestroyedFunctionsWithoutWaiting)
+{
+    std::binary_semaphore started{0};
+    std::binary_semaphore released{0};
+    std::atomic<int> compiled = 0;
+    {
+        BackgroundCompiler compiler(
+            [&](const Proto &)
+            {
+                started.release();
+                (void)released.try_acquire_for(std::chrono::seconds(10));
+                ++compiled;
+                return ret;
+            });
+        auto slow = hot_proto("slow");
+        auto queued = hot_proto("queued");
+        compiler.submit(*slow);
+        compiler.submit(*queued);
+        started.acquire();
+
+        slow.reset();
+        queued.reset();
+        ASSERT_EQ(compiled, 0);
+
+        // the code of the forgotten job is thrown away once it finishes.
+        released.release();
+        compiler.install_finished();
+    }
+    ASSERT_EQ(compiled, 1);
+}
+
+TEST(BackgroundCompilerTest, DropsUnfinishedJobsWhenDestroyed)
+{
+    std::binary_semaphore started{0};
+    std::binary_semaphore released{0};
+    auto slow = hot_proto("slow");
+    auto queued = hot_proto("queued");
+    {
+        BackgroundCompiler compiler(
+            [&](const Proto &)
+            {
+                started.release();
+                (void)released.try_acquire_for(std::chrono::seconds(10));
+                return ret;
+            });
+        compiler.submit(*slow);
+        compiler.submit(*queued);
+        started.acquire();
+        released.release();
+    }
+    for (const Proto *fn : {slow.get(), queued.get()})
+    {
+        ASSERT_EQ(fn->compiler, nullptr);
+        ASSERT_EQ(fn->compiled, nullptr);
+        ASSERT_EQ(fn->compilation_counter, 0);
+    }
+}
@@ -0,0 +1,54 @@
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/instruction.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace tachyon::runtime;
+using tachyon::parser::Op;
+
+TEST(BytecodeTest, NamesEveryOpcode)
+{
+    for (uint16_t op = 0; op < opcode_table.size(); ++op)
+    {
+        if (!opcode_info(op).is_known()) continue;
+        ASSERT_EQ(opcode_named(opcode_info(op).mnemonic()), op);
+    }
+    ASSERT_STREQ(bytecode_to_str(MSCR), "MSCR");
+    ASSERT_STREQ(bytecode_to_str(0x03), "unknown");
+    ASSERT_FALSE(opcode_named("XXXX").has_value());
+}
+
+TEST(BytecodeTest, DescribesFamilies)
+{
+    const OpcodeInfo &info = opcode_info(JHCR);
+    ASSERT_EQ(info.family, OpcodeFamily::Branch);
+    ASSERT_EQ(info.operation, Op::Lset);
+    ASSERT_EQ(info.operand_count, 3);
+    ASSERT_EQ(info.operands[0], OperandKind::Constant);
+    ASSERT_EQ(info.operands[1], OperandKind::Register);
+    ASSERT_EQ(info.operands[2], OperandKind::Target);
+
+    ASSERT_EQ(opcode_info(MPRC).counterpart, DPRC);
+    ASSERT_EQ(opcode_info(DPRC).counterpart, MPRC);
+    ASSERT_EQ(opcode_info(BNOR).operation, Op::Not);
+    ASSERT_FALSE(opcode_info(PRNR).is_pure);
+    ASSERT_TRUE(opcode_info(GRRC).is_pure);
+}
+
+TEST(BytecodeTest, FindsFamilyOpcodes)
+{
+    using enum OperandKind;
+    ASSERT_EQ(family_opcode(OpcodeFamily::Arithmetic, Op::Div, Register, Constant), MDRC);
+    ASSERT_EQ(family_opcode(OpcodeFamily::Comparison, Op::Gret, Constant, Constant), CFCC);
+    ASSERT_EQ(family_opcode(OpcodeFamily::Branch, Op::Neq, Register, Register), JNRR);
+    ASSERT_EQ(family_opcode(OpcodeFamily::Logic, Op::Or, Constant, Register), BOCR);
+    ASSERT_FALSE(family_opcode(OpcodeFamily::Logic, Op::Add, Register, Register).has_value());
+}
+
+TEST(BytecodeTest, DecodeRejectsQuickenedOpcodes)
+{
+    std::vector<Value> constants{Value(1.0)};
+    ASSERT_TRUE(decode({MARC, 0, 0, 1, RETR, 1}, constants).has_value());
+    ASSERT_FALSE(decode({DARC, 0, 0, 1, RETR, 1}, constants).has_value());
+    ASSERT_FALSE(decode({LOOP, 0}, constants).has_value());
+}
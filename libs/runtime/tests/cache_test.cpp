@@ -0,0 +1,47 @@
+#include "tachyon/runtime/cache.hpp"
+
+#include <gtest/gtest.h>
+#include <span>
+
+using namespace tachyon::runtime;
+
+TEST(CacheTest, Miss)
+{
+    Cache cache;
+    Values args{Value(1.), Value(2.)};
+    ASSERT_EQ(cache.get(args), nullptr);
+}
+
+TEST(CacheTest, HitWithoutCopyingArguments)
+{
+    Cache cache;
+    cache.put(Values{Value(1.), Value("a")}, Value(3.));
+
+    // the lookup only views the caller's arguments.
+    Value registers[] = {Value(), Value(1.), Value("a"), Value()};
+    const Value *hit = cache.get(std::span<const Value>(registers + 1, 2));
+    ASSERT_NE(hit, nullptr);
+    ASSERT_EQ(hit->as_double(), 3.);
+    ASSERT_EQ(cache.get(std::span<const Value>(registers, 2)), nullptr);
+}
+
+TEST(CacheTest, PutReplaces)
+{
+    Cache cache;
+    cache.put(Values{Value(1.)}, Value(1.));
+    cache.put(Values{Value(1.)}, Value(2.));
+    cache.put(Values{Value(2.)}, Value(4.));
+
+    Values args{Value(1.)};
+    ASSERT_EQ(cache.get(args)->as_double(), 2.);
+}
+
+TEST(CacheTest, SurvivesMove)
+{
+    Cache cache;
+    cache.put(Values{Value("key")}, Value(1.));
+    Cache moved(std::move(cache));
+
+    Values args{Value("key")};
+    ASSERT_NE(moved.get(args), nullptr);
+}
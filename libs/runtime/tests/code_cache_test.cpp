@@ -0,0 +1,127 @@
+#include "tachyon/runtime/code_cache.hpp"
+#include "tachyon/runtime/proto.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+using namespace tachyon::runtime;
+
+// mov eax, value; ret
+static std::vector<uint8_t> returning(uint8_t value)
+{
+    return {0xB8, value, 0x00, 0x00, 0x00, 0xC3};
+}
+
+static int call(void *code)
+{
+    return reinterpret_cast<int (*)()>(code)();
+}
+
+TEST(CodeCacheTest, AllocatesExecutableBlocks)
+{
+    CodeCache cache;
+    void *first = cache.allocate(returning(1)).value();
+    void *second = cache.allocate(returning(2)).value();
+    ASSERT_EQ(call(first), 1);
+    ASSERT_EQ(call(second), 2);
+    ASSERT_EQ(cache.used(), 12);
+    ASSERT_EQ(cache.reserved(), CodeCache::default_chunk_size);
+}
+
+TEST(CodeCacheTest, AlignsBlocks)
+{
+    CodeCache cache;
+    cache.allocate(returning(1), 1).value();
+    void *aligned = cache.allocate(returning(2), 64).value();
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0);
+    ASSERT_EQ(call(aligned), 2);
+
+    // the padding before the aligned block is free, and fits a small block.
+    void *packed = cache.allocate(returning(3), 1).value();
+    ASSERT_LT(packed, aligned);
+    ASSERT_EQ(call(packed), 3);
+}
+
+TEST(CodeCacheTest, ReusesFreedBlocks)
+{
+    CodeCache cache;
+    void *first = cache.allocate(returning(1)).value();
+    void *second = cache.allocate(returning(2)).value();
+    cache.free(first, 6);
+    ASSERT_EQ(cache.used(), 6);
+
+    void *third = cache.allocate(returning(3)).value();
+    ASSERT_EQ(third, first);
+    ASSERT_EQ(call(third), 3);
+    ASSERT_EQ(call(second), 2);
+}
+
+TEST(CodeCacheTest, UnmapsFreeChunks)
+{
+    CodeCache cache(4096);
+    const std::vector<uint8_t> large(4000, 0xC3);
+    void *first = cache.allocate(large).value();
+    void *second = cache.allocate(large).value();
+    ASSERT_EQ(cache.reserved(), 2 * 4096);
+
+    // blocks never span chunks, even if the chunks are mapped next to each other.
+    cache.free(first, large.size());
+    cache.free(second, large.size());
+    ASSERT_EQ(cache.used(), 0);
+    ASSERT_EQ(cache.reserved(), 4096);
+    cache.allocate(std::vector<uint8_t>(4096, 0xC3), 1).value();
+    ASSERT_EQ(cache.reserved(), 4096);
+}
+
+TEST(CodeCacheTest, EvictsColdestFunctions)
+{
+    // the cache is destroyed first, which leaves the functions without code.
+    Proto first, second, third;
+    CodeCache cache;
+    cache.set_budget(12);
+    cache.install(first, returning(1)).value();
+    cache.install(second, returning(2)).value();
+    first.compiled_calls = 5;
+    ASSERT_EQ(cache.used(), 12);
+
+    // the function that was just installed stays, even though it was not called yet. the coldest
+    // other one is only marked, since another thread may still run its code.
+    cache.install(third, returning(3)).value();
+    ASSERT_EQ(cache.used(), 18);
+    ASSERT_FALSE(first.is_evicted);
+    ASSERT_TRUE(second.is_evicted);
+    ASSERT_EQ(call(second.compiled), 2);
+    ASSERT_EQ(call(third.compiled), 3);
+    ASSERT_EQ(first.compiled_calls, 2);
+
+    // the thread that calls it next frees it.
+    cache.evict(second);
+    ASSERT_EQ(second.compiled, nullptr);
+    ASSERT_FALSE(second.is_evicted);
+    ASSERT_EQ(cache.used(), 12);
+
+    cache.evict(first);
+    ASSERT_EQ(first.compiled, nullptr);
+    ASSERT_EQ(cache.used(), 6);
+}
+
+TEST(CodeCacheTest, CountsMarkedFunctionsAsFreed)
+{
+    Proto first, second, third, fourth;
+    CodeCache cache;
+    cache.set_budget(12);
+    cache.install(first, returning(1)).value();
+    cache.install(second, returning(2)).value();
+    second.compiled_calls = 5;
+    cache.install(third, returning(3)).value();
+    ASSERT_TRUE(first.is_evicted);
+    cache.evict(third);
+
+    // the code of first is going to be freed, so the cache is within its budget without marking
+    // second.
+    cache.install(fourth, returning(4)).value();
+    ASSERT_EQ(cache.used(), 18);
+    ASSERT_FALSE(second.is_evicted);
+}
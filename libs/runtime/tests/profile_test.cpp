@@ -0,0 +1,85 @@
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/profile.hpp"
+
+#include <gtest/gtest.h>
+#include <sstream>
+
+using namespace tachyon::runtime;
+
+static Profile loop_profile()
+{
+    Profile profile;
+    for (int i = 0; i < 3; ++i)
+    {
+        profile.record(JLRC);
+        profile.record(MARC);
+        profile.record(JMPU);
+        profile.record_back_edge("loop", 0);
+    }
+    return profile;
+}
+
+TEST(ProfileTest, CountsSequences)
+{
+    Profile profile = loop_profile();
+    ASSERT_EQ(profile.count({JLRC}), 3);
+    ASSERT_EQ(profile.count({JLRC, MARC}), 3);
+    ASSERT_EQ(profile.count({JMPU, JLRC}), 2);
+    ASSERT_EQ(profile.count({JLRC, MARC, JMPU}), 3);
+    ASSERT_EQ(profile.count({MARC, JLRC}), 0);
+}
+
+TEST(ProfileTest, BreaksSequences)
+{
+    Profile profile;
+    profile.record(CALR);
+    profile.break_sequence();
+    profile.record(MARC);
+    ASSERT_EQ(profile.count({MARC}), 1);
+    ASSERT_EQ(profile.count({CALR, MARC}), 0);
+}
+
+TEST(ProfileTest, MergesTables)
+{
+    std::stringstream table;
+    loop_profile().write_table(table);
+
+    Profile profile = loop_profile();
+    profile.merge(table);
+    ASSERT_EQ(profile.count({MARC}), 6);
+    ASSERT_EQ(profile.count({JMPU, JLRC}), 4);
+    ASSERT_EQ(profile.count({JLRC, MARC, JMPU}), 6);
+    ASSERT_EQ(profile.back_edge_count("loop", 0), 6);
+}
+
+TEST(ProfileTest, MergesJson)
+{
+    std::stringstream json;
+    loop_profile().write_json(json);
+
+    Profile profile;
+    ASSERT_TRUE(profile.empty());
+    profile.merge(json);
+    ASSERT_EQ(profile.count({MARC}), 3);
+    ASSERT_EQ(profile.count({JMPU, JLRC}), 2);
+    ASSERT_EQ(profile.count({MARC, JMPU, JLRC}), 2);
+    ASSERT_EQ(profile.back_edge_count("loop", 0), 3);
+}
+
+TEST(ProfileTest, CountsBackEdges)
+{
+    Profile profile;
+    profile.record_back_edge("", 4);
+    profile.record_back_edge("", 4);
+    profile.record_back_edge("main", 4);
+    ASSERT_EQ(profile.back_edge_count("", 4), 2);
+    ASSERT_EQ(profile.back_edge_count("main", 4), 1);
+    ASSERT_EQ(profile.back_edge_count("main", 2), 0);
+
+    // anonymous functions keep their name when written and read back.
+    std::stringstream table;
+    profile.write_table(table);
+    Profile merged;
+    merged.merge(table);
+    ASSERT_EQ(merged.back_edge_count("", 4), 2);
+}
@@ -0,0 +1,83 @@
+#include "tachyon/runtime/proto.hpp"
+#include "tachyon/runtime/value.hpp"
+
+#include <cmath>
+#include <gtest/gtest.h>
+
+using namespace tachyon::runtime;
+
+TEST(ValueTest, Size)
+{
+    ASSERT_EQ(sizeof(Value), 8);
+}
+
+TEST(ValueTest, Kinds)
+{
+    ASSERT_EQ(Value().kind(), Value::Kind::Nil);
+    ASSERT_EQ(Value(1.5).kind(), Value::Kind::Double);
+    ASSERT_EQ(Value(true).kind(), Value::Kind::Bool);
+    ASSERT_EQ(Value("text").kind(), Value::Kind::String);
+    ASSERT_EQ(Value(Matrix(std::vector<double>{1, 2})).kind(), Value::Kind::Matrix);
+    ASSERT_EQ(Value(std::make_shared<Proto>()).kind(), Value::Kind::Proto);
+}
+
+TEST(ValueTest, Doubles)
+{
+    ASSERT_EQ(Value(-1.5).as_double(), -1.5);
+    ASSERT_EQ(Value(-INFINITY).as_double(), -INFINITY);
+    ASSERT_TRUE(Value(-INFINITY).is_double());
+
+    // every NaN stays a double, whatever its sign or payload.
+    ASSERT_TRUE(Value(-NAN).is_double());
+    ASSERT_TRUE(std::isnan(Value(std::bit_cast<double>(0xFFFF'0000'0000'0001)).as_double()));
+    ASSERT_NE(Value(NAN), Value(NAN));
+    ASSERT_EQ(Value(0.0), Value(-0.0));
+}
+
+TEST(ValueTest, Equality)
+{
+    ASSERT_EQ(Value(), Value());
+    ASSERT_EQ(Value(false), Value(false));
+    ASSERT_NE(Value(false), Value(true));
+    ASSERT_EQ(Value("a"), Value("a"));
+    ASSERT_NE(Value("a"), Value(1.0));
+    ASSERT_EQ(Value(Matrix(std::vector<double>{1, 2})), Value(Matrix(std::vector<double>{1, 2})));
+    ASSERT_NE(Value(Matrix(std::vector<double>{1, 2})), Value(Matrix(std::vector<double>{1, 3})));
+}
+
+TEST(ValueTest, CopiesShareStrings)
+{
+    Value a("text");
+    Value b = a;
+    ASSERT_EQ(&a.as_string(), &b.as_string());
+}
+
+TEST(ValueTest, CopiesCloneMatrices)
+{
+    Value a(Matrix(std::vector<double>{1, 2}));
+    Value b = a;
+    b.as_matrix()(1) = 3;
+    ASSERT_EQ(a.as_matrix()(1), 1);
+    ASSERT_EQ(b.as_matrix()(1), 3);
+}
+
+TEST(ValueTest, ProtoLifetime)
+{
+    auto proto = std::make_shared<Proto>();
+    {
+        Value a(proto);
+        Value b = a;
+        Value c = std::move(b);
+        ASSERT_EQ(proto.use_count(), 2);
+        ASSERT_TRUE(b.is_nil());
+    }
+    ASSERT_EQ(proto.use_count(), 1);
+}
+
+TEST(ValueTest, Hash)
+{
+    ValueHash h;
+    ASSERT_EQ(h(Value(2.0)), h(Value(2.0)));
+    ASSERT_EQ(h(Value("a")), h(Value("a")));
+    ASSERT_EQ(h(Value(Matrix(std::vector<double>{1, 2}))), h(Value(Matrix(std::vector<double>{1, 2}))));
+}
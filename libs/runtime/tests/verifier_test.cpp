@@ -0,0 +1,70 @@
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/instruction.hpp"
+#include "tachyon/runtime/proto.hpp"
+#include "tachyon/runtime/verifier.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+using namespace tachyon::runtime;
+
+static std::expected<bool, tachyon::Error> verify_bytecode(std::vector<uint16_t> bytecode,
+                                                           std::vector<Value> constants,
+                                                           size_t arguments, size_t registers)
+{
+    Proto proto(std::move(bytecode), std::move(constants), arguments, false, false, "verified",
+                tachyon::SourceSpan(0, 0), registers);
+    auto code = decode(proto.bytecode, *proto.constants);
+    EXPECT_TRUE(code.has_value());
+    return verify(proto, *code);
+}
+
+TEST(VerifierTest, RejectsRegistersOutsideOfTheFrame)
+{
+    ASSERT_FALSE(verify_bytecode({LOCR, 0, 2, RETR, 1}, {Value(1.0)}, 0, 2).has_value());
+    ASSERT_FALSE(verify_bytecode({RETR, 0}, {}, 2, 2).has_value());
+    ASSERT_TRUE(verify_bytecode({LOCR, 0, 1, RETR, 1}, {Value(1.0)}, 0, 2).has_value());
+}
+
+TEST(VerifierTest, RejectsMalformedCalls)
+{
+    auto callee = std::make_shared<Proto>(std::vector<uint16_t>{RETR, 1}, std::vector<Value>{}, 1,
+                                          false, false, "callee", tachyon::SourceSpan(0, 0), 2);
+
+    // the argument of the callee would be read from past the end of the frame.
+    ASSERT_FALSE(verify_bytecode({CALC, 0, 2, RETR, 0}, {Value(callee)}, 0, 2).has_value());
+    ASSERT_TRUE(verify_bytecode({CALC, 0, 1, RETR, 0}, {Value(callee)}, 0, 2).has_value());
+
+    ASSERT_FALSE(verify_bytecode({CALC, 0, 1, RETR, 0}, {Value(1.0)}, 0, 2).has_value());
+    ASSERT_FALSE(verify_bytecode({TALC, 0, 1, RETR, 1}, {Value(callee)}, 0, 2).has_value());
+}
+
+// r1 = 1, r2 = 2, r3 = r1 < r2, r3 = !r3, return r3
+TEST(VerifierTest, ProvesStraightLineCode)
+{
+    auto verified = verify_bytecode({LOCR, 0, 1, LOCR, 1, 2, CLRR, 1, 2, 3, BNOR, 3, 3, RETR, 3},
+                                    {Value(1.0), Value(2.0)}, 0, 4);
+    ASSERT_TRUE(verified.value());
+}
+
+// the kind of an argument is not known, so the comparison has to check it.
+TEST(VerifierTest, DoesNotProveArguments)
+{
+    ASSERT_FALSE(verify_bytecode({CLRC, 1, 0, 2, RETR, 2}, {Value(1.0)}, 1, 3).value());
+}
+
+// r1 = 0, while r1 < 10 { r1 = r1 + 1 }, return r1. the loop is proven if r1 holds a double on
+// both paths into the comparison, and not if the body loads a string instead.
+TEST(VerifierTest, MergesKindsAtJumps)
+{
+    std::vector<Value> constants{Value(0.0), Value(10.0), Value(1.0), Value("one")};
+    ASSERT_TRUE(verify_bytecode(
+                    {LOCR, 0, 1, CLRC, 1, 1, 2, JMRN, 2, 16, MARC, 1, 2, 1, JMPU, 3, RETR, 1},
+                    constants, 0, 3)
+                    .value());
+    ASSERT_FALSE(verify_bytecode(
+                     {LOCR, 0, 1, CLRC, 1, 1, 2, JMRN, 2, 15, LOCR, 3, 1, JMPU, 3, RETR, 1},
+                     constants, 0, 3)
+                     .value());
+}
@@ -0,0 +1,193 @@
+#include "tachyon/runtime/bytecode.hpp"
+#include "tachyon/runtime/proto.hpp"
+#include "tachyon/runtime/vm.hpp"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+using namespace tachyon::runtime;
+
+// r1 = 1, r2 = 2, r3 = r1 + r2, r3 = r3 * 3, return r3
+static Proto arithmetic_proto()
+{
+    return Proto({LOCR, 0, 1, LOCR, 1, 2, MARR, 1, 2, 3, MMRC, 3, 2, 3, RETR, 3},
+                 {Value(1.0), Value(2.0), Value(3.0)}, 0, false, false, "arithmetic",
+                 tachyon::SourceSpan(0, 0), 4);
+}
+
+static void expect_quickening(Dispatch dispatch)
+{
+    VM vm;
+    vm.set_dispatch(dispatch);
+    Proto proto = arithmetic_proto();
+
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, DARR);
+    ASSERT_EQ(proto.code[3].op, DMRC);
+
+    // quickened instructions keep running while their operands are doubles.
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, DARR);
+
+    // the register operand is no longer a double, so the instruction falls back to the generic
+    // handler, which reports the error.
+    (*proto.constants)[1] = Value("two");
+    ASSERT_FALSE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, MARR);
+    ASSERT_EQ(proto.code[3].op, DMRC);
+
+    // and it is quickened again once it sees doubles.
+    (*proto.constants)[1] = Value(2.0);
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, DARR);
+}
+
+TEST(VMTest, QuickensArithmeticWithSwitchDispatch)
+{
+    expect_quickening(Dispatch::Switch);
+}
+
+TEST(VMTest, QuickensArithmeticWithThreadedDispatch)
+{
+    expect_quickening(Dispatch::Threaded);
+}
+
+// instructions that the switch loop rewrites keep handlers that the threaded loop can run.
+TEST(VMTest, QuickensAcrossDispatches)
+{
+    VM threaded;
+    threaded.set_dispatch(Dispatch::Threaded);
+    VM switched;
+    switched.set_dispatch(Dispatch::Switch);
+    Proto proto = arithmetic_proto();
+
+    ASSERT_TRUE(threaded.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, DARR);
+
+    (*proto.constants)[1] = Value("two");
+    ASSERT_FALSE(switched.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, MARR);
+
+    (*proto.constants)[1] = Value(2.0);
+    ASSERT_TRUE(threaded.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, DARR);
+    ASSERT_TRUE(switched.run(proto).has_value());
+    ASSERT_TRUE(threaded.run(proto).has_value());
+}
+
+TEST(VMTest, ArithmeticOnStringsFails)
+{
+    VM vm;
+    Proto proto({MACC, 0, 1, 1, RETR, 1}, {Value(1.0), Value("one")}, 0, false, false, "strings",
+                tachyon::SourceSpan(0, 0), 2);
+    ASSERT_FALSE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[0].op, MACC);
+}
+
+// the verifier does not know what register 1 holds when the function starts, so the comparison
+// checks it and reports the error.
+TEST(VMTest, ComparisonOfNilFails)
+{
+    for (Dispatch dispatch : {Dispatch::Switch, Dispatch::Threaded})
+    {
+        VM vm;
+        vm.set_dispatch(dispatch);
+        Proto proto({CLRC, 1, 0, 2, RETR, 2}, {Value(1.0)}, 0, false, false, "nil",
+                    tachyon::SourceSpan(0, 0), 3);
+        ASSERT_FALSE(vm.run(proto).has_value());
+        ASSERT_FALSE(proto.is_verified);
+    }
+}
+
+// r1 = 0, while r1 < 2000 { r1 = r1 + 1 }, return r1
+TEST(VMTest, ReportsHotLoops)
+{
+    VM vm;
+    std::vector<std::pair<uint32_t, uint32_t>> hot_loops;
+    vm.set_hot_loop_hook([&](Proto &, uint32_t header, uint32_t back_edge)
+                         { hot_loops.emplace_back(header, back_edge); });
+    Proto proto({LOCR, 0, 1, CLRC, 1, 1, 2, JMRN, 2, 16, MARC, 1, 2, 1, JMPU, 3, RETR, 1},
+                {Value(0.0), Value(2000.0), Value(1.0)}, 0, false, false, "loop",
+                tachyon::SourceSpan(0, 0), 3);
+
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(hot_loops, (std::vector<std::pair<uint32_t, uint32_t>>{{1, 4}}));
+
+    // the rest of the loop ran in machine code, entered from the back edge.
+    ASSERT_EQ(proto.code[4].op, LOOP);
+    ASSERT_EQ(proto.code[4].operands[1].count, VM::hot_loop_threshold);
+    ASSERT_EQ(proto.loops.size(), 1);
+}
+
+TEST(VMTest, InterpretsHotLoopsWithoutLoopCompilation)
+{
+    VM vm;
+    vm.set_loop_compilation(false);
+    size_t hot_loops = 0;
+    vm.set_hot_loop_hook([&](Proto &, uint32_t, uint32_t) { ++hot_loops; });
+    Proto proto({LOCR, 0, 1, CLRC, 1, 1, 2, JMRN, 2, 16, MARC, 1, 2, 1, JMPU, 3, RETR, 1},
+                {Value(0.0), Value(2000.0), Value(1.0)}, 0, false, false, "loop",
+                tachyon::SourceSpan(0, 0), 3);
+
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(hot_loops, 1);
+    ASSERT_EQ(proto.code[4].op, JMPU);
+    ASSERT_EQ(proto.code[4].operands[1].count, 2000);
+    ASSERT_TRUE(proto.loops.empty());
+}
+
+// returns its argument
+static std::shared_ptr<Proto> identity_proto()
+{
+    return std::make_shared<Proto>(std::vector<uint16_t>{RETR, 1}, std::vector<Value>{}, 1, false,
+                                   false, "identity", tachyon::SourceSpan(0, 0), 2);
+}
+
+// r1 = callee, r2 = 2, r0 = r1(r2), return r0
+static Proto call_proto(std::shared_ptr<Proto> callee)
+{
+    return Proto({LOCR, 0, 1, LOCR, 1, 2, CALR, 1, 2, RETR, 0},
+                 {Value(std::move(callee)), Value(2.0)}, 0, false, false, "call",
+                 tachyon::SourceSpan(0, 0), 3);
+}
+
+TEST(VMTest, CachesCallee)
+{
+    VM vm;
+    std::shared_ptr<Proto> first = identity_proto();
+    Proto proto = call_proto(first);
+
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, CAIR);
+    ASSERT_EQ(proto.code[2].operands[2].callee, first.get());
+
+    // a different callee misses, and the call site remembers that one instead.
+    std::shared_ptr<Proto> second = identity_proto();
+    (*proto.constants)[0] = Value(second);
+    ASSERT_TRUE(vm.run(proto).has_value());
+    ASSERT_EQ(proto.code[2].op, CAIR);
+    ASSERT_EQ(proto.code[2].operands[2].callee, second.get());
+}
+
+TEST(VMTest, StopsCachingCalleesThatKeepChanging)
+{
+    VM vm;
+    std::shared_ptr<Proto> callees[] = {identity_proto(), identity_proto()};
+    Proto proto = call_proto(callees[0]);
+
+    for (size_t i = 0; i < 32; ++i)
+    {
+        (*proto.constants)[0] = Value(callees[i % 2]);
+        ASSERT_TRUE(vm.run(proto).has_value());
+    }
+    ASSERT_EQ(proto.code[2].op, CALR);
+}
+
+TEST(VMTest, CallOfNumberFails)
+{
+    VM vm;
+    Proto proto({LOCR, 0, 1, CALR, 1, 2, RETR, 0}, {Value(1.0)}, 0, false, false, "number",
+                tachyon::SourceSpan(0, 0), 3);
+    ASSERT_FALSE(vm.run(proto).has_value());
+}
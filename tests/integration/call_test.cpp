@@ -0,0 +1,345 @@
+#include "tachyon/codegen/bytecode_generator.hpp"
+#include "tachyon/lexer/lexer.hpp"
+#include "tachyon/parser/parser.hpp"
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+using namespace tachyon;
+
+static runtime::Proto compile(const std::string &source) {
+    lexer::Lexer lexer = lexer::lex(source);
+    EXPECT_TRUE(lexer.errors.empty());
+    return parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+        .and_then(codegen::generate_main_proto)
+        .value();
+}
+
+static std::expected<void, Error> run(runtime::VM &vm, const std::string &source) {
+    lexer::Lexer lexer = lexer::lex(source);
+    EXPECT_TRUE(lexer.errors.empty());
+    return parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+        .and_then(codegen::generate_main_proto)
+        .and_then([&vm](runtime::Proto proto) -> std::expected<void, Error> {
+            return vm.run(proto);
+        });
+}
+
+// calls do not use the native stack, so recursion is only limited by memory. adding a string
+// fails the program if the depth comes out wrong.
+static const std::string deep_recursion_source = R"(count = fn(n, count) {
+  if n == 0 { return 0; }
+  r = count(n - 1, count)
+  return r + 1
+}
+depth = count(200000, count)
+if depth != 200000 { depth = depth + "wrong depth"; }
+return 0;)";
+
+TEST(CallTest, DeepRecursion) {
+    runtime::VM vm{};
+    run(vm, deep_recursion_source).value();
+}
+
+static const std::string failing_call_source = R"(inner = fn(x) { return x + "not a number"; }
+outer = fn(x, inner) {
+  y = inner(x)
+  return y
+}
+outer(1, inner)
+return 0;)";
+
+TEST(CallTest, ErrorInCallUnwinds) {
+    runtime::VM vm{};
+    ASSERT_FALSE(run(vm, failing_call_source).has_value());
+
+    // the frames of the failed calls are gone, so the same vm can run again.
+    run(vm, deep_recursion_source).value();
+}
+
+// every level returns a call, so the loop runs in one frame.
+static const std::string tail_recursion_source = R"(loop = fn(n, total, loop) {
+  if n == 0 { return total; }
+  return loop(n - 1, total + 2, loop)
+}
+total = loop(1000000, 0, loop)
+if total != 2000000 { total = total + "wrong total"; }
+return 0;)";
+
+TEST(CallTest, TailRecursion) {
+    runtime::Proto proto = compile(tail_recursion_source);
+
+    // the returned call is a tail call, the call in main is not.
+    auto function = std::ranges::find_if(*proto.constants,
+                                         [](const runtime::Value &v) { return v.is_proto(); });
+    ASSERT_NE(function, proto.constants->end());
+    const std::vector<uint16_t> &loop = function->as_proto()->bytecode;
+    ASSERT_NE(std::ranges::find(loop, runtime::TALR), loop.end());
+    ASSERT_EQ(std::ranges::find(proto.bytecode, runtime::TALR), proto.bytecode.end());
+
+    runtime::VM vm{};
+    vm.run(proto).value();
+}
+
+static const std::string mutual_tail_recursion_source = R"(even = fn(n, even, odd) {
+  if n == 0 { return 1; }
+  return odd(n - 1, even, odd)
+}
+odd = fn(n, even, odd) {
+  if n == 0 { return 0; }
+  return even(n - 1, even, odd)
+}
+e = even(100001, even, odd)
+o = odd(100001, even, odd)
+if e != 0 { e = e + "wrong parity"; }
+if o != 1 { o = o + "wrong parity"; }
+return 0;)";
+
+TEST(CallTest, MutualTailRecursion) {
+    runtime::VM vm{};
+    run(vm, mutual_tail_recursion_source).value();
+}
+
+
+// twenty values are live before they are subtracted, more than there are XMM registers, so the
+// compiled function keeps some of them on the stack.
+static const std::string spilling_source = R"(u = fn(x) {
+  a = x + 1
+  b = x + 2
+  c = x + 3
+  d = x + 4
+  e = x + 5
+  f = x + 6
+  g = x + 7
+  h = x + 8
+  i = x + 9
+  j = x + 10
+  k = x + 11
+  l = x + 12
+  m = x + 13
+  n = x + 14
+  o = x + 15
+  p = x + 16
+  q = x + 17
+  r = x + 18
+  s = x + 19
+  t = x + 20
+  return t - s - r - q - p - o - n - m - l - k - j - i - h - g - f - e - d - c - b - a
+}
+v = 0
+while v < 20 {
+  w = u(v)
+  e = 0 - 18 * v - 170
+  if w != e { w = w + "wrong result"; }
+  v = v + 1
+}
+return 0;)";
+
+TEST(CallTest, CompiledFunctionsSpillValues) {
+    runtime::Proto proto = compile(spilling_source);
+    runtime::VM vm{};
+    vm.set_background_compilation(false);
+    vm.run(proto).value();
+
+    auto function = std::ranges::find_if(*proto.constants,
+                                         [](const runtime::Value &v) { return v.is_proto(); });
+    ASSERT_NE(function, proto.constants->end());
+    ASSERT_NE(function->as_proto()->compiled, nullptr);
+}
+
+// the functions are compiled on their tenth call, and their results are checked against values
+// that main works out itself. comparisons with NaN only hold for !=.
+static const std::string compiled_control_flow_source = R"(gcd = fn(a, b) {
+  while b > 0 {
+    if a >= b {
+      a = a - b
+    } else {
+      t = a
+      a = b
+      b = t
+    }
+  }
+  return a
+}
+swap = fn(n) {
+  p = 1
+  q = 2
+  while n > 0 {
+    w = p
+    p = q
+    q = w
+    n = n - 1
+  }
+  return p * 10 + q
+}
+power = fn(e) {
+  return 2 ^ e
+}
+compare = fn(c, d) {
+  m = 0
+  if c < d { m = m + 1; }
+  if c <= d { m = m + 2; }
+  if c > d { m = m + 4; }
+  if c >= d { m = m + 8; }
+  if c == d { m = m + 16; }
+  if c != d { m = m + 32; }
+  if (c < d) || (c == d) { m = m + 64; }
+  return m
+}
+v = 1
+swapped = 21
+doubled = 2
+while v < 30 {
+  r = gcd(6 * v, 4 * v)
+  if r != (2 * v) { v = v + "wrong gcd"; }
+  r = swap(v)
+  if r != swapped { v = v + "wrong swap"; }
+  r = power(v)
+  if r != doubled { v = v + "wrong power"; }
+  s = 0
+  if v < 15 { s = s + 1; }
+  if v <= 15 { s = s + 2; }
+  if v > 15 { s = s + 4; }
+  if v >= 15 { s = s + 8; }
+  if v == 15 { s = s + 16; }
+  if v != 15 { s = s + 32; }
+  if (v < 15) || (v == 15) { s = s + 64; }
+  r = compare(v, 15)
+  if r != s { v = v + "wrong comparison"; }
+  r = compare(0 / 0, v)
+  if r != 32 { v = v + "wrong comparison with NaN"; }
+  swapped = 33 - swapped
+  doubled = doubled * 2
+  v = v + 1
+}
+return 0;)";
+
+TEST(CallTest, CompilesBranchesLoopsAndPowers) {
+    runtime::Proto proto = compile(compiled_control_flow_source);
+    runtime::VM vm{};
+    vm.set_background_compilation(false);
+    vm.run(proto).value();
+
+    for (const runtime::Value &constant : *proto.constants) {
+        if (constant.is_proto()) {
+            EXPECT_NE(constant.as_proto()->compiled, nullptr);
+        }
+    }
+}
+
+// with no room for more than one function, every function that is compiled evicts the others,
+// which are interpreted until they are compiled again.
+TEST(CallTest, CodeCacheEvictsFunctionsOverBudget) {
+    runtime::Proto proto = compile(compiled_control_flow_source);
+    runtime::CodeCache &cache = runtime::code_cache();
+    const size_t budget = cache.budget();
+    cache.set_budget(0);
+    runtime::VM vm{};
+    vm.set_background_compilation(false);
+    auto ran = vm.run(proto);
+    cache.set_budget(budget);
+    ran.value();
+
+    // the others are marked, and freed once they are called again.
+    const auto compiled = std::ranges::count_if(*proto.constants, [](const runtime::Value &v) {
+        return v.is_proto() && v.as_proto()->compiled && !v.as_proto()->is_evicted;
+    });
+    ASSERT_EQ(compiled, 1);
+}
+
+// the programs share the code cache, so each thread evicts functions that the other one runs.
+TEST(CallTest, CodeCacheEvictsFunctionsOfOtherThreads) {
+    runtime::CodeCache &cache = runtime::code_cache();
+    const size_t budget = cache.budget();
+    cache.set_budget(0);
+    std::expected<void, Error> ran[2];
+    {
+        std::jthread first([&] {
+            runtime::VM vm{};
+            ran[0] = run(vm, compiled_control_flow_source);
+        });
+        std::jthread second([&] {
+            runtime::VM vm{};
+            ran[1] = run(vm, compiled_control_flow_source);
+        });
+    }
+    cache.set_budget(budget);
+    ran[0].value();
+    ran[1].value();
+}
+
+// scale is compiled once and then called from every depth of deep. the program runs again on a
+// second vm, whose registers are elsewhere.
+static const std::string compiled_depth_source = R"(scale = fn(z) { return z * 3; }
+below = fn(k) { return k < 10; }
+deep = fn(n, deep, scale) {
+  if n == 0 { return 0; }
+  r = deep(n - 1, deep, scale)
+  t = scale(n)
+  return r + t
+}
+v = 0
+count = 0
+while v < 20 {
+  r = deep(v, deep, scale)
+  if r != (3 * v * (v + 1) / 2) { v = v + "wrong depth"; }
+  b = below(v)
+  if b { count = count + 1; }
+  v = v + 1
+}
+if count != 10 { v = v + "wrong boolean"; }
+return 0;)";
+
+TEST(CallTest, CompiledFunctionsRunAtAnyDepth) {
+    runtime::Proto proto = compile(compiled_depth_source);
+    runtime::VM vm{};
+    vm.set_background_compilation(false);
+    vm.run(proto).value();
+    runtime::VM other{};
+    other.run(proto).value();
+
+    auto scale = std::ranges::find_if(*proto.constants,
+                                      [](const runtime::Value &v) { return v.is_proto(); });
+    ASSERT_NE(scale, proto.constants->end());
+    ASSERT_NE(scale->as_proto()->compiled, nullptr);
+}
+
+// join is compiled for numbers, so a string is passed to the interpreter, which fails on it.
+static const std::string compiled_argument_source = R"(join = fn(g, h) { return g + h; }
+v = 0
+while v < 20 {
+  j = join(v, 1)
+  if j != (v + 1) { v = v + "wrong sum"; }
+  v = v + 1
+}
+j = join("a", 1)
+return 0;)";
+
+TEST(CallTest, CompiledFunctionsCheckTheirArguments) {
+    runtime::VM vm{};
+    ASSERT_FALSE(run(vm, compiled_argument_source).has_value());
+}
+
+// functions are compiled on a thread of their own by default, or on the thread that runs them.
+// run does not wait for the compiler thread, so the program runs again until the code of every
+// function was installed.
+TEST(CallTest, CompilesInTheBackgroundOrInPlace) {
+    for (bool in_background : {true, false}) {
+        runtime::Proto proto = compile(compiled_control_flow_source);
+        runtime::VM vm{};
+        vm.set_background_compilation(in_background);
+        const auto is_compiled = [&] {
+            return std::ranges::all_of(*proto.constants, [](const runtime::Value &v) {
+                return !v.is_proto() || v.as_proto()->compiled;
+            });
+        };
+        vm.run(proto).value();
+        for (int runs = 1; in_background && !is_compiled() && runs < 1000; ++runs)
+            vm.run(proto).value();
+        EXPECT_TRUE(is_compiled());
+    }
+}
@@ -1,6 +1,7 @@
 #include "tachyon/codegen/bytecode_generator.hpp"
 #include "tachyon/lexer/lexer.hpp"
 #include "tachyon/parser/parser.hpp"
+#include "tachyon/runtime/instruction.hpp"
 
 #include <gtest/gtest.h>
 
@@ -28,3 +29,47 @@ TEST(ComparisonTest, AllOperators) {
         })
         .value();
 }
+
+// every loop and if condition is a comparison, so none of them should need a bool register. the
+// loops only terminate if the branches are taken correctly.
+static const std::string branches_source = R"(i = 0
+while (i < 10) {
+  i = i + 1
+}
+while (20 > i) {
+  i = i + 1
+}
+n = 0
+if (i == 20) {
+  n = n + 1
+}
+if (i != 20) {
+  n = 100
+} else if (i >= 20) {
+  n = n + 1
+}
+if (1 <= 2) {
+  n = n + 1
+}
+while (n <= i) {
+  n = n + 1
+}
+return n;)";
+
+TEST(ComparisonTest, FusedBranches) {
+    lexer::Lexer lexer = lexer::lex(branches_source);
+    ASSERT_TRUE(lexer.errors.empty());
+    runtime::Proto proto =
+        parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+            .and_then(codegen::generate_main_proto)
+            .value();
+
+    auto code = runtime::decode(proto.bytecode, *proto.constants).value();
+    for (const runtime::Instruction &instruction : code) {
+        ASSERT_FALSE(instruction.op >= runtime::CECC && instruction.op <= runtime::CFRR);
+        ASSERT_NE(instruction.op, runtime::JMRN);
+    }
+
+    runtime::VM vm{};
+    vm.run(proto).value();
+}
@@ -0,0 +1,97 @@
+#include "tachyon/codegen/bytecode_generator.hpp"
+#include "tachyon/lexer/lexer.hpp"
+#include "tachyon/parser/parser.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace tachyon;
+
+static const std::string duplicates_source = R"(a = 1
+b = 1
+s = "one"
+t = "one"
+f = fn(x) { return x + 1; }
+f = fn(x) { return x + 1; }
+g = fn(x) { return x + 1; }
+h = fn(x) { return x + 2; }
+m = [1, 2]
+n = [1, 2]
+r = f(a)
+q = h(b)
+if r != 2 { r = r + "wrong"; }
+if q != 3 { q = q + "wrong"; }
+return 0;)";
+
+TEST(ConstantPoolTest, InternsConstantsOfModule) {
+    lexer::Lexer lexer = lexer::lex(duplicates_source);
+    ASSERT_TRUE(lexer.errors.empty());
+    runtime::Proto proto = parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+                               .and_then(codegen::generate_main_proto)
+                               .value();
+
+    // identical numbers, strings and functions are stored once, also when they are used by
+    // different functions. functions are only identical if they have the same name as well, and
+    // the templates of matrix literals are filled at run time, so they are never shared.
+    const runtime::ConstantPool &pool = *proto.constants;
+    ASSERT_EQ(std::ranges::count(pool, runtime::Value(1.0)), 1);
+    ASSERT_EQ(std::ranges::count(pool, runtime::Value("one")), 1);
+    ASSERT_EQ(std::ranges::count(pool, runtime::Value("wrong")), 1);
+    ASSERT_EQ(std::ranges::count_if(pool, [](const runtime::Value &v) { return v.is_matrix(); }),
+              2);
+    std::vector<std::string> names;
+    for (const runtime::Value &value : pool)
+        if (value.is_proto()) names.push_back(value.as_proto()->name);
+    ASSERT_EQ(names, (std::vector<std::string>{"f", "g", "h"}));
+
+    // the nested functions index the pool of the module, which only the top-level function owns.
+    for (const runtime::Value &value : pool) {
+        if (!value.is_proto()) continue;
+        ASSERT_EQ(value.as_proto()->constants.get(), proto.constants.get());
+        ASSERT_EQ(value.as_proto()->constants.use_count(), 0);
+    }
+
+    runtime::VM vm{};
+    vm.run(proto).value();
+}
+
+// the function is pure, so its memoization cache holds the arguments of its calls, which include
+// the function itself.
+static const std::string self_reference_source = R"(count = fn(n, count) {
+  if n == 0 { return 0; }
+  r = count(n - 1, count)
+  return r + 1
+}
+depth = count(100, count)
+if depth != 100 { depth = depth + "wrong depth"; }
+return 0;)";
+
+TEST(ConstantPoolTest, ReleasesFunctionsOfModule) {
+    lexer::Lexer lexer = lexer::lex(self_reference_source);
+    ASSERT_TRUE(lexer.errors.empty());
+    std::optional<runtime::Proto> proto =
+        parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+            .and_then(codegen::generate_main_proto)
+            .value();
+
+    // the top-level function owns the functions of the module, which the pool only refers to.
+    ASSERT_EQ(proto->functions.size(), 1);
+    std::weak_ptr<runtime::Proto> function = proto->functions.front();
+    ASSERT_TRUE(proto->functions.front()->is_pure);
+    for (const runtime::Value &value : *proto->constants) {
+        if (!value.is_proto()) continue;
+        ASSERT_EQ(value.as_proto().use_count(), 0);
+    }
+
+    {
+        runtime::VM vm{};
+        vm.run(*proto).value();
+    }
+    proto.reset();
+    ASSERT_TRUE(function.expired());
+}
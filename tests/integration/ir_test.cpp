@@ -0,0 +1,140 @@
+#include "tachyon/codegen/bytecode_generator.hpp"
+#include "tachyon/codegen/ir_generator.hpp"
+#include "tachyon/lexer/lexer.hpp"
+#include "tachyon/parser/parser.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using namespace tachyon;
+
+static runtime::Proto compile(const std::string &source) {
+    lexer::Lexer lexer = lexer::lex(source);
+    EXPECT_TRUE(lexer.errors.empty());
+    return parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+        .and_then(codegen::generate_main_proto)
+        .value();
+}
+
+static std::vector<codegen::IRValue> instructions_of(const codegen::IRFunction &ir,
+                                                     uint32_t block, codegen::IROpcode opcode) {
+    std::vector<codegen::IRValue> found;
+    std::ranges::copy_if(ir.blocks[block].instructions, std::back_inserter(found),
+                         [&](codegen::IRValue value) { return ir[value].opcode == opcode; });
+    return found;
+}
+
+// every operand has to be defined by an instruction that a block still holds, and every block has
+// to end in its only terminator.
+static void expect_well_formed(const codegen::IRFunction &ir) {
+    std::vector<bool> live(ir.instructions.size());
+    for (const codegen::IRBlock &block : ir.blocks)
+        for (codegen::IRValue value : block.instructions) live[value] = true;
+    for (uint32_t b = 0; b < ir.blocks.size(); ++b) {
+        const codegen::IRBlock &block = ir.blocks[b];
+        ASSERT_FALSE(block.instructions.empty());
+        EXPECT_TRUE(codegen::is_terminator(ir.terminator(b).opcode));
+        for (codegen::IRValue value : block.instructions) {
+            EXPECT_EQ(ir[value].block, b);
+            for (codegen::IRValue operand : ir[value].operands) EXPECT_TRUE(live[operand]);
+            if (ir[value].opcode == codegen::IROpcode::Phi) {
+                EXPECT_EQ(ir[value].operands.size(), block.predecessors.size());
+            }
+        }
+    }
+}
+
+// the header of the loop joins the entry and the body, so i and s each get a phi there.
+static const std::string loop_source = R"(i = 0
+s = 0
+while i < 10 {
+  s = s + i * 2
+  i = i + 1
+}
+print(s)
+return 0;)";
+
+TEST(IRTest, BuildsPhisForLoops) {
+    runtime::Proto proto = compile(loop_source);
+    codegen::IRFunction ir = codegen::generate_ir(proto).value();
+    expect_well_formed(ir);
+    ASSERT_EQ(ir.blocks.size(), 4);
+
+    const codegen::IRBlock &header = ir.blocks[1];
+    ASSERT_EQ(header.predecessors.size(), 2);
+    const auto phis = instructions_of(ir, 1, codegen::IROpcode::Phi);
+    ASSERT_EQ(phis.size(), 2);
+    for (codegen::IRValue phi : phis) EXPECT_EQ(ir[phi].type, codegen::IRType::Double);
+
+    const codegen::IRInstruction &branch = ir.terminator(1);
+    ASSERT_EQ(branch.opcode, codegen::IROpcode::Branch);
+    EXPECT_EQ(ir[branch.operands[0]].opcode, codegen::IROpcode::Lst);
+    EXPECT_EQ(ir[branch.operands[0]].type, codegen::IRType::Bool);
+    EXPECT_EQ(ir.terminator(ir.blocks[1].successors[0]).opcode, codegen::IROpcode::Jump);
+    EXPECT_EQ(ir.terminator(ir.blocks[1].successors[1]).opcode, codegen::IROpcode::Return);
+}
+
+static const std::string call_source = R"(f = fn(x, y) {
+  if x < y { return x; }
+  return y + 1
+}
+m = [1, 2, 3]
+m[1, 2] = 5
+return f(m[1, 1], 2);)";
+
+// the parameters of a function are not typed, but the results of arithmetic on them are.
+TEST(IRTest, ConvertsBranchesOfFunctions) {
+    runtime::Proto proto = compile(call_source);
+    const auto callee = std::ranges::find_if(*proto.constants,
+                                             [](const runtime::Value &v) { return v.is_proto(); });
+    ASSERT_NE(callee, proto.constants->end());
+    codegen::IRFunction ir = codegen::generate_ir(*callee->as_proto()).value();
+    expect_well_formed(ir);
+
+    const auto parameters = instructions_of(ir, 0, codegen::IROpcode::Parameter);
+    ASSERT_EQ(parameters.size(), 2);
+    EXPECT_EQ(ir[parameters[0]].type, codegen::IRType::Any);
+    ASSERT_EQ(ir.terminator(0).opcode, codegen::IROpcode::Branch);
+    ASSERT_EQ(ir.blocks[0].successors.size(), 2);
+
+    const codegen::IRInstruction &taken = ir.terminator(ir.blocks[0].successors[0]);
+    ASSERT_EQ(taken.opcode, codegen::IROpcode::Return);
+    EXPECT_EQ(taken.operands[0], parameters[0]);
+    const codegen::IRInstruction &fallen = ir.terminator(ir.blocks[0].successors[1]);
+    ASSERT_EQ(fallen.opcode, codegen::IROpcode::Return);
+    EXPECT_EQ(ir[fallen.operands[0]].opcode, codegen::IROpcode::Add);
+    EXPECT_EQ(ir[fallen.operands[0]].type, codegen::IRType::Double);
+
+    // of the constants of the module, the function only uses the 1 that it adds.
+    ASSERT_EQ(ir.constants.size(), 1);
+    EXPECT_EQ(ir.constants[0], runtime::Value(1.0));
+}
+
+// the store produces a new list, which the load then reads from, and the call takes its arguments
+// as values.
+TEST(IRTest, ModelsListsAsValues) {
+    runtime::Proto proto = compile(call_source);
+    codegen::IRFunction ir = codegen::generate_ir(proto).value();
+    expect_well_formed(ir);
+    ASSERT_EQ(ir.blocks.size(), 1);
+
+    const auto stores = instructions_of(ir, 0, codegen::IROpcode::Store);
+    const auto loads = instructions_of(ir, 0, codegen::IROpcode::Load);
+    ASSERT_EQ(stores.size(), 1);
+    ASSERT_EQ(loads.size(), 1);
+    EXPECT_EQ(ir[stores[0]].type, codegen::IRType::Matrix);
+    EXPECT_EQ(ir[ir[stores[0]].operands[0]].opcode, codegen::IROpcode::Push);
+    EXPECT_EQ(ir[loads[0]].operands[0], stores[0]);
+    EXPECT_EQ(ir[loads[0]].type, codegen::IRType::Double);
+
+    const auto calls = instructions_of(ir, 0, codegen::IROpcode::TailCall);
+    ASSERT_EQ(calls.size(), 1);
+    ASSERT_EQ(ir[calls[0]].operands.size(), 3);
+    EXPECT_EQ(ir[ir[calls[0]].operands[0]].type, codegen::IRType::Function);
+    EXPECT_EQ(ir[calls[0]].operands[1], loads[0]);
+    EXPECT_EQ(ir.terminator(0).operands[0], calls[0]);
+}
@@ -0,0 +1,90 @@
+#include "tachyon/codegen/bytecode_generator.hpp"
+#include "tachyon/lexer/lexer.hpp"
+#include "tachyon/parser/parser.hpp"
+#include "tachyon/runtime/bytecode.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+
+using namespace tachyon;
+
+static runtime::Proto compile(const std::string &source) {
+    lexer::Lexer lexer = lexer::lex(source);
+    EXPECT_TRUE(lexer.errors.empty());
+    return parser::parse(std::move(lexer.tokens), std::move(lexer.constants))
+        .and_then(codegen::generate_main_proto)
+        .value();
+}
+
+static bool enters_compiled_loop(const runtime::Proto &proto) {
+    return std::ranges::any_of(
+        proto.code, [](const runtime::Instruction &i) { return i.op == runtime::LOOP; });
+}
+
+// the loop gets hot long before it ends, so most of it runs in machine code. adding a string fails
+// the program if the registers come back wrong.
+static const std::string hot_loop_source = R"(i = 0
+s = 0
+t = 0
+while i < 100000 {
+  d = i - 3
+  s = s + d * d / 2
+  c = d > 5
+  e = i < 7
+  b = c || e
+  if !b { t = t + 1; }
+  i = i + 1
+}
+if i != 100000 { i = i + "wrong count"; }
+if s != 166649167275000 { s = s + "wrong sum"; }
+if t != 2 { t = t + "wrong branches"; }
+return 0;)";
+
+TEST(LoopTest, ContinuesHotLoopInMachineCode) {
+    runtime::Proto proto = compile(hot_loop_source);
+    runtime::VM vm{};
+    vm.run(proto).value();
+    ASSERT_TRUE(enters_compiled_loop(proto));
+    ASSERT_EQ(proto.loops.size(), 1);
+}
+
+// the inner loop is compiled first and left at its exit on every turn of the outer loop, which is
+// then compiled with the inner loop in it.
+static const std::string nested_loop_source = R"(i = 0
+n = 0
+while i < 2000 {
+  j = 0
+  while j < 10 {
+    n = n + 1
+    j = j + 1
+  }
+  i = i + 1
+}
+if n != 20000 { n = n + "wrong count"; }
+return 0;)";
+
+TEST(LoopTest, CompilesNestedLoops) {
+    runtime::Proto proto = compile(nested_loop_source);
+    runtime::VM vm{};
+    vm.run(proto).value();
+    ASSERT_EQ(proto.loops.size(), 2);
+}
+
+// a loop that works on strings stays in the interpreter.
+static const std::string string_loop_source = R"(i = 0
+s = ""
+while i < 2000 {
+  s = "x"
+  i = i + 1
+}
+if i != 2000 { i = i + "wrong count"; }
+return 0;)";
+
+TEST(LoopTest, InterpretsUnsupportedLoops) {
+    runtime::Proto proto = compile(string_loop_source);
+    runtime::VM vm{};
+    vm.run(proto).value();
+    ASSERT_FALSE(enters_compiled_loop(proto));
+}